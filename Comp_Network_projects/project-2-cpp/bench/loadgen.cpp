@@ -0,0 +1,525 @@
+/*
+loadgen
+-------
+
+    End-to-end load generator for the put/get file server. It speaks the same
+    framing as the client (common/NetIO) and reports throughput and tail
+    latency so changes to server.cpp can be compared run against run.
+
+Usage:
+    ./loadgen.out [options] <server_host>
+
+      -p <port>        server port (default SERVER_PORT)
+      -x <host[:port]> route every connection through the project-2 proxy
+                       (the proxy port defaults to PROXY_PORT)
+      -c <conns>       concurrent connections (default 4)
+      -d <seconds>     run time of the measured phase (default 10)
+      -n <ops>         stop after this many operations instead of -d
+      -m <ratio>       fraction of operations that are puts, 0..1 (default 0.5)
+      -s <dist>        file-size distribution (default fixed:64k)
+                         fixed:<n>           every file is n bytes
+                         uniform:<min>:<max> uniform in [min, max]
+                         exp:<mean>          exponential with the given mean
+                       sizes accept k/m/g suffixes
+      -P <depth>       pipelining depth per connection (default 1)
+      -k <keys>        files pre-populated per connection for gets (default 16)
+      -U <path>        connect to the server's local Unix socket instead of
+                       TCP (host is then optional and only used as a label)
+      -S               with -U, move file bodies through the shared-memory
+                       rings (see common/ShmRing.h)
+      -j               print one JSON object instead of the text report
+
+Each connection uploads its own key set (lg_c<conn>_k<key>) in a warm-up
+phase, then issues a random put/get mix against those keys. A writer thread
+keeps up to <depth> requests in flight while a reader thread consumes the
+responses in order; latency is measured from the first byte of a request to
+the last byte of its response.
+*/
+
+#include "../common/NetIO.h"
+#include "../common/UnixSock.h"
+#include "../common/ShmRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#define SERVER_PORT 5432
+#define PROXY_PORT 5465
+
+static const size_t IO_BUFFER_SIZE = 64 * 1024;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host;
+    int port = SERVER_PORT;
+    std::string proxyHost;
+    int proxyPort = PROXY_PORT;
+    int conns = 4;
+    double seconds = 10.0;
+    long maxOps = 0;
+    double putRatio = 0.5;
+    std::string sizeDist = "fixed:64k";
+    int depth = 1;
+    int keys = 16;
+    std::string localPath;
+    bool shm = false;
+    bool json = false;
+};
+
+// One server connection: the socket plus the rings when -S negotiated them
+struct Link {
+    int s = -1;
+    std::unique_ptr<ShmTransport> shm;
+    bool sendBody(const void *buf, size_t len) {
+        return shm ? shm->toServer.write(buf, len) : sendAll(s, buf, len);
+    }
+    bool recvBody(void *buf, size_t len) {
+        return shm ? shm->toClient.read(buf, len) : recvExact(s, buf, len);
+    }
+};
+
+// Size distribution parsed from -s
+struct SizeDist {
+    enum Kind { FIXED, UNIFORM, EXP } kind = FIXED;
+    size_t a = 64 * 1024;
+    size_t b = 64 * 1024;
+
+    size_t sample(std::mt19937_64 &rng) const {
+        switch (kind) {
+            case FIXED: return a;
+            case UNIFORM: return std::uniform_int_distribution<size_t>(a, b)(rng);
+            case EXP: {
+                std::exponential_distribution<double> d(1.0 / static_cast<double>(a));
+                return static_cast<size_t>(d(rng));
+            }
+        }
+        return a;
+    }
+};
+
+// One finished operation as seen by the reader thread
+struct Sample {
+    bool isPut;
+    bool ok;
+    size_t bytes;
+    uint64_t latencyNs;
+};
+
+// One request the writer has sent and the reader has not answered yet
+struct Pending {
+    bool isPut;
+    int key;
+    size_t bytes;
+    Clock::time_point start;
+};
+
+static std::atomic<bool> stopFlag(false);
+static std::atomic<long> opsIssued(0);
+static std::vector<char> payload;
+
+static bool parseSize(const std::string &s, size_t &out) {
+    if (s.empty()) return false;
+    char* end = nullptr;
+    double v = std::strtod(s.c_str(), &end);
+    if (end == s.c_str() || v < 0) return false;
+    switch (*end) {
+        case 'k': case 'K': v *= 1024.0; end++; break;
+        case 'm': case 'M': v *= 1024.0 * 1024.0; end++; break;
+        case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return false;
+    out = static_cast<size_t>(v);
+    return true;
+}
+
+static bool parseDist(const std::string &spec, SizeDist &out) {
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ':')) parts.push_back(item);
+    if (parts.size() == 2 && parts[0] == "fixed") {
+        out.kind = SizeDist::FIXED;
+        return parseSize(parts[1], out.a);
+    }
+    if (parts.size() == 3 && parts[0] == "uniform") {
+        out.kind = SizeDist::UNIFORM;
+        return parseSize(parts[1], out.a) && parseSize(parts[2], out.b) && out.a <= out.b;
+    }
+    if (parts.size() == 2 && parts[0] == "exp") {
+        out.kind = SizeDist::EXP;
+        return parseSize(parts[1], out.a) && out.a > 0;
+    }
+    return false;
+}
+
+static int connectTo(const std::string &host, int port) {
+    struct hostent *hp = gethostbyname(host.c_str());
+    if (!hp) {
+        std::cerr << "loadgen: unknown host: " << host << std::endl;
+        return -1;
+    }
+    struct sockaddr_in sin;
+    bzero((char *)&sin, sizeof(sin));
+    sin.sin_family = AF_INET;
+    bcopy(hp->h_addr, (char *)&sin.sin_addr, hp->h_length);
+    sin.sin_port = htons(port);
+    int s = socket(PF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+        perror("loadgen: socket");
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("loadgen: connect");
+        close(s);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+// Local connection: Unix socket, optionally upgraded to shared-memory rings
+static bool openLocal(const Options &opt, Link &link) {
+    if ((link.s = connectUnix(opt.localPath)) < 0) {
+        perror("loadgen: connect");
+        return false;
+    }
+    if (!opt.shm) return true;
+    std::string header = std::string("shm ") + std::to_string(SHM_RING_CAPACITY) + "\n";
+    std::string resp;
+    int fds[5];
+    std::unique_ptr<ShmTransport> shm(new ShmTransport());
+    if (!sendAll(link.s, header.data(), header.size()) || !recvLine(link.s, resp) || resp != "OK" ||
+        !ShmTransport::recvFds(link.s, fds) || !shm->attach(fds, link.s)) {
+        std::cerr << "loadgen: shm negotiation failed" << (resp.empty() ? "" : ": " + resp) << std::endl;
+        return false;
+    }
+    link.shm = std::move(shm);
+    return true;
+}
+
+// Open a connection to the server, optionally through the project-2 proxy,
+// which expects "<server_host> <server_port>\n" as the first line.
+static bool openConnection(const Options &opt, Link &link) {
+    if (!opt.localPath.empty()) return openLocal(opt, link);
+    if (opt.proxyHost.empty()) return (link.s = connectTo(opt.host, opt.port)) >= 0;
+    int s = connectTo(opt.proxyHost, opt.proxyPort);
+    if (s < 0) return false;
+    std::string serInfo = opt.host + " " + std::to_string(opt.port) + "\n";
+    if (!sendAll(s, serInfo.data(), serInfo.size())) {
+        close(s);
+        return false;
+    }
+    link.s = s;
+    return true;
+}
+
+static std::string keyName(int conn, int key) {
+    return "lg_c" + std::to_string(conn) + "_k" + std::to_string(key);
+}
+
+// Request group: header, path bytes and (for put) the body from the shared payload
+static bool sendRequest(Link &link, bool isPut, const std::string &path, size_t bytes) {
+    std::string header = isPut
+        ? std::string("put ") + std::to_string(path.size()) + " " + std::to_string(bytes) + "\n"
+        : std::string("get ") + std::to_string(path.size()) + "\n";
+    if (!sendAll(link.s, header.data(), header.size())) return false;
+    if (!sendAll(link.s, path.data(), path.size())) return false;
+    if (!isPut) return true;
+    size_t remaining = bytes;
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, payload.size());
+        if (!link.sendBody(payload.data(), chunk)) return false;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+// Response group: "OK\n" for put, "OK <size>\n<bytes>" for get
+static bool readResponse(Link &link, bool isPut, std::vector<char> &buffer, size_t &bytesOut, bool &okOut) {
+    std::string resp;
+    if (!recvLine(link.s, resp)) return false;
+    okOut = resp.rfind("OK", 0) == 0;
+    if (isPut || !okOut) return true;
+    size_t size = 0;
+    std::istringstream iss(resp.substr(3));
+    iss >> size;
+    if (!iss) return false;
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, buffer.size());
+        if (!link.recvBody(buffer.data(), chunk)) return false;
+        remaining -= chunk;
+    }
+    bytesOut = size;
+    return true;
+}
+
+// Warm-up: upload every key once so gets always have something to fetch
+static bool populate(const Options &opt, const SizeDist &dist, int conn, std::vector<size_t> &sizes) {
+    Link link;
+    if (!openConnection(opt, link)) return false;
+    std::mt19937_64 rng(0x5eed + conn);
+    std::vector<char> buffer(IO_BUFFER_SIZE);
+    sizes.assign(opt.keys, 0);
+    bool ok = true;
+    for (int k = 0; k < opt.keys && ok; k++) {
+        sizes[k] = dist.sample(rng);
+        size_t got = 0;
+        bool okResp = false;
+        ok = sendRequest(link, true, keyName(conn, k), sizes[k]) && readResponse(link, true, buffer, got, okResp) && okResp;
+    }
+    close(link.s);
+    return ok;
+}
+
+// Measured phase for one connection: writer keeps up to depth requests in flight
+static void runConnection(const Options &opt, const SizeDist &dist, int conn, std::vector<size_t> sizes, std::vector<Sample> &samples) {
+    Link link;
+    if (!openConnection(opt, link)) return;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Pending> inFlight;
+    bool writerDone = false;
+
+    std::thread reader([&]() {
+        std::vector<char> buffer(IO_BUFFER_SIZE);
+        while (true) {
+            Pending p;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return !inFlight.empty() || writerDone; });
+                if (inFlight.empty()) break;
+                p = inFlight.front();
+            }
+            size_t got = 0;
+            bool ok = false;
+            bool alive = readResponse(link, p.isPut, buffer, got, ok);
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - p.start).count();
+            samples.push_back(Sample{p.isPut, ok && alive, p.isPut ? p.bytes : got, ns});
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                inFlight.pop_front();
+            }
+            cv.notify_all();
+            if (!alive) {
+                stopFlag = true;
+                break;
+            }
+        }
+    });
+
+    std::mt19937_64 rng(0xbeef + conn);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::uniform_int_distribution<int> pickKey(0, opt.keys - 1);
+    while (!stopFlag) {
+        if (opt.maxOps > 0 && opsIssued.fetch_add(1) >= opt.maxOps) break;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            // stopFlag is raised without notifying this cv, so re-check it periodically
+            while (!cv.wait_for(lock, std::chrono::milliseconds(50),
+                                [&]() { return (int)inFlight.size() < opt.depth || stopFlag; })) {}
+            if (stopFlag) break;
+        }
+        Pending p;
+        p.isPut = coin(rng) < opt.putRatio;
+        p.key = pickKey(rng);
+        p.bytes = p.isPut ? dist.sample(rng) : sizes[p.key];
+        if (p.isPut) sizes[p.key] = p.bytes;
+        p.start = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            inFlight.push_back(p);
+        }
+        cv.notify_all();
+        if (!sendRequest(link, p.isPut, keyName(conn, p.key), p.bytes)) {
+            stopFlag = true;
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        writerDone = true;
+    }
+    cv.notify_all();
+    reader.join();
+    close(link.s);
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t idx = static_cast<size_t>(std::ceil(q * sorted.size())) ;
+    if (idx > 0) idx--;
+    if (idx >= sorted.size()) idx = sorted.size() - 1;
+    return sorted[idx];
+}
+
+struct Summary {
+    long ops = 0;
+    long errors = 0;
+    size_t bytes = 0;
+    std::vector<uint64_t> lat;
+};
+
+static void summarize(const std::vector<Sample> &all, int which, Summary &out) {
+    for (const auto &smp : all) {
+        if (which == 1 && !smp.isPut) continue;
+        if (which == 2 && smp.isPut) continue;
+        out.ops++;
+        if (!smp.ok) out.errors++;
+        out.bytes += smp.bytes;
+        out.lat.push_back(smp.latencyNs);
+    }
+    std::sort(out.lat.begin(), out.lat.end());
+}
+
+static std::string jsonBlock(const Summary &s, double secs) {
+    std::ostringstream o;
+    o << "{\"ops\":" << s.ops
+      << ",\"errors\":" << s.errors
+      << ",\"bytes\":" << s.bytes
+      << ",\"ops_per_s\":" << (secs > 0 ? s.ops / secs : 0.0)
+      << ",\"mb_per_s\":" << (secs > 0 ? s.bytes / secs / (1024.0 * 1024.0) : 0.0)
+      << ",\"lat_us\":{\"p50\":" << percentile(s.lat, 0.50) / 1000.0
+      << ",\"p99\":" << percentile(s.lat, 0.99) / 1000.0
+      << ",\"p999\":" << percentile(s.lat, 0.999) / 1000.0
+      << ",\"max\":" << (s.lat.empty() ? 0 : s.lat.back()) / 1000.0 << "}}";
+    return o.str();
+}
+
+static void textBlock(const char *name, const Summary &s, double secs) {
+    printf("%-5s ops=%-8ld err=%-4ld %10.1f ops/s %9.2f MB/s  p50=%.1fus p99=%.1fus p999=%.1fus\n",
+           name, s.ops, s.errors,
+           secs > 0 ? s.ops / secs : 0.0,
+           secs > 0 ? s.bytes / secs / (1024.0 * 1024.0) : 0.0,
+           percentile(s.lat, 0.50) / 1000.0,
+           percentile(s.lat, 0.99) / 1000.0,
+           percentile(s.lat, 0.999) / 1000.0);
+}
+
+static void usage() {
+    std::cerr << "usage: loadgen.out [-p port] [-x proxy[:port]] [-c conns] [-d secs] [-n ops]"
+                 " [-m put_ratio] [-s dist] [-P depth] [-k keys] [-U socket [-S]] [-j] host" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    Options opt;
+    int c;
+    while ((c = getopt(argc, argv, "p:x:c:d:n:m:s:P:k:U:Sj")) != -1) {
+        switch (c) {
+            case 'p': opt.port = atoi(optarg); break;
+            case 'x': {
+                std::string v(optarg);
+                size_t col = v.find(':');
+                opt.proxyHost = v.substr(0, col);
+                if (col != std::string::npos) opt.proxyPort = atoi(v.c_str() + col + 1);
+                break;
+            }
+            case 'c': opt.conns = atoi(optarg); break;
+            case 'd': opt.seconds = atof(optarg); break;
+            case 'n': opt.maxOps = atol(optarg); break;
+            case 'm': opt.putRatio = atof(optarg); break;
+            case 's': opt.sizeDist = optarg; break;
+            case 'P': opt.depth = atoi(optarg); break;
+            case 'k': opt.keys = atoi(optarg); break;
+            case 'U': opt.localPath = optarg; break;
+            case 'S': opt.shm = true; break;
+            case 'j': opt.json = true; break;
+            default: usage();
+        }
+    }
+    if (optind == argc && !opt.localPath.empty()) opt.host = "local";
+    else if (optind != argc - 1) usage();
+    else opt.host = argv[optind];
+    if (opt.shm && opt.localPath.empty()) usage();
+    SizeDist dist;
+    if (!parseDist(opt.sizeDist, dist)) {
+        std::cerr << "loadgen: bad size distribution: " << opt.sizeDist << std::endl;
+        return 1;
+    }
+    if (opt.conns < 1 || opt.depth < 1 || opt.keys < 1 || opt.putRatio < 0.0 || opt.putRatio > 1.0) usage();
+
+    payload.resize(IO_BUFFER_SIZE);
+    std::mt19937_64 fill(42);
+    for (char &b : payload) b = static_cast<char>(fill());
+
+    // Warm-up phase: every connection uploads its key set
+    std::vector<std::vector<size_t>> sizes(opt.conns);
+    for (int i = 0; i < opt.conns; i++) {
+        if (!populate(opt, dist, i, sizes[i])) {
+            std::cerr << "loadgen: warm-up failed for connection " << i << std::endl;
+            return 1;
+        }
+    }
+
+    // Measured phase
+    std::vector<std::vector<Sample>> perConn(opt.conns);
+    std::vector<std::thread> workers;
+    auto t0 = Clock::now();
+    for (int i = 0; i < opt.conns; i++) {
+        workers.emplace_back(runConnection, std::cref(opt), std::cref(dist), i, sizes[i], std::ref(perConn[i]));
+    }
+    if (opt.maxOps == 0) {
+        while (!stopFlag && std::chrono::duration<double>(Clock::now() - t0).count() < opt.seconds) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        stopFlag = true;
+    }
+    for (auto &t : workers) t.join();
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    std::vector<Sample> all;
+    for (auto &v : perConn) all.insert(all.end(), v.begin(), v.end());
+    Summary total, puts, gets;
+    summarize(all, 0, total);
+    summarize(all, 1, puts);
+    summarize(all, 2, gets);
+
+    if (opt.json) {
+        std::ostringstream o;
+        o << "{\"host\":\"" << opt.host << "\",\"port\":" << opt.port
+          << ",\"proxy\":" << (opt.proxyHost.empty() ? "false" : "true")
+          << ",\"conns\":" << opt.conns << ",\"depth\":" << opt.depth
+          << ",\"put_ratio\":" << opt.putRatio << ",\"size_dist\":\"" << opt.sizeDist << "\""
+          << ",\"seconds\":" << secs
+          << ",\"total\":" << jsonBlock(total, secs)
+          << ",\"put\":" << jsonBlock(puts, secs)
+          << ",\"get\":" << jsonBlock(gets, secs) << "}";
+        std::cout << o.str() << std::endl;
+    } else {
+        printf("loadgen: %d conns, depth %d, put ratio %.2f, sizes %s, %.2fs%s\n",
+               opt.conns, opt.depth, opt.putRatio, opt.sizeDist.c_str(), secs,
+               opt.proxyHost.empty() ? "" : " (via proxy)");
+        textBlock("total", total, secs);
+        textBlock("put", puts, secs);
+        textBlock("get", gets, secs);
+    }
+    return total.errors == 0 ? 0 : 2;
+}
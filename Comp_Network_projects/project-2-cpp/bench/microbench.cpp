@@ -0,0 +1,193 @@
+/*
+microbench
+----------
+
+    Microbenchmarks for the code that runs on every request:
+
+      - sendAll / recvExact / recvLine (common/NetIO) over an AF_UNIX
+        socketpair, with a helper thread on the far end draining or feeding
+      - CommandHandler::executeCommand tokenize-and-dispatch of a protocol
+        header line into a no-op handler
+      - sanitizePath (common/PathUtil) on short and deep relative paths, for
+        both the flat and the fan-out storage layout
+      - ShmRing::write (common/ShmRing) with a helper thread reading the
+        ring, to compare against sendAll over the socketpair
+      - a 64 KiB transfer buffer per request: fresh std::vector versus a
+        PooledBuffer (common/BufferPool), touching every page of it
+
+Usage:
+    ./microbench.out [-j] [filter]
+
+      -j        one JSON object per result line
+      filter    only run benchmarks whose name contains this substring
+
+The proxy_http helpers are covered by project-4/bench/microbench.out.
+*/
+
+#include "BenchHarness.h"
+#include "../common/NetIO.h"
+#include "../common/PathUtil.h"
+#include "../common/CommandHandler.h"
+#include "../common/ShmRing.h"
+#include "../common/BufferPool.h"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static std::string g_filter;
+
+static bool wanted(const std::string &name) {
+    return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+// The far end of the pair discards everything it receives
+static void benchSendAll(size_t size) {
+    std::string name = "sendAll/" + std::to_string(size);
+    if (!wanted(name)) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); return; }
+    std::thread drain([fd = sv[1]]() {
+        std::vector<char> sink(256 * 1024);
+        while (recv(fd, sink.data(), sink.size(), 0) > 0) {}
+    });
+    std::vector<char> data(size, 'x');
+    runBench(name, [&]() { sendAll(sv[0], data.data(), data.size()); }, size);
+    shutdown(sv[0], SHUT_WR);
+    drain.join();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+// The far end keeps the pair full so recvExact never waits on the producer
+static void benchRecvExact(size_t size) {
+    std::string name = "recvExact/" + std::to_string(size);
+    if (!wanted(name)) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); return; }
+    std::thread feed([fd = sv[1]]() {
+        std::vector<char> src(256 * 1024, 'y');
+        while (send(fd, src.data(), src.size(), 0) > 0) {}
+    });
+    std::vector<char> data(size);
+    runBench(name, [&]() { recvExact(sv[0], data.data(), data.size()); }, size);
+    shutdown(sv[0], SHUT_RDWR);
+    feed.join();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+// Feed a stream of identical protocol header lines
+static void benchRecvLine(const std::string &line) {
+    std::string name = "recvLine/" + std::to_string(line.size() + 1) + "B";
+    if (!wanted(name)) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); return; }
+    std::thread feed([fd = sv[1], line]() {
+        std::string block;
+        while (block.size() < 64 * 1024) block += line + "\n";
+        while (send(fd, block.data(), block.size(), 0) > 0) {}
+    });
+    std::string out;
+    runBench(name, [&]() { recvLine(sv[0], out); }, line.size() + 1);
+    shutdown(sv[0], SHUT_RDWR);
+    feed.join();
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void benchExecuteCommand(const std::string &header) {
+    std::string name = "executeCommand/" + header.substr(0, header.find(' '));
+    if (!wanted(name)) return;
+    CommandHandler handler;
+    volatile int sink = 0;
+    handler.registerCommand("put", [&](int argc, char**) { sink += argc; return 0; });
+    handler.registerCommand("get", [&](int argc, char**) { sink += argc; return 0; });
+    // executeCommand traces to stdout; keep that cost but send it nowhere
+    std::ostringstream devnull;
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+    std::vector<char> buf(header.size() + 1);
+    runBench(name, [&]() {
+        memcpy(buf.data(), header.c_str(), header.size() + 1);
+        handler.executeCommand(buf.data());
+        devnull.str(std::string());
+    });
+    std::cout.rdbuf(saved);
+}
+
+static void benchSanitizePath(const std::string &path, const char *label, StorageLayout layout) {
+    std::string name = std::string("sanitizePath/") + (layout == LAYOUT_FANOUT ? "fanout-" : "") + label;
+    if (!wanted(name)) return;
+    setStorageLayout(layout);
+    std::string out;
+    runBench(name, [&]() { sanitizePath(path, out); });
+    setStorageLayout(LAYOUT_FLAT);
+}
+
+// Same shape as benchSendAll, but the bytes go through the shared-memory ring
+static void benchShmRing(size_t size) {
+    std::string name = "shmRing/" + std::to_string(size);
+    if (!wanted(name)) return;
+    ShmTransport shm;
+    if (!shm.create(SHM_RING_CAPACITY, -1)) { perror("shm"); return; }
+    std::thread drain([&shm]() {
+        std::vector<char> sink(256 * 1024);
+        while (shm.toServer.read(sink.data(), sink.size())) {}
+    });
+    std::vector<char> data(size, 'x');
+    runBench(name, [&]() { shm.toServer.write(data.data(), data.size()); }, size);
+    shm.toServer.close();
+    drain.join();
+}
+
+// What a transfer loop pays for its buffer before moving any bytes
+static void benchIoBuffer() {
+    if (wanted("ioBuffer/vector")) {
+        runBench("ioBuffer/vector", []() {
+            std::vector<char> buffer(BUFFER_POOL_BUF_SIZE);
+            for (size_t i = 0; i < buffer.size(); i += 4096) buffer[i] = 1;
+            asm volatile("" : : "r"(buffer.data()) : "memory");
+        });
+    }
+    if (wanted("ioBuffer/pool")) {
+        runBench("ioBuffer/pool", []() {
+            PooledBuffer buffer;
+            for (size_t i = 0; i < buffer.size(); i += 4096) buffer.data()[i] = 1;
+            asm volatile("" : : "r"(buffer.data()) : "memory");
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) json = true;
+        else g_filter = argv[i];
+    }
+
+    for (size_t size : {64UL, 4096UL, 65536UL, 1048576UL}) benchSendAll(size);
+    for (size_t size : {64UL, 4096UL, 65536UL, 1048576UL}) benchRecvExact(size);
+    for (size_t size : {64UL, 4096UL, 65536UL, 1048576UL}) benchShmRing(size);
+    benchRecvLine("get 12");
+    benchRecvLine("put 48 1073741824");
+    benchRecvLine(std::string("put 200 ") + std::string(200, '7'));
+
+    benchIoBuffer();
+
+    benchExecuteCommand("put 12 65536\n");
+    benchExecuteCommand("get 12\n");
+
+    for (StorageLayout layout : {LAYOUT_FLAT, LAYOUT_FANOUT}) {
+        benchSanitizePath("file.txt", "short", layout);
+        benchSanitizePath("builds/2025/10/artifacts/linux-x86_64/release/app.tar.gz", "deep", layout);
+        benchSanitizePath("a/../../etc/passwd", "reject", layout);
+    }
+
+    printResults(json);
+    return 0;
+}
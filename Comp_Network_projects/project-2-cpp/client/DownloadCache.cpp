@@ -0,0 +1,94 @@
+#include "DownloadCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the index file is shared by every Client in the process (mux streams)
+static std::mutex indexMtx;
+
+static int64_t nanos(const struct timespec &ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static bool cacheable(const std::string &path) {
+    return !path.empty() && path.find_first_of("\t\n") == std::string::npos;
+}
+
+DownloadCache::DownloadCache(const std::string &indexPath) : indexPath(indexPath) {}
+
+std::map<std::string, DownloadCache::Entry> DownloadCache::load() const {
+    std::map<std::string, Entry> entries;
+    std::ifstream in(this->indexPath);
+    std::string line;
+    while (std::getline(in, line)) {
+        // Parse group: skip lines that are not exactly five fields
+        std::istringstream iss(line);
+        std::string local, remote, size, mtime, etag;
+        if (!std::getline(iss, local, '\t') || !std::getline(iss, remote, '\t') || !std::getline(iss, size, '\t') ||
+            !std::getline(iss, mtime, '\t') || !std::getline(iss, etag) || etag.empty()) {
+            continue;
+        }
+        char *end1 = nullptr; char *end2 = nullptr;
+        unsigned long long sizeUll = std::strtoull(size.c_str(), &end1, 10);
+        long long mtimeLl = std::strtoll(mtime.c_str(), &end2, 10);
+        if (*end1 != '\0' || *end2 != '\0') continue;
+        entries[local] = Entry{remote, static_cast<size_t>(sizeUll), static_cast<int64_t>(mtimeLl), etag};
+    }
+    return entries;
+}
+
+bool DownloadCache::save(const std::map<std::string, Entry> &entries) const {
+    std::string tmp = this->indexPath + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) return false;
+        for (const auto &kv : entries) {
+            out << kv.first << '\t' << kv.second.remotePath << '\t' << kv.second.size << '\t'
+                << kv.second.mtimeNs << '\t' << kv.second.etag << '\n';
+        }
+        if (!out.flush()) {
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), this->indexPath.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string DownloadCache::validator(const std::string &localPath, const std::string &remotePath) const {
+    if (!cacheable(localPath) || !cacheable(remotePath)) return "";
+    std::lock_guard<std::mutex> lock(indexMtx);
+    std::map<std::string, Entry> entries = this->load();
+    auto it = entries.find(localPath);
+    if (it == entries.end() || it->second.remotePath != remotePath) return "";
+    struct stat st;
+    if (stat(localPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+        static_cast<size_t>(st.st_size) != it->second.size || nanos(st.st_mtim) != it->second.mtimeNs) {
+        return "";
+    }
+    return it->second.etag;
+}
+
+void DownloadCache::store(const std::string &localPath, const std::string &remotePath, const std::string &etag) {
+    if (!cacheable(localPath) || !cacheable(remotePath) || etag.empty()) return;
+    struct stat st;
+    if (stat(localPath.c_str(), &st) != 0) return;
+    std::lock_guard<std::mutex> lock(indexMtx);
+    std::map<std::string, Entry> entries = this->load();
+    entries[localPath] = Entry{remotePath, static_cast<size_t>(st.st_size), nanos(st.st_mtim), etag};
+    this->save(entries);
+}
+
+void DownloadCache::forget(const std::string &localPath) {
+    std::lock_guard<std::mutex> lock(indexMtx);
+    std::map<std::string, Entry> entries = this->load();
+    if (entries.erase(localPath) > 0) this->save(entries);
+}
@@ -0,0 +1,57 @@
+#ifndef DOWNLOAD_CACHE_H
+#define DOWNLOAD_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// one line per downloaded file: "<local>\t<remote>\t<size>\t<mtime ns>\t<etag>"
+#define DOWNLOAD_CACHE_INDEX "client_storage/.cache_index"
+
+/*
+DownloadCache
+-------------
+
+    Remembers which version of a remote file each `get` left in
+    client_storage/, so the next get of the same file can ask the server
+    `get-if-changed` with that version's ETag and skip the body when it is
+    still current.
+
+    An entry records the local file's size and mtime (ns) right after the
+    download. If the local copy has since been edited, replaced by another
+    command or deleted, those no longer match and `validator` returns ""
+    (the client sends `-` and gets the full file).
+
+    The index lives in DOWNLOAD_CACHE_INDEX and is re-read and rewritten
+    (write to .tmp, then rename) on every change, under a process-wide
+    lock, so the clients of concurrent `mux` streams share it. Paths with
+    tabs or newlines are never cached.
+*/
+
+class DownloadCache {
+    private:
+        struct Entry {
+            std::string remotePath;
+            size_t size;
+            int64_t mtimeNs;
+            std::string etag;
+        };
+
+        std::string indexPath;
+
+        std::map<std::string, Entry> load() const;
+        bool save(const std::map<std::string, Entry> &entries) const;
+
+    public:
+        explicit DownloadCache(const std::string &indexPath = DOWNLOAD_CACHE_INDEX);
+        // ETag of the cached copy of `remotePath` at `localPath`, "" if there
+        // is none or the local file changed since it was downloaded
+        std::string validator(const std::string &localPath, const std::string &remotePath) const;
+        // `localPath` now holds `remotePath` at `etag` (stat()s it for size and mtime)
+        void store(const std::string &localPath, const std::string &remotePath, const std::string &etag);
+        // `localPath` is about to be overwritten
+        void forget(const std::string &localPath);
+};
+
+#endif // DOWNLOAD_CACHE_H
@@ -1,10 +1,23 @@
 #include "client.h"
+#include "../common/NetIO.h"
+#include "../common/UnixSock.h"
 #include <vector>
 #include <sstream>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
 
-static const size_t IO_BUFFER_SIZE = 64 * 1024;
+// swarm: bytes per range request, and requests kept in flight per source
+static const size_t SWARM_BLOCK_SIZE = 1024 * 1024;
+static const size_t SWARM_DEPTH = 2;
 
 
 /*
@@ -15,69 +28,71 @@ Prompt:Formulate a plan to implement remote file copy between the server and the
 Used plan to implement by hand
 
 */
-// Helper: send exactly len bytes
-// Returns false on error/EOF; loops until all bytes are sent
-static bool sendAll(int sock, const void* buf, size_t len) {
-    const char* p = static_cast<const char*>(buf);
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = send(sock, p + total, len - total, 0);
-        if (n <= 0) {
-            if (n < 0 && errno == EINTR) continue;
-            return false;
-        }
-        total += static_cast<size_t>(n);
-    }
-    return true;
-}
+// Framing helpers (sendAll / recvExact / recvLine) live in common/NetIO.cpp
+// so the bench tools can reuse exactly the same code path.
 
-// Helper: receive exactly len bytes
-// Returns false on error/EOF; loops until all bytes are read
-static bool recvExact(int sock, void* buf, size_t len) {
-    char* p = static_cast<char*>(buf);
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = recv(sock, p + total, len - total, 0);
-        if (n == 0) return false;
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            return false;
+Client::Client(int argc, char* argv[]) {
+    this->lastWatchVersion = 0;
+    this->headSock = -1;
+    this->muxSock = -1;
+    while (argc >= 4 && strncmp(argv[1], "--", 2) == 0) {
+        // optional cluster file: route every path to its owner on the hash ring
+        if (strcmp(argv[1], "--cluster") == 0) {
+            if (!loadClusterConfig(argv[2], this->ring)) {
+                std::cerr << "simplex-talk: cannot load cluster file: " << argv[2] << std::endl;
+                exit(1);
+            }
         }
-        total += static_cast<size_t>(n);
-    }
-    return true;
-}
-
-// Helper: receive a line ending with \n (not including the \n)
-// Bounded to 4096 bytes to avoid unbounded growth
-static bool recvLine(int sock, std::string &out) {
-    out.clear();
-    char ch;
-    while (true) {
-        ssize_t n = recv(sock, &ch, 1, 0);
-        if (n == 0) return false;
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            return false;
+        // optional tail of a replication chain: gets are served by it, writes go to host
+        else if (strcmp(argv[1], "--tail") == 0) {
+            std::string tailHost;
+            int tailPort;
+            if (!splitHostPort(argv[2], tailHost, tailPort)) {
+                std::cerr << "simplex-talk: --tail expects host:port" << std::endl;
+                exit(1);
+            }
+            this->tailNode = argv[2];
+        }
+        // emulated link for uput/uget datagrams, e.g. loss=0.01,delay=25
+        else if (strcmp(argv[1], "--udp-impair") == 0) {
+            if (!UdpChannel::impair(argv[2])) {
+                std::cerr << "simplex-talk: bad --udp-impair spec: " << argv[2] << std::endl;
+                exit(1);
+            }
         }
-        if (ch == '\n') break;
-        out.push_back(ch);
-        if (out.size() > 4096) return false;
+        else break;
+        argv += 2;
+        argc -= 2;
     }
-    return true;
-}
-
-Client::Client(int argc, char* argv[]) {
-    if (argc == 2) {
+    if (argc == 2 && !(this->tailNode.size() && !this->ring.empty())) {
         host = argv[1];
     }
     else {
-        std::cerr << "usage: simplex-talk host" << std::endl;
+        std::cerr << "usage: simplex-talk [--cluster file | --tail host:port] [--udp-impair spec] host|unix:<socket_path>" << std::endl;
         exit(1);
     }
 }
 
+Client::Client(int streamSock) {
+    this->host = nullptr;
+    this->lastWatchVersion = 0;
+    this->s = this->headSock = streamSock;
+    this->muxSock = -1;
+}
+
+Client::~Client() {
+    if (this->mux) {
+        this->mux->stop();
+        this->muxThread.join();
+        close(this->muxSock);
+    }
+}
+
 void Client::connectToServer() {
+    if (strncmp(this->host, LOCAL_HOST_PREFIX, strlen(LOCAL_HOST_PREFIX)) == 0) {
+        this->connectLocal(this->host + strlen(LOCAL_HOST_PREFIX));
+        return;
+    }
     this->hp = gethostbyname(this->host);
     if (!this->hp) {
         std::cerr << "simplex-talk: unknown host: " << this->host << std::endl;
@@ -89,22 +104,156 @@ void Client::connectToServer() {
 	
 	//changed to from SERVER_PORT to PROXY_PORT
     this->sin.sin_port = htons(PROXY_PORT);
-    if ((this->s = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("simplex-talk: socket");
-        exit(1);
-        }
-        if (connect(this->s, (struct sockaddr *)&this->sin, sizeof(this->sin)) < 0) {
-        perror("simplex-talk: connect");
-        close(this->s);
+
+    // Cluster mode: connections to the nodes are opened on first use
+    if (!this->ring.empty()) {
+        if (!this->route(nullptr)) exit(1);
+        return;
+    }
+    if ((this->s = this->openProxied(this->host, SERVER_PORT)) < 0) {
         exit(1);
     }
+    this->headSock = this->s;
     std::cout << "Client: Connected to server" << std::endl;
+}
+
+// Connect to the proxy and ask it for serverHost:serverPort
+int Client::openProxied(const std::string &serverHost, int serverPort) {
+    int sock;
+    if ((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("simplex-talk: socket");
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&this->sin, sizeof(this->sin)) < 0) {
+        perror("simplex-talk: connect");
+        close(sock);
+        return -1;
+    }
 	
 	// Send server info from client to proxy
-    std::string serInfo = std::string(this->host) + " " + std::to_string(SERVER_PORT) + "\n";
-    sendAll(this->s, serInfo.data(), serInfo.size());
+    std::string serInfo = serverHost + " " + std::to_string(serverPort) + "\n";
+    sendAll(sock, serInfo.data(), serInfo.size());
+    return sock;
+}
+
+// Cluster mode: point this->s at the node owning remotePath (the first node
+// for nullptr). Outside cluster mode this is the server given on the command
+// line, which is the head when a replication chain is in use.
+bool Client::route(const char *remotePath) {
+    if (this->ring.empty()) {
+        if (this->headSock >= 0) this->s = this->headSock;
+        return true;
+    }
+    return this->useNode(remotePath ? this->ring.owner(remotePath) : this->ring.nodes().front());
+}
+
+// Reads: the tail of the replication chain only has committed files
+bool Client::routeRead(const char *remotePath) {
+    if (this->tailNode.empty()) return this->route(remotePath);
+    return this->useNode(this->tailNode);
+}
+
+// Point this->s at host:port, reusing one connection per node
+bool Client::useNode(const std::string &node) {
+    auto it = this->nodeSocks.find(node);
+    if (it == this->nodeSocks.end()) {
+        std::string nodeHost;
+        int nodePort;
+        int sock = splitHostPort(node, nodeHost, nodePort) ? this->openProxied(nodeHost, nodePort) : -1;
+        if (sock < 0) {
+            std::cerr << "Failed to connect to node " << node << std::endl;
+            return false;
+        }
+        std::cout << "Client: Connected to node " << node << std::endl;
+        it = this->nodeSocks.emplace(node, sock).first;
+    }
+    this->s = it->second;
+    return true;
+}
+
+// The proxy only relays TCP, so datagrams go straight to the server's host
+std::string Client::serverHost(int *port) {
+    for (const auto &kv : this->nodeSocks) {
+        std::string nodeHost;
+        int nodePort;
+        if (kv.second == this->s && splitHostPort(kv.first, nodeHost, nodePort)) {
+            if (port) *port = nodePort;
+            return nodeHost;
+        }
+    }
+    if (port) *port = SERVER_PORT;
+    if (!this->host) return "";
+    if (strncmp(this->host, LOCAL_HOST_PREFIX, strlen(LOCAL_HOST_PREFIX)) == 0) return "127.0.0.1";
+    return this->host;
+}
+
+int Client::openDirect() {
+    int port = SERVER_PORT;
+    std::string host = this->serverHost(&port);
+    struct hostent *hp = host.empty() ? nullptr : gethostbyname(host.c_str());
+    if (!hp) {
+        std::cerr << "simplex-talk: unknown host: " << host << std::endl;
+        return -1;
+    }
+    struct sockaddr_in addr;
+    bzero((char *)&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    bcopy(hp->h_addr, (char *)&addr.sin_addr, hp->h_length);
+    addr.sin_port = htons(port);
+    int sock = socket(PF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("simplex-talk: socket");
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("simplex-talk: connect");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Same-host server: talk to its Unix socket directly (no proxy) and move file
+// bodies through shared-memory rings when the server agrees.
+void Client::connectLocal(const char *path) {
+    if ((this->s = connectUnix(path)) < 0) {
+        perror("simplex-talk: connect");
+        exit(1);
+    }
+    this->headSock = this->s;
+    std::cout << "Client: Connected to local server" << std::endl;
+
+    std::string header = std::string("shm ") + std::to_string(SHM_RING_CAPACITY) + "\n";
+    std::string resp;
+    if (!sendAll(this->s, header.data(), header.size()) || !recvLine(this->s, resp)) {
+        perror("simplex-talk: shm");
+        exit(1);
+    }
+    if (resp != "OK") {
+        std::cout << "Client: shared memory unavailable (" << resp << "), using the socket" << std::endl;
+        return;
+    }
+    int fds[5];
+    std::unique_ptr<ShmTransport> ring(new ShmTransport());
+    if (!ShmTransport::recvFds(this->s, fds) || !ring->attach(fds, this->s)) {
+        // the server already switched this connection over, so we cannot fall back
+        std::cerr << "simplex-talk: failed to attach shared memory" << std::endl;
+        exit(1);
+    }
+    this->shm = std::move(ring);
+    std::cout << "Client: Using shared memory transport" << std::endl;
+}
+
+bool Client::sendBody(const void *buf, size_t len) {
+    // the rings belong to the local connection, not to a --tail node
+    if (this->shm && this->s == this->headSock) return this->shm->toServer.write(buf, len);
+    return sendAll(this->s, buf, len);
 }
 
+bool Client::recvBody(void *buf, size_t len) {
+    if (this->shm && this->s == this->headSock) return this->shm->toClient.read(buf, len);
+    return recvExact(this->s, buf, len);
+}
 
 void Client::builtin_put(int argc, char* argv[]) {
     // CLI parsing group: local_path and optional remote_path
@@ -115,6 +264,7 @@ void Client::builtin_put(int argc, char* argv[]) {
 
     std::string srcPath = std::string("client_storage/") + argv[1];
     const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->route(remotePath)) return;
 
     std::ifstream in(srcPath, std::ios::binary);
     if (!in) {
@@ -144,24 +294,97 @@ void Client::builtin_put(int argc, char* argv[]) {
     }
 
     // File transfer group: stream local file to server
-    std::vector<char> buffer(IO_BUFFER_SIZE);
-    size_t remaining = fileSize;
+    if (!this->sendFileBody(in, fileSize)) return;
+
+    std::string resp;
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK", 0) == 0) {
+        std::cout << "Upload succeeded" << std::endl;
+    } else {
+        std::cerr << "Server error: " << resp << std::endl;
+    }
+}
+
+// The tuner follows this->s, which changes with the cluster node in use
+SocketTuner &Client::tunerForSocket() {
+    if (this->tuner.socket() != this->s) this->tuner = SocketTuner(this->s);
+    return this->tuner;
+}
+
+// Stream `size` bytes of `in` as a put body
+bool Client::sendFileBody(std::ifstream &in, size_t size) {
+    SocketTuner &tuner = this->tunerForSocket();
+    ChunkBuffer buffer;
+    size_t remaining = size;
+    bool tuned = false;
+    tuner.begin();
     while (remaining > 0) {
-        size_t chunk = std::min(remaining, buffer.size());
-        in.read(buffer.data(), static_cast<std::streamsize>(chunk));
+        size_t chunk = std::min(remaining, tuner.chunkSize());
+        char *buf = buffer.get(chunk);
+        in.read(buf, static_cast<std::streamsize>(chunk));
         std::streamsize got = in.gcount();
         if (got <= 0) {
             std::cerr << "Unexpected EOF or read error" << std::endl;
-            return;
+            return false;
         }
-        if (!sendAll(this->s, buffer.data(), static_cast<size_t>(got))) {
+        if (!this->sendBody(buf, static_cast<size_t>(got))) {
             std::cerr << "Failed to send file data" << std::endl;
-            return;
+            return false;
         }
+        if (tuner.progress(static_cast<size_t>(got), true)) tuned = true;
         remaining -= static_cast<size_t>(got);
     }
+    if (tuned) std::cout << "Tuned: " << tuner.describe() << std::endl;
+    return true;
+}
+
+// hput <local> [remote]: send the SHA-256 first and the body only if the
+// server does not already store that content
+void Client::builtin_hash_put(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: hput <local_path> [remote_path]" << std::endl;
+        return;
+    }
+    std::string srcPath = std::string("client_storage/") + argv[1];
+    const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
 
+    // Hash group: checksum the local file before contacting the server
+    std::string sha;
+    if (!sha256File(srcPath, sha)) {
+        std::cerr << "Failed to read local file: " << srcPath << std::endl;
+        return;
+    }
+    std::ifstream in(srcPath, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "Failed to open local file: " << srcPath << std::endl;
+        return;
+    }
+    size_t fileSize = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    if (!this->route(remotePath)) return;
+
+    // Header group: size and checksum, then the path
+    std::string request = std::string("hput ") + std::to_string(strlen(remotePath)) + " " + std::to_string(fileSize) +
+                          " " + sha + "\n" + remotePath;
     std::string resp;
+    if (!sendAll(this->s, request.data(), request.size()) || !recvLine(this->s, resp)) {
+        std::cerr << "Failed to send HPUT request" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK", 0) == 0) {
+        std::cout << "Upload skipped: server already has the content" << std::endl;
+        return;
+    }
+    if (resp.rfind("SEND", 0) != 0) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+
+    // File transfer group: the server asked for the body
+    if (!this->sendFileBody(in, fileSize)) return;
     if (!recvLine(this->s, resp)) {
         std::cerr << "Failed to receive response" << std::endl;
         return;
@@ -173,6 +396,8 @@ void Client::builtin_put(int argc, char* argv[]) {
     }
 }
 
+// get <remote> [local]: a conditional get that skips the body when the copy
+// a previous get left in client_storage/ is still current (see DownloadCache.h)
 void Client::builtin_get(int argc, char* argv[]) {
     if (argc < 2) {
         std::cerr << "usage: get <remote_path> [local_path]" << std::endl;
@@ -180,6 +405,7 @@ void Client::builtin_get(int argc, char* argv[]) {
     }
     const char* remotePath = argv[1];
     const char* localPath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->routeRead(remotePath)) return;
 
     // Ensure client_storage directory exists
     if (mkdir("client_storage", 0755) != 0 && errno != EEXIST) {
@@ -188,8 +414,10 @@ void Client::builtin_get(int argc, char* argv[]) {
     }
     std::string finalLocalPath = std::string("client_storage/") + localPath;
 
-    // Header group: send GET header with remote path length
-    std::string header = std::string("get ") + std::to_string(strlen(remotePath)) + "\n";
+    // Header group: conditional get, with the ETag of the copy we already have
+    std::string etag = this->downloads.validator(finalLocalPath, remotePath);
+    std::string header = std::string("get-if-changed ") + std::to_string(strlen(remotePath)) + " " +
+                         (etag.empty() ? "-" : etag) + "\n";
     if (!sendAll(this->s, header.data(), header.size())) {
         std::cerr << "Failed to send GET header" << std::endl;
         return;
@@ -200,52 +428,944 @@ void Client::builtin_get(int argc, char* argv[]) {
         return;
     }
 
-    // Response group: read OK <size> line then stream file to disk
+    // Response group: NOT_MODIFIED, or read OK <size> <etag> line then stream file to disk
     std::string resp;
     if (!recvLine(this->s, resp)) {
         std::cerr << "Failed to receive response" << std::endl;
         return;
     }
+    if (resp == "NOT_MODIFIED") {
+        std::cout << "Not modified: " << finalLocalPath << " (cached copy is current)" << std::endl;
+        return;
+    }
     if (resp.rfind("OK ", 0) != 0) {
         std::cerr << "Server error: " << resp << std::endl;
         return;
     }
 
     size_t size = 0;
+    std::string newEtag;
     {
         std::istringstream iss(resp.substr(3));
-        iss >> size;
+        iss >> size >> newEtag;
         if (!iss) {
             std::cerr << "Malformed OK header: " << resp << std::endl;
             return;
         }
     }
 
+    this->downloads.forget(finalLocalPath);
     std::ofstream out(finalLocalPath, std::ios::binary);
     if (!out) {
         std::cerr << "Failed to open local file for writing: " << finalLocalPath << std::endl;
         return;
     }
 
-    std::vector<char> buffer(IO_BUFFER_SIZE);
+    SocketTuner &tuner = this->tunerForSocket();
+    ChunkBuffer buffer;
     size_t remaining = size;
+    bool tuned = false;
+    tuner.begin();
     while (remaining > 0) {
-        size_t chunk = std::min(remaining, buffer.size());
-        if (!recvExact(this->s, buffer.data(), chunk)) {
+        size_t chunk = std::min(remaining, tuner.chunkSize());
+        char *buf = buffer.get(chunk);
+        if (!this->recvBody(buf, chunk)) {
             std::cerr << "Failed to receive file data" << std::endl;
             return;
         }
-        out.write(buffer.data(), static_cast<std::streamsize>(chunk));
+        out.write(buf, static_cast<std::streamsize>(chunk));
         if (!out) {
             std::cerr << "Failed to write local file" << std::endl;
             return;
         }
+        if (tuner.progress(chunk, false)) tuned = true;
         remaining -= chunk;
     }
 
+    out.close();
+    if (!out) {
+        std::cerr << "Failed to write local file" << std::endl;
+        return;
+    }
+    // `-`: the server had no checksum yet, so there is nothing to revalidate with
+    if (newEtag != "-") this->downloads.store(finalLocalPath, remotePath, newEtag);
+
+    if (tuned) std::cout << "Tuned: " << tuner.describe() << std::endl;
     std::cout << "Download succeeded: " << finalLocalPath << std::endl;
 }
 
+// uput <local> [remote]: the server opens a UDP port, we send the body there
+// (see common/UdpTransfer.h) and the server's reply line ends the transfer
+void Client::builtin_udp_put(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: uput <local_path> [remote_path]" << std::endl;
+        return;
+    }
+    std::string srcPath = std::string("client_storage/") + argv[1];
+    const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->route(remotePath)) return;
+    std::string udpHost = this->serverHost();
+    if (udpHost.empty()) {
+        std::cerr << "uput needs the server's host (not available inside mux)" << std::endl;
+        return;
+    }
+    int fd = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::cerr << "Failed to open local file: " << srcPath << std::endl;
+        return;
+    }
+
+    // Header group: path and size; the reply names the UDP port and session
+    std::string header = std::string("uput ") + std::to_string(strlen(remotePath)) + " " + std::to_string(st.st_size) + "\n";
+    std::string resp;
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, remotePath, strlen(remotePath)) ||
+        !recvLine(this->s, resp)) {
+        std::cerr << "Failed to send UPUT request" << std::endl;
+        close(fd);
+        return;
+    }
+    int udpPort = 0;
+    unsigned long session = 0;
+    if (resp.rfind("OK ", 0) != 0 || sscanf(resp.c_str() + 3, "%d %lu", &udpPort, &session) != 2) {
+        std::cerr << "Server error: " << resp << std::endl;
+        close(fd);
+        return;
+    }
+
+    // Transfer group: datagrams until the server's verdict (which a failed
+    // channel still has to wait for, the server is expecting data)
+    int udpSock = UdpChannel::connectTo(udpHost, udpPort);
+    UdpTransferStats stats;
+    if (udpSock < 0) {
+        std::cerr << "Failed to open UDP channel to " << udpHost << ":" << udpPort << std::endl;
+    } else {
+        UdpChannel channel(udpSock, static_cast<uint32_t>(session), true);
+        udpSendFile(channel, fd, static_cast<size_t>(st.st_size), this->s, stats);
+    }
+    close(fd);
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK", 0) == 0) {
+        std::cout << "Upload succeeded (UDP): " << stats.describe() << std::endl;
+    } else {
+        std::cerr << "Server error: " << resp << std::endl;
+    }
+}
+
+// uget <remote> [local]: the server sends the body from a UDP port; we answer
+// with the verdict line once every block is written
+void Client::builtin_udp_get(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: uget <remote_path> [local_path]" << std::endl;
+        return;
+    }
+    const char* remotePath = argv[1];
+    const char* localPath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->routeRead(remotePath)) return;
+    std::string udpHost = this->serverHost();
+    if (udpHost.empty()) {
+        std::cerr << "uget needs the server's host (not available inside mux)" << std::endl;
+        return;
+    }
+    if (mkdir("client_storage", 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create client_storage directory" << std::endl;
+        return;
+    }
+    std::string finalLocalPath = std::string("client_storage/") + localPath;
+
+    // Header group: the reply carries the size, UDP port and session
+    std::string header = std::string("uget ") + std::to_string(strlen(remotePath)) + "\n";
+    std::string resp;
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, remotePath, strlen(remotePath)) ||
+        !recvLine(this->s, resp)) {
+        std::cerr << "Failed to send UGET request" << std::endl;
+        return;
+    }
+    unsigned long long size = 0;
+    int udpPort = 0;
+    unsigned long session = 0;
+    if (resp.rfind("OK ", 0) != 0 || sscanf(resp.c_str() + 3, "%llu %d %lu", &size, &udpPort, &session) != 3) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+
+    // Transfer group: blocks land at their offsets in the local file; the
+    // verdict goes back whatever happened, the server sends until it arrives
+    this->downloads.forget(finalLocalPath);
+    int fd = open(finalLocalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int udpSock = fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0 ? UdpChannel::connectTo(udpHost, udpPort) : -1;
+    UdpTransferStats stats;
+    std::string error = fd < 0 ? "write_failed" : "udp_unavailable";
+    bool ok = false;
+    if (udpSock >= 0) {
+        UdpChannel channel(udpSock, static_cast<uint32_t>(session), true);
+        ok = udpReceiveFile(channel, fd, static_cast<size_t>(size), this->s, stats, error);
+    }
+    if (fd >= 0 && close(fd) != 0 && ok) {
+        ok = false;
+        error = "write_failed";
+    }
+    std::string verdict = ok ? std::string("OK\n") : "ERR " + error + "\n";
+    sendAll(this->s, verdict.data(), verdict.size());
+    if (ok) {
+        std::cout << "Download succeeded (UDP): " << finalLocalPath << ", " << stats.describe() << std::endl;
+    } else {
+        std::cerr << "UDP download failed: " << error << std::endl;
+    }
+}
+
+// put for sparse files: only the data extents travel (see common/SparseIO.h)
+void Client::builtin_sparse_put(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: sput <local_path> [remote_path]" << std::endl;
+        return;
+    }
+    std::string srcPath = std::string("client_storage/") + argv[1];
+    const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->route(remotePath)) return;
+
+    int fd = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Failed to open local file: " << srcPath << std::endl;
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    // Header group: header and path, then the extents
+    std::string header = std::string("sput ") + std::to_string(strlen(remotePath)) + " " + std::to_string(st.st_size) + "\n";
+    size_t sent = 0;
+    bool ok = sendAll(this->s, header.data(), header.size()) && sendAll(this->s, remotePath, strlen(remotePath)) &&
+              sendSparseExtents(fd, static_cast<size_t>(st.st_size), this->s,
+                                [this](const void *buf, size_t len) { return this->sendBody(buf, len); }, &sent);
+    close(fd);
+    if (!ok) {
+        std::cerr << "Failed to send file data" << std::endl;
+        return;
+    }
+
+    std::string resp;
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK", 0) == 0) {
+        std::cout << "Upload succeeded (" << sent << " of " << st.st_size << " bytes were data)" << std::endl;
+    } else {
+        std::cerr << "Server error: " << resp << std::endl;
+    }
+}
+
+// get for sparse files: holes are recreated by ftruncate, only data is written
+void Client::builtin_sparse_get(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: sget <remote_path> [local_path]" << std::endl;
+        return;
+    }
+    const char* remotePath = argv[1];
+    const char* localPath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->routeRead(remotePath)) return;
+    if (mkdir("client_storage", 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create client_storage directory" << std::endl;
+        return;
+    }
+    std::string finalLocalPath = std::string("client_storage/") + localPath;
+
+    std::string header = std::string("sget ") + std::to_string(strlen(remotePath)) + "\n";
+    std::string resp;
+    unsigned long long size = 0;
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, remotePath, strlen(remotePath)) ||
+        !recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (sscanf(resp.c_str(), "OK %llu", &size) != 1) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+
+    // O_TRUNC + ftruncate: the whole file starts out as one hole
+    int fd = open(finalLocalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) std::cerr << "Failed to open local file for writing: " << finalLocalPath << std::endl;
+    bool diskOk;
+    size_t written = 0;
+    // the extents are read even if the file could not be opened, to stay in sync
+    bool ok = recvSparseExtents(this->s, [this](void *buf, size_t len) { return this->recvBody(buf, len); },
+                                fd, static_cast<size_t>(size), diskOk, &written);
+    if (fd < 0) return;
+    close(fd);
+    if (!ok || !diskOk) {
+        std::cerr << "Failed to receive file data" << std::endl;
+        return;
+    }
+    std::cout << "Download succeeded: " << finalLocalPath << " (" << written << " of " << size << " bytes were data)" << std::endl;
+}
+
+/*
+Swarm download: the file is split into SWARM_BLOCK_SIZE blocks and every
+source pulls the next unclaimed block whenever it has room, so a fast source
+simply ends up serving more blocks than a slow one. Once nothing is left
+unclaimed, idle sources re-request blocks still in flight on another source
+(endgame), so one stalled replica cannot hold back the tail of the
+download; whichever copy arrives first is written, pwrite makes the second
+harmless. Blocks of a source that fails go back to the queue, and when the
+last block is in the sockets are shut down so a stalled source does not
+keep the download waiting.
+*/
+struct SwarmState {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<size_t> unclaimed;
+    std::vector<int> inFlight;      // sources currently asked for each block
+    std::vector<bool> done;
+    size_t doneCount = 0;
+    int activeSources = 0;
+    std::vector<int> socks;
+
+    // Next block for a source; -1 if there is none. A source with nothing
+    // outstanding (wait) blocks until work shows up or the download ends.
+    long take(const std::deque<size_t> &mine, bool wait) {
+        std::unique_lock<std::mutex> lock(this->mtx);
+        while (this->doneCount < this->done.size()) {
+            while (!this->unclaimed.empty()) {
+                size_t b = this->unclaimed.front();
+                this->unclaimed.pop_front();
+                if (this->done[b]) continue;
+                this->inFlight[b]++;
+                return static_cast<long>(b);
+            }
+            // endgame: duplicate a block that only one other source is on
+            for (size_t b = 0; b < this->done.size(); b++) {
+                if (this->done[b] || this->inFlight[b] != 1) continue;
+                if (std::find(mine.begin(), mine.end(), b) != mine.end()) continue;
+                this->inFlight[b]++;
+                return static_cast<long>(b);
+            }
+            if (!wait || this->activeSources <= 1) return -1;
+            this->cv.wait(lock);
+        }
+        return -1;
+    }
+
+    // true if this copy was the first one to arrive
+    bool finish(size_t b) {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->inFlight[b]--;
+        if (this->done[b]) return false;
+        this->done[b] = true;
+        if (++this->doneCount == this->done.size()) {
+            for (int sock : this->socks) shutdown(sock, SHUT_RDWR);
+        }
+        this->cv.notify_all();
+        return true;
+    }
+
+    // Returns false if the download is complete (a failure then does not matter)
+    bool giveBack(const std::deque<size_t> &mine) {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        for (size_t b : mine) {
+            this->inFlight[b]--;
+            if (!this->done[b] && this->inFlight[b] == 0) this->unclaimed.push_back(b);
+        }
+        this->activeSources--;
+        this->cv.notify_all();
+        return this->doneCount < this->done.size();
+    }
+};
+
+// One source of a swarm download; returns the bytes this source contributed
+static size_t swarmWorker(SwarmState &state, int sock, const std::string &remotePath, size_t totalSize, int fd, bool &failed) {
+    std::deque<size_t> mine;    // requested on this socket, oldest first
+    PooledBuffer buffer;
+    size_t contributed = 0;
+    failed = false;
+    while (true) {
+        // Request group: keep up to SWARM_DEPTH ranges queued on the socket
+        while (mine.size() < SWARM_DEPTH) {
+            long b = state.take(mine, mine.empty());
+            if (b < 0) break;
+            size_t offset = static_cast<size_t>(b) * SWARM_BLOCK_SIZE;
+            std::string header = std::string("getr ") + std::to_string(remotePath.size()) + " " +
+                                 std::to_string(offset) + " " + std::to_string(SWARM_BLOCK_SIZE) + "\n";
+            mine.push_back(static_cast<size_t>(b));
+            if (!sendAll(sock, header.data(), header.size()) || !sendAll(sock, remotePath.data(), remotePath.size())) {
+                failed = true;
+                break;
+            }
+        }
+        if (failed || mine.empty()) break;
+
+        // Response group: the oldest request answers first
+        size_t b = mine.front();
+        size_t offset = b * SWARM_BLOCK_SIZE;
+        size_t expect = std::min(SWARM_BLOCK_SIZE, totalSize - offset);
+        std::string resp;
+        size_t len = 0, size = 0;
+        if (!recvLine(sock, resp) || sscanf(resp.c_str(), "OK %zu %zu", &len, &size) != 2 || len != expect || size != totalSize) {
+            if (resp.rfind("OK", 0) != 0 && !resp.empty()) std::cerr << "Swarm source error: " << resp << std::endl;
+            failed = true;
+            break;
+        }
+        bool ok = true;
+        for (size_t got = 0; got < len;) {
+            size_t chunk = std::min(len - got, buffer.size());
+            if (!recvExact(sock, buffer.data(), chunk)) { ok = false; break; }
+            if (pwrite(fd, buffer.data(), chunk, static_cast<off_t>(offset + got)) != static_cast<ssize_t>(chunk)) { ok = false; break; }
+            got += chunk;
+        }
+        if (!ok) { failed = true; break; }
+        mine.pop_front();
+        if (state.finish(b)) contributed += len;
+    }
+    if (!state.giveBack(mine)) failed = false;
+    return contributed;
+}
+
+void Client::builtin_swarm(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "usage: swarm <remote_path> <local_path> <host:port> [host:port ...]" << std::endl;
+        return;
+    }
+    std::string remotePath = argv[1];
+    std::string finalLocalPath = std::string("client_storage/") + argv[2];
+    if (mkdir("client_storage", 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create client_storage directory" << std::endl;
+        return;
+    }
+
+    // Connect group: one fresh connection per source, so they never share a
+    // socket. A zero-length range checks that the source has the file; the
+    // first answer fixes the size and sources that disagree are left out.
+    std::vector<std::string> nodes;
+    std::vector<int> socks;
+    std::string header = std::string("getr ") + std::to_string(remotePath.size()) + " 0 0\n";
+    size_t totalSize = 0;
+    for (int i = 3; i < argc; i++) {
+        std::string nodeHost, resp;
+        int nodePort;
+        size_t len = 0, size = 0;
+        int sock = splitHostPort(argv[i], nodeHost, nodePort) ? this->openProxied(nodeHost, nodePort) : -1;
+        if (sock < 0 || !sendAll(sock, header.data(), header.size()) || !sendAll(sock, remotePath.data(), remotePath.size()) ||
+            !recvLine(sock, resp) || sscanf(resp.c_str(), "OK %zu %zu", &len, &size) != 2 ||
+            (!socks.empty() && size != totalSize)) {
+            std::cerr << "Skipping source " << argv[i] << (resp.empty() ? "" : ": " + resp) << std::endl;
+            if (sock >= 0) close(sock);
+            continue;
+        }
+        totalSize = size;
+        nodes.push_back(argv[i]);
+        socks.push_back(sock);
+    }
+    if (socks.empty()) {
+        std::cerr << "No usable source for " << remotePath << std::endl;
+        return;
+    }
+    int fd = open(finalLocalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(totalSize)) != 0) {
+        std::cerr << "Failed to open local file for writing: " << finalLocalPath << std::endl;
+        if (fd >= 0) close(fd);
+        for (int sock : socks) close(sock);
+        return;
+    }
+
+    // Transfer group: one thread per source, all pulling from the same block queue
+    SwarmState state;
+    size_t blocks = (totalSize + SWARM_BLOCK_SIZE - 1) / SWARM_BLOCK_SIZE;
+    state.inFlight.assign(blocks, 0);
+    state.done.assign(blocks, false);
+    for (size_t b = 0; b < blocks; b++) state.unclaimed.push_back(b);
+    state.activeSources = static_cast<int>(socks.size());
+    state.socks = socks;
+    std::vector<size_t> contributed(socks.size(), 0);
+    std::unique_ptr<bool[]> failed(new bool[socks.size()]);
+    std::vector<std::thread> workers;
+    auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < socks.size(); i++) {
+        workers.emplace_back([&, i]() {
+            contributed[i] = swarmWorker(state, socks[i], remotePath, totalSize, fd, failed[i]);
+        });
+    }
+    for (auto &t : workers) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    close(fd);
+    for (int sock : socks) close(sock);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        std::cout << "  " << nodes[i] << ": " << contributed[i] << " bytes" << (failed[i] ? " (failed)" : "") << std::endl;
+    }
+    if (state.doneCount != blocks) {
+        std::cerr << "Swarm download incomplete: " << state.doneCount << "/" << blocks << " blocks" << std::endl;
+        return;
+    }
+    std::cout << "Download succeeded: " << finalLocalPath << " (" << totalSize << " bytes in " << seconds << " s)" << std::endl;
+}
+
+// copy/move run entirely on the server: send both remote paths, read the status
+void Client::sendPathPairCommand(const char *verb, int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << verb << " <remote_src> <remote_dst>" << std::endl;
+        return;
+    }
+    const char* srcPath = argv[1];
+    const char* dstPath = argv[2];
+    if (!this->route(srcPath)) return;
+
+    // Header group: verb with both path lengths, then the raw path bytes
+    std::string header = std::string(verb) + " " + std::to_string(strlen(srcPath)) + " " + std::to_string(strlen(dstPath)) + "\n";
+    if (!sendAll(this->s, header.data(), header.size()) ||
+        !sendAll(this->s, srcPath, strlen(srcPath)) ||
+        !sendAll(this->s, dstPath, strlen(dstPath))) {
+        std::cerr << "Failed to send " << verb << " request" << std::endl;
+        return;
+    }
+
+    std::string resp;
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK", 0) == 0) {
+        std::cout << "Remote " << verb << " succeeded: " << srcPath << " -> " << dstPath << std::endl;
+    } else {
+        std::cerr << "Server error: " << resp << std::endl;
+    }
+}
+
+void Client::builtin_copy(int argc, char* argv[]) {
+    this->sendPathPairCommand("copy", argc, argv);
+}
+
+void Client::builtin_move(int argc, char* argv[]) {
+    this->sendPathPairCommand("move", argc, argv);
+}
+
+void Client::builtin_append(int argc, char* argv[]) {
+    // CLI parsing group: local_path and optional remote_path
+    if (argc < 2) {
+        std::cerr << "usage: append <local_path> [remote_path]" << std::endl;
+        return;
+    }
+    std::string srcPath = std::string("client_storage/") + argv[1];
+    const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
+    if (!this->route(remotePath)) return;
+    std::ifstream in(srcPath, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "Failed to open local file: " << srcPath << std::endl;
+        return;
+    }
+    size_t len = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    // Header group: append header, then path bytes and the local file as the body
+    std::string header = std::string("append ") + std::to_string(strlen(remotePath)) + " " + std::to_string(len) + "\n";
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, remotePath, strlen(remotePath))) {
+        std::cerr << "Failed to send APPEND header" << std::endl;
+        return;
+    }
+    PooledBuffer buffer;
+    size_t remaining = len;
+    while (remaining > 0) {
+        in.read(buffer.data(), static_cast<std::streamsize>(std::min(remaining, buffer.size())));
+        std::streamsize got = in.gcount();
+        if (got <= 0 || !this->sendBody(buffer.data(), static_cast<size_t>(got))) {
+            std::cerr << "Failed to send file data" << std::endl;
+            return;
+        }
+        remaining -= static_cast<size_t>(got);
+    }
+
+    std::string resp;
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    if (resp.rfind("OK ", 0) == 0) {
+        std::cout << "Append succeeded, remote size " << resp.substr(3) << std::endl;
+    } else {
+        std::cerr << "Server error: " << resp << std::endl;
+    }
+}
+
+// Log shipping: follow a local file like `tail -f` and stream whatever is
+// appended to it into the remote file over one append-stream.
+void Client::builtin_ship(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: ship <local_path> [remote_path] [seconds]" << std::endl;
+        return;
+    }
+    std::string srcPath = std::string("client_storage/") + argv[1];
+    const char* remotePath = (argc >= 3 ? argv[2] : argv[1]);
+    double seconds = (argc >= 4 ? atof(argv[3]) : 10.0);
+    if (!this->route(remotePath)) return;
+    int fd = open(srcPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open local file: " << srcPath << std::endl;
+        return;
+    }
+    // only data written from now on is shipped
+    lseek(fd, 0, SEEK_END);
+
+    std::string header = std::string("append-stream ") + std::to_string(strlen(remotePath)) + "\n";
+    std::string resp;
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, remotePath, strlen(remotePath)) ||
+        !recvLine(this->s, resp)) {
+        std::cerr << "Failed to start append stream" << std::endl;
+        close(fd);
+        return;
+    }
+    if (resp.rfind("OK", 0) != 0) {
+        std::cerr << "Server error: " << resp << std::endl;
+        close(fd);
+        return;
+    }
+
+    // Stream group: one frame per read of new data, acks drained as they come
+    PooledBuffer buffer;
+    bool alive = true;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while (alive && std::chrono::steady_clock::now() < deadline) {
+        ssize_t got = read(fd, buffer.data(), buffer.size());
+        if (got <= 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        } else {
+            std::string frame = std::to_string(got) + "\n";
+            alive = sendAll(this->s, frame.data(), frame.size()) && this->sendBody(buffer.data(), static_cast<size_t>(got));
+        }
+        struct pollfd pfd;
+        pfd.fd = this->s;
+        pfd.events = POLLIN;
+        while (alive && poll(&pfd, 1, 0) > 0) {
+            if (!recvLine(this->s, resp) || resp.rfind("ACK ", 0) != 0) {
+                std::cerr << "Server error: " << resp << std::endl;
+                alive = false;
+                break;
+            }
+        }
+    }
+    close(fd);
+    if (!alive) return;
+
+    // End group: terminating frame, then skip late acks until the final OK
+    std::string endFrame = "0\n";
+    if (!sendAll(this->s, endFrame.data(), endFrame.size())) {
+        std::cerr << "Failed to end append stream" << std::endl;
+        return;
+    }
+    while (recvLine(this->s, resp)) {
+        if (resp.rfind("ACK ", 0) == 0) continue;
+        if (resp.rfind("OK ", 0) == 0) std::cout << "Shipped " << resp.substr(3) << " bytes to " << remotePath << std::endl;
+        else std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+    std::cerr << "Failed to receive response" << std::endl;
+}
+
+// Block until something under the prefix changes on the server (long-poll)
+void Client::builtin_watch(int argc, char* argv[]) {
+    const char* prefix = (argc >= 2 ? argv[1] : "");
+    std::string header = std::string("watch ") + std::to_string(strlen(prefix)) + " " + std::to_string(this->lastWatchVersion);
+    if (argc >= 3) header += std::string(" ") + argv[2];
+    header += "\n";
+    if (!sendAll(this->s, header.data(), header.size()) || !sendAll(this->s, prefix, strlen(prefix))) {
+        std::cerr << "Failed to send WATCH request" << std::endl;
+        return;
+    }
+
+    // Response group: EVENT <version> <size> <pathLen>\n<path> or TIMEOUT <version>
+    std::string resp;
+    if (!recvLine(this->s, resp)) {
+        std::cerr << "Failed to receive response" << std::endl;
+        return;
+    }
+    std::istringstream iss(resp);
+    std::string kind;
+    unsigned long long version = 0;
+    iss >> kind >> version;
+    if (kind == "TIMEOUT" && iss) {
+        this->lastWatchVersion = version;
+        std::cout << "No changes" << std::endl;
+        return;
+    }
+    size_t size = 0, pathLen = 0;
+    iss >> size >> pathLen;
+    if (kind != "EVENT" || !iss) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+    std::string path(pathLen, '\0');
+    if (!recvExact(this->s, path.data(), pathLen)) {
+        std::cerr << "Failed to receive event path" << std::endl;
+        return;
+    }
+    this->lastWatchVersion = version;
+    std::cout << "Changed: " << path << " (" << size << " bytes, version " << version << ")" << std::endl;
+}
+
+// stat <remote>...: size, mtime and SHA-256 of every path, one request per
+// server (in cluster mode the paths are grouped by owner)
+void Client::builtin_stat(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: stat <remote_path>..." << std::endl;
+        return;
+    }
+    std::map<std::string, std::vector<int>> groups;
+    for (int i = 1; i < argc; i++) {
+        groups[this->ring.empty() ? std::string() : this->ring.owner(argv[i])].push_back(i);
+    }
+
+    std::vector<std::string> results(argc);
+    for (auto &group : groups) {
+        if (!this->routeRead(argv[group.second.front()])) return;
+        // Request group: header and the whole path list in one write
+        std::string list;
+        for (int i : group.second) {
+            if (!list.empty()) list += "\n";
+            list += argv[i];
+        }
+        std::string request = "stat " + std::to_string(group.second.size()) + " " + std::to_string(list.size()) + "\n" + list;
+        std::string resp;
+        if (!sendAll(this->s, request.data(), request.size()) || !recvLine(this->s, resp)) {
+            std::cerr << "Failed to send stat request" << std::endl;
+            return;
+        }
+        size_t count = 0;
+        if (sscanf(resp.c_str(), "OK %zu", &count) != 1 || count != group.second.size()) {
+            std::cerr << "Server error: " << resp << std::endl;
+            return;
+        }
+        // Reply group: one line per path, in request order
+        for (int i : group.second) {
+            if (!recvLine(this->s, results[i])) {
+                std::cerr << "Failed to receive stat reply" << std::endl;
+                return;
+            }
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        long long size, mtime;
+        char sha[65];
+        if (sscanf(results[i].c_str(), "OK %lld %lld %64s", &size, &mtime, sha) == 3) {
+            std::cout << argv[i] << "  " << size << " bytes  mtime " << mtime << "  sha256 " << sha << std::endl;
+        } else {
+            std::cout << argv[i] << "  " << results[i] << std::endl;
+        }
+    }
+}
+
+// Print the server's counters (stats replies OK <len> and "name value" lines)
+void Client::builtin_stats(int argc, char* argv[]) {
+    if (!this->route(nullptr)) return;
+    std::string header = "stats\n";
+    std::string resp;
+    if (!sendAll(this->s, header.data(), header.size()) || !recvLine(this->s, resp)) {
+        std::cerr << "Failed to request stats" << std::endl;
+        return;
+    }
+    size_t len = 0;
+    if (sscanf(resp.c_str(), "OK %zu", &len) != 1) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return;
+    }
+    std::string body(len, '\0');
+    if (!recvExact(this->s, body.data(), len)) {
+        std::cerr << "Failed to receive stats" << std::endl;
+        return;
+    }
+    std::cout << body;
+}
+
+// CPU time (user + system) of the calling thread
+static uint64_t threadCpuUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+// "1048576", "64K", "512M", "2G"
+static bool parseByteCount(const char *text, size_t &out) {
+    char *end = nullptr;
+    unsigned long long n = std::strtoull(text, &end, 10);
+    if (end == text || text[0] == '-') return false;
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; // fall through
+        case 'M': case 'm': n <<= 10; // fall through
+        case 'K': case 'k': n <<= 10; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return false;
+    out = static_cast<size_t>(n);
+    return true;
+}
+
+// Times one bench transfer from the request to the server's closing line
+bool Client::runBench(bool download, size_t bytes, BenchRun &run) {
+    static const std::vector<char> pattern = [] {
+        std::vector<char> out(TUNE_MAX_CHUNK);
+        for (size_t i = 0; i < out.size(); i++) out[i] = static_cast<char>(i * 131 + 7);
+        return out;
+    }();
+    SocketTuner &tuner = this->tunerForSocket();
+    ChunkBuffer buffer;
+    std::string header = std::string(download ? "bench-send " : "bench-recv ") + std::to_string(bytes) + "\n";
+    std::string resp;
+    auto started = std::chrono::steady_clock::now();
+    uint64_t cpuStart = threadCpuUs();
+    if (!sendAll(this->s, header.data(), header.size())) return false;
+
+    // Body group: the same chunking and transport as get/put, minus the files
+    tuner.begin();
+    if (download) {
+        if (!recvLine(this->s, resp) || resp != "OK " + std::to_string(bytes)) {
+            std::cerr << "Server error: " << resp << std::endl;
+            return false;
+        }
+    }
+    for (size_t remaining = bytes; remaining > 0;) {
+        size_t chunk = std::min(remaining, std::min(tuner.chunkSize(), pattern.size()));
+        if (download ? !this->recvBody(buffer.get(chunk), chunk) : !this->sendBody(pattern.data(), chunk)) return false;
+        tuner.progress(chunk, !download);
+        remaining -= chunk;
+    }
+
+    // Trailer group: the server's own time and CPU for the body
+    unsigned long long serverUs = 0, serverCpuUs = 0;
+    if (!recvLine(this->s, resp) || sscanf(resp.c_str(), "OK %llu %llu", &serverUs, &serverCpuUs) != 2) {
+        std::cerr << "Server error: " << resp << std::endl;
+        return false;
+    }
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    run.cpuUs = threadCpuUs() - cpuStart;
+    run.serverUs = serverUs;
+    run.serverCpuUs = serverCpuUs;
+    return true;
+}
+
+void Client::builtin_bench(int argc, char* argv[]) {
+    // CLI parsing group: byte count and whether to skip the proxy
+    size_t bytes = 0;
+    bool direct = argc >= 3 && strcmp(argv[2], "direct") == 0;
+    if (argc < 2 || !parseByteCount(argv[1], bytes) || (argc >= 3 && !direct)) {
+        std::cerr << "usage: bench <bytes>[K|M|G] [direct]" << std::endl;
+        return;
+    }
+    if (!this->route(nullptr)) return;
+    bool local = this->host && strncmp(this->host, LOCAL_HOST_PREFIX, strlen(LOCAL_HOST_PREFIX)) == 0;
+    std::string hop = !this->host ? "mux stream" : local ? (this->shm ? "shared memory" : "unix socket") : "proxy";
+    int directSock = -1;
+    if (direct && this->host && !local) {
+        if ((directSock = this->openDirect()) < 0) return;
+        hop = "direct";
+    }
+    int savedSock = this->s;
+    if (directSock >= 0) this->s = directSock;
+
+    // RTT group: empty bench-recvs, one small write each way (an empty
+    // bench-send would answer with two, which Nagle can hold back)
+    const int probes = 10;
+    double minMs = 0, totalMs = 0;
+    BenchRun run;
+    bool ok = true;
+    for (int i = 0; i < probes && ok; i++) {
+        ok = this->runBench(false, 0, run);
+        double ms = run.seconds * 1000;
+        minMs = i == 0 ? ms : std::min(minMs, ms);
+        totalMs += ms;
+    }
+    char line[256];
+    if (ok) {
+        snprintf(line, sizeof(line), "rtt min %.3f ms, avg %.3f ms (%d probes)", minMs, totalMs / probes, probes);
+        std::cout << "bench via " << hop << ": " << line << std::endl;
+    }
+
+    // Throughput group: download then upload, CPU in ns per byte on each end
+    for (int download = 1; ok && download >= 0; download--) {
+        if (!(ok = this->runBench(download, bytes, run))) break;
+        double mb = static_cast<double>(bytes) / (1024 * 1024);
+        double perByte = bytes > 0 ? 1000.0 / static_cast<double>(bytes) : 0;
+        snprintf(line, sizeof(line), "%.1f MB in %.3f s (%.1f MB/s), cpu/byte client %.2f ns, server %.2f ns (server busy %.3f s)",
+                 mb, run.seconds, run.seconds > 0 ? mb / run.seconds : 0.0,
+                 run.cpuUs * perByte, run.serverCpuUs * perByte, run.serverUs / 1e6);
+        std::cout << (download ? "download: " : "upload:   ") << line << std::endl;
+    }
+    if (!ok) std::cerr << "bench failed" << std::endl;
+
+    this->s = savedSock;
+    if (directSock >= 0) close(directSock);
+}
+
+// Dedicated connection for mux (the main one stays usable for plain commands)
+bool Client::startMux() {
+    if (this->mux) return true;
+    if (!this->host) {
+        std::cerr << "mux: not available inside a mux stream" << std::endl;
+        return false;
+    }
+    if (strncmp(this->host, LOCAL_HOST_PREFIX, strlen(LOCAL_HOST_PREFIX)) == 0) {
+        this->muxSock = connectUnix(this->host + strlen(LOCAL_HOST_PREFIX));
+    } else {
+        this->muxSock = this->openProxied(this->host, SERVER_PORT);
+    }
+    std::string header = "mux\n";
+    std::string resp;
+    if (this->muxSock < 0 || !sendAll(this->muxSock, header.data(), header.size()) ||
+        !recvLine(this->muxSock, resp) || resp != "OK") {
+        std::cerr << "mux: server refused: " << resp << std::endl;
+        if (this->muxSock >= 0) close(this->muxSock);
+        this->muxSock = -1;
+        return false;
+    }
+    this->mux.reset(new MuxSession(this->muxSock, true));
+    this->muxThread = std::thread(&MuxSession::run, this->mux.get());
+    std::cout << "Client: multiplexed connection ready" << std::endl;
+    return true;
+}
+
+// mux <command> [; <command> ...]: every command runs on its own stream,
+// concurrently, so small requests finish while a bulk transfer is running
+void Client::builtin_mux(int argc, char* argv[]) {
+    std::vector<std::string> lines(1);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], ";") == 0) { lines.emplace_back(); continue; }
+        if (!lines.back().empty()) lines.back() += " ";
+        lines.back() += argv[i];
+    }
+    lines.erase(std::remove(lines.begin(), lines.end(), std::string()), lines.end());
+    if (lines.empty()) {
+        std::cerr << "usage: mux <command> [; <command> ...]" << std::endl;
+        return;
+    }
+    if (!this->startMux()) return;
+
+    std::vector<std::thread> workers;
+    auto started = std::chrono::steady_clock::now();
+    for (const std::string &line : lines) {
+        int fd = this->mux->openStream();
+        if (fd < 0) {
+            perror("mux: stream");
+            continue;
+        }
+        workers.emplace_back([fd, line, started]() {
+            Client stream(fd);
+            stream.registerCommands();
+            std::vector<char> buf(line.begin(), line.end());
+            buf.push_back('\0');
+            stream.commandHandler.executeCommand(buf.data());
+            close(fd);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+            std::cout << "[mux] " << line << ": done after " << ms << " ms" << std::endl;
+        });
+    }
+    for (auto &t : workers) t.join();
+}
+
 void Client::registerCommands() {
     // Register "put" command with a lambda that calls the member function
 
@@ -281,6 +1401,66 @@ void Client::registerCommands() {
         this->builtin_get(argc, argv);
         return 0;
     });
+    this->commandHandler.registerCommand("uput", [this](int argc, char* argv[]) {
+        this->builtin_udp_put(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("uget", [this](int argc, char* argv[]) {
+        this->builtin_udp_get(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("sput", [this](int argc, char* argv[]) {
+        this->builtin_sparse_put(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("sget", [this](int argc, char* argv[]) {
+        this->builtin_sparse_get(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("swarm", [this](int argc, char* argv[]) {
+        this->builtin_swarm(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("copy", [this](int argc, char* argv[]) {
+        this->builtin_copy(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("move", [this](int argc, char* argv[]) {
+        this->builtin_move(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("append", [this](int argc, char* argv[]) {
+        this->builtin_append(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("ship", [this](int argc, char* argv[]) {
+        this->builtin_ship(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("watch", [this](int argc, char* argv[]) {
+        this->builtin_watch(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("mux", [this](int argc, char* argv[]) {
+        this->builtin_mux(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("hput", [this](int argc, char* argv[]) {
+        this->builtin_hash_put(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("stat", [this](int argc, char* argv[]) {
+        this->builtin_stat(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("stats", [this](int argc, char* argv[]) {
+        this->builtin_stats(argc, argv);
+        return 0;
+    });
+    this->commandHandler.registerCommand("bench", [this](int argc, char* argv[]) {
+        this->builtin_bench(argc, argv);
+        return 0;
+    });
 }
 
 void Client::mainloop() {
@@ -294,6 +1474,8 @@ void Client::mainloop() {
 }
 
 int main(int argc, char* argv[]) {
+    // a swarm source that drops its connection must not kill the client
+    signal(SIGPIPE, SIG_IGN);
     Client client(argc, argv);
     client.connectToServer();
     client.registerCommands();
@@ -12,12 +12,26 @@
 #include <netdb.h>
 #include <functional>
 #include <filesystem> 
+#include <memory>
 #include "../common/CommandHandler.h"
+#include "../common/ShmRing.h"
+#include "../common/HashRing.h"
+#include "../common/BufferPool.h"
+#include "../common/SparseIO.h"
+#include "../common/Mux.h"
+#include "../common/Sha256.h"
+#include "../common/SocketTuner.h"
+#include "../common/UdpTransfer.h"
+#include "DownloadCache.h"
+#include <thread>
+#include <map>
 
 #define MAX_LINE 256
 #define SERVER_PORT 5432
 //added proxy port
 #define PROXY_PORT 5465
+// host prefix selecting the server's local Unix-domain socket, e.g. unix:../server/server.sock
+#define LOCAL_HOST_PREFIX "unix:"
 
 
 class Client {
@@ -30,16 +44,78 @@ class Client {
         int s;
         int len;
         CommandHandler commandHandler;
+        // shared-memory rings for file bodies, only on local connections
+        std::unique_ptr<ShmTransport> shm;
+        // version of the last change seen by `watch`, so none are missed in between
+        unsigned long long lastWatchVersion;
+        // cluster mode: owner lookup and one cached connection per node
+        HashRing ring;
+        std::map<std::string, int> nodeSocks;
+        // chain replication: gets go to the tail, everything else to the head
+        std::string tailNode;
+        int headSock;
+        int openProxied(const std::string &serverHost, int serverPort);
+        bool route(const char *remotePath);
+        bool routeRead(const char *remotePath);
+        bool useNode(const std::string &node);
+        // host (and port) of the server behind this->s, for the UDP data channel and `bench direct` ("" if unknown)
+        std::string serverHost(int *port = nullptr);
+        // TCP connection to that server that skips the proxy (-1 on failure)
+        int openDirect();
+        // one bench-send (download) or bench-recv (upload) of `bytes` on this->s
+        struct BenchRun {
+            double seconds;
+            uint64_t cpuUs, serverUs, serverCpuUs;
+        };
+        bool runBench(bool download, size_t bytes, BenchRun &run);
+        void connectLocal(const char *path);
+        bool sendBody(const void *buf, size_t len);
+        bool sendFileBody(std::ifstream &in, size_t size);
+        bool recvBody(void *buf, size_t len);
+        // BDP-driven chunk and socket buffer sizing for the current socket
+        SocketTuner tuner;
+        SocketTuner &tunerForSocket();
+        // ETags of files `get` left in client_storage/, for conditional gets
+        DownloadCache downloads;
+        void sendPathPairCommand(const char *verb, int argc, char* argv[]);
+        // multiplexed connection used by `mux`, opened on first use
+        std::unique_ptr<MuxSession> mux;
+        int muxSock;
+        std::thread muxThread;
+        bool startMux();
+        // a client bound to one mux stream, running one sub-command
+        explicit Client(int streamSock);
 
     public:
         Client() = default;
         // create a client with the host name from when you run the program
         // like ./client localhost
         Client(int argc, char* argv[]);
-        ~Client() = default;
+        ~Client();
         void registerCommands();
         void builtin_put(int argc, char* argv[]);
+        void builtin_hash_put(int argc, char* argv[]);
         void builtin_get(int argc, char* argv[]);
+        // put/get with the body on a UDP data channel (long fat lossy links)
+        void builtin_udp_put(int argc, char* argv[]);
+        void builtin_udp_get(int argc, char* argv[]);
+        // put/get that only move the data extents of sparse files
+        void builtin_sparse_put(int argc, char* argv[]);
+        void builtin_sparse_get(int argc, char* argv[]);
+        // parallel ranged get of one file from several replicas
+        void builtin_swarm(int argc, char* argv[]);
+        void builtin_copy(int argc, char* argv[]);
+        void builtin_move(int argc, char* argv[]);
+        void builtin_append(int argc, char* argv[]);
+        void builtin_ship(int argc, char* argv[]);
+        void builtin_watch(int argc, char* argv[]);
+        // size, mtime and checksum of many remote files in one round trip
+        void builtin_stat(int argc, char* argv[]);
+        void builtin_stats(int argc, char* argv[]);
+        // network-only throughput, RTT and CPU per byte, via the proxy or direct
+        void builtin_bench(int argc, char* argv[]);
+        // run several commands at once on streams of one connection
+        void builtin_mux(int argc, char* argv[]);
         void connectToServer();
         void mainloop();
 
@@ -0,0 +1,94 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+
+/*
+Affinity
+--------
+
+    Optional NUMA-aware placement of per-connection worker threads
+    (`--affinity` on the server and proxy_http). `enable` reads the node
+    layout from /sys/devices/system/node (one node holding every allowed
+    CPU when there is none) and restricts it to the CPUs the process may
+    run on.
+
+    For every accepted connection `placeConnection` picks a node and a
+    core on it:
+
+    - the node of the CPU that received the connection's packets
+      (SO_INCOMING_CPU, i.e. where the NIC queue's interrupts land),
+    - else the node the NIC itself sits on
+      (/sys/class/net/<interface of the local address>/device/numa_node),
+    - else the node with the fewest workers.
+
+    Within the node the core with the fewest workers wins. The worker then
+    holds a PinnedThread for its lifetime: the thread is bound to that core
+    and takes its I/O buffers from the node's BufferPool, so a connection's
+    socket processing, buffers and thread stay on one node.
+
+    Without `enable` placeConnection returns -1 and PinnedThread does
+    nothing. `statsText` gives the `affinity.*` lines of the server's stats.
+*/
+
+class Affinity {
+    private:
+        struct Cpu {
+            int id;
+            int node;
+            int workers;
+        };
+
+        bool on;
+        std::mutex mtx;
+        std::vector<Cpu> cpus;
+        std::vector<int> nodeIds;                    // nodes that have allowed CPUs
+        std::map<std::string, int> nicNodes;         // interface -> NUMA node (-1 unknown)
+
+        Affinity();
+        int nicNode(int sock);
+        int nodeOfCpuLocked(int cpu) const;
+
+    public:
+        std::atomic<unsigned long> steeredRxCpu;
+        std::atomic<unsigned long> steeredNic;
+        std::atomic<unsigned long> balanced;
+
+        static Affinity &instance();
+        // read the topology and turn placement on; false if it stays off
+        bool enable();
+        bool enabled() const { return this->on; }
+        size_t nodeCount() const { return this->nodeIds.size(); }
+        // core for the worker serving `sock`, counted as taken until the
+        // worker's PinnedThread ends; -1 when affinity is off
+        int placeConnection(int sock);
+        int nodeOfCpu(int cpu);
+        void releaseCpu(int cpu);
+        // "affinity.* value" lines for the stats command
+        std::string statsText();
+};
+
+/*
+PinnedThread
+------------
+    Binds the calling thread to `cpu` and its node's buffer pool until the
+    object goes away (cpu -1: no-op).
+*/
+class PinnedThread {
+    private:
+        int cpu;
+
+    public:
+        explicit PinnedThread(int cpu);
+        ~PinnedThread();
+        PinnedThread(const PinnedThread &) = delete;
+        PinnedThread &operator=(const PinnedThread &) = delete;
+};
+
+#endif // AFFINITY_H
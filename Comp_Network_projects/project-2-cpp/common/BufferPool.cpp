@@ -0,0 +1,225 @@
+#include "BufferPool.h"
+
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// Per-thread cache in front of the shared stack of one pool (the thread's node's)
+struct BufferPoolThreadCache {
+    BufferPool *owner = nullptr;
+    uint32_t items[BUFFER_POOL_THREAD_CACHE];
+    int count = 0;
+
+    void flush() {
+        while (this->count > 0) this->owner->pushShared(this->items[--this->count]);
+    }
+    ~BufferPoolThreadCache() {
+        if (this->owner) this->flush();
+    }
+};
+
+static thread_local BufferPoolThreadCache threadCache;
+static thread_local int threadNode = -1;
+static std::atomic<bool> hugePages(false);
+// slot 0 is the default pool, slot n + 1 the pool of node n; never destroyed,
+// since thread caches may hand buffers back during exit
+static std::atomic<BufferPool *> pools[BUFFER_POOL_MAX_NODES + 1];
+
+BufferPool &BufferPool::instance() {
+    return forNode(threadNode);
+}
+
+BufferPool &BufferPool::forNode(int node) {
+    if (node < -1 || node >= BUFFER_POOL_MAX_NODES) node = -1;
+    std::atomic<BufferPool *> &slot = pools[node + 1];
+    BufferPool *pool = slot.load(std::memory_order_acquire);
+    if (pool) return *pool;
+    BufferPool *created = new BufferPool(node);
+    if (slot.compare_exchange_strong(pool, created, std::memory_order_acq_rel)) return *created;
+    delete created;
+    return *pool;
+}
+
+void BufferPool::setThreadNode(int node) {
+    threadNode = node;
+}
+
+BufferPool::BufferPool(int node)
+    : freeHead(NONE), slabCount(0), node(node), acquires(0), threadCacheHits(0),
+      sharedHits(0), hugeSlabs(0), inUse(0), highWater(0), failures(0) {
+    for (auto &slab : this->slabs) slab.store(nullptr, std::memory_order_relaxed);
+}
+
+void BufferPool::useHugePages(bool enable) {
+    hugePages = enable;
+}
+
+char *BufferPool::data(uint32_t index) {
+    char *slab = this->slabs[index / PER_SLAB].load(std::memory_order_acquire);
+    return slab + static_cast<size_t>(index % PER_SLAB) * BUFFER_POOL_BUF_SIZE;
+}
+
+uint32_t BufferPool::popShared() {
+    uint64_t head = this->freeHead.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t index = static_cast<uint32_t>(head);
+        if (index == NONE) return NONE;
+        uint32_t nextIndex = this->next[index].load(std::memory_order_relaxed);
+        uint64_t newHead = ((head >> 32) + 1) << 32 | nextIndex;
+        if (this->freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel)) return index;
+    }
+}
+
+void BufferPool::pushShared(uint32_t index) {
+    uint64_t head = this->freeHead.load(std::memory_order_relaxed);
+    while (true) {
+        this->next[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        uint64_t newHead = ((head >> 32) + 1) << 32 | index;
+        if (this->freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel)) return;
+    }
+}
+
+// Map one more slab and push its buffers; only one thread grows at a time
+bool BufferPool::growSlab() {
+    static std::mutex growMtx;
+    std::lock_guard<std::mutex> lock(growMtx);
+    if (static_cast<uint32_t>(this->freeHead.load()) != NONE) return true;   // someone else just grew
+    uint32_t slabIndex = this->slabCount.load();
+    if (slabIndex >= BUFFER_POOL_MAX_SLABS) return false;
+
+    char *slab = nullptr;
+    if (hugePages) {
+        void *p = mmap(nullptr, BUFFER_POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            slab = static_cast<char *>(p);
+            this->hugeSlabs++;
+        }
+    }
+    if (!slab) {
+        // over-map so the slab can start on a 2 MiB boundary (needed for THP)
+        size_t len = 2 * BUFFER_POOL_SLAB_SIZE;
+        void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        uintptr_t start = reinterpret_cast<uintptr_t>(p);
+        uintptr_t aligned = (start + BUFFER_POOL_SLAB_SIZE - 1) & ~static_cast<uintptr_t>(BUFFER_POOL_SLAB_SIZE - 1);
+        if (aligned > start) munmap(p, aligned - start);
+        if (aligned + BUFFER_POOL_SLAB_SIZE < start + len) {
+            munmap(reinterpret_cast<void *>(aligned + BUFFER_POOL_SLAB_SIZE), start + len - aligned - BUFFER_POOL_SLAB_SIZE);
+        }
+        slab = reinterpret_cast<char *>(aligned);
+        madvise(slab, BUFFER_POOL_SLAB_SIZE, MADV_HUGEPAGE);
+    }
+    if (this->node >= 0) {
+        // nothing is faulted in yet, so every page lands on the node (if it has memory)
+        unsigned long mask = 1UL << this->node;
+        syscall(SYS_mbind, slab, BUFFER_POOL_SLAB_SIZE, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+
+    this->slabs[slabIndex].store(slab, std::memory_order_release);
+    this->slabCount.store(slabIndex + 1);
+    for (uint32_t i = PER_SLAB; i > 0; i--) this->pushShared(slabIndex * PER_SLAB + i - 1);
+    return true;
+}
+
+void BufferPool::noteAcquire() {
+    uint64_t used = ++this->inUse;
+    uint64_t high = this->highWater.load(std::memory_order_relaxed);
+    while (used > high && !this->highWater.compare_exchange_weak(high, used, std::memory_order_relaxed)) {}
+}
+
+uint32_t BufferPool::acquire() {
+    this->acquires.fetch_add(1, std::memory_order_relaxed);
+    if (threadCache.owner != this) {
+        // the thread moved to another node's pool: give the old one its buffers back
+        if (threadCache.owner) threadCache.flush();
+        threadCache.owner = this;
+    }
+    if (threadCache.count > 0) {
+        this->threadCacheHits.fetch_add(1, std::memory_order_relaxed);
+        this->noteAcquire();
+        return threadCache.items[--threadCache.count];
+    }
+    while (true) {
+        uint32_t index = this->popShared();
+        if (index != NONE) {
+            this->sharedHits.fetch_add(1, std::memory_order_relaxed);
+            this->noteAcquire();
+            return index;
+        }
+        if (!this->growSlab()) {
+            this->failures.fetch_add(1, std::memory_order_relaxed);
+            return NONE;
+        }
+    }
+}
+
+void BufferPool::release(uint32_t index) {
+    this->inUse--;
+    if (threadCache.owner == this && threadCache.count < BUFFER_POOL_THREAD_CACHE) {
+        threadCache.items[threadCache.count++] = index;
+        return;
+    }
+    this->pushShared(index);
+}
+
+BufferPoolStats BufferPool::stats() {
+    BufferPoolStats s;
+    s.acquires = this->acquires.load();
+    s.threadCacheHits = this->threadCacheHits.load();
+    s.sharedHits = this->sharedHits.load();
+    s.slabs = this->slabCount.load();
+    s.hugeSlabs = this->hugeSlabs.load();
+    s.inUse = this->inUse.load();
+    s.highWater = this->highWater.load();
+    s.failures = this->failures.load();
+    return s;
+}
+
+// "key value" lines, as sent by the server's stats command
+std::string BufferPool::statsText() {
+    BufferPoolStats s = this->stats();
+    std::string out;
+    out += "bufpool.buffer_size " + std::to_string(BUFFER_POOL_BUF_SIZE) + "\n";
+    out += "bufpool.acquires " + std::to_string(s.acquires) + "\n";
+    out += "bufpool.thread_cache_hits " + std::to_string(s.threadCacheHits) + "\n";
+    out += "bufpool.shared_hits " + std::to_string(s.sharedHits) + "\n";
+    out += "bufpool.slabs " + std::to_string(s.slabs) + "\n";
+    out += "bufpool.huge_slabs " + std::to_string(s.hugeSlabs) + "\n";
+    out += "bufpool.bytes_mapped " + std::to_string(s.slabs * BUFFER_POOL_SLAB_SIZE) + "\n";
+    out += "bufpool.in_use " + std::to_string(s.inUse) + "\n";
+    out += "bufpool.high_water " + std::to_string(s.highWater) + "\n";
+    out += "bufpool.heap_fallbacks " + std::to_string(s.failures) + "\n";
+    return out;
+}
+
+std::string BufferPool::allStatsText() {
+    std::string out = forNode(-1).statsText();
+    for (int node = 0; node < BUFFER_POOL_MAX_NODES; node++) {
+        BufferPool *pool = pools[node + 1].load(std::memory_order_acquire);
+        if (!pool) continue;
+        BufferPoolStats s = pool->stats();
+        std::string prefix = "bufpool.node" + std::to_string(node) + ".";
+        out += prefix + "acquires " + std::to_string(s.acquires) + "\n";
+        out += prefix + "slabs " + std::to_string(s.slabs) + "\n";
+        out += prefix + "in_use " + std::to_string(s.inUse) + "\n";
+        out += prefix + "high_water " + std::to_string(s.highWater) + "\n";
+    }
+    return out;
+}
+
+PooledBuffer::PooledBuffer() {
+    this->pool = &BufferPool::instance();
+    this->index = this->pool->acquire();
+    this->ptr = this->index != BufferPool::NONE ? this->pool->data(this->index) : new char[BUFFER_POOL_BUF_SIZE];
+}
+
+PooledBuffer::~PooledBuffer() {
+    if (this->index != BufferPool::NONE) this->pool->release(this->index);
+    else delete[] this->ptr;
+}
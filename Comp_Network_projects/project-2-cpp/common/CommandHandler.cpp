@@ -18,13 +18,15 @@ void CommandHandler::executeCommand(char *command) const {
         return;
     }
 
-    // strtok modifies the input buffer in-place by inserting null terminators
+    // strtok_r modifies the input buffer in-place by inserting null terminators
     // at delimiter positions. This is why we duplicated the input above.
-    char* token = strtok(cmd_copy, " \t\n");
+    // (strtok_r rather than strtok: connection threads tokenize concurrently.)
+    char* saveptr = nullptr;
+    char* token = strtok_r(cmd_copy, " \t\n", &saveptr);
     while (token != nullptr) {
         argv.push_back(token);
         argc++;
-        token = strtok(nullptr, " \t\n");
+        token = strtok_r(nullptr, " \t\n", &saveptr);
     }
 
     std::cout << "command: " << command << std::endl;
@@ -0,0 +1,89 @@
+#include "HashRing.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+HashRing::HashRing(int v) : vnodes(v) {}
+
+uint64_t HashRing::hash(const std::string &key) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    // finalizer (splitmix64) so nearby keys land far apart
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+void HashRing::addNode(const std::string &node, int weight) {
+    if (this->contains(node)) return;
+    this->members.push_back(node);
+    for (int i = 0; i < this->vnodes * std::max(weight, 1); i++) {
+        this->points[hash(node + "#" + std::to_string(i))] = node;
+    }
+}
+
+void HashRing::removeNode(const std::string &node) {
+    this->members.erase(std::remove(this->members.begin(), this->members.end(), node), this->members.end());
+    for (auto it = this->points.begin(); it != this->points.end();) {
+        if (it->second == node) it = this->points.erase(it);
+        else ++it;
+    }
+}
+
+bool HashRing::empty() const {
+    return this->points.empty();
+}
+
+bool HashRing::contains(const std::string &node) const {
+    return std::find(this->members.begin(), this->members.end(), node) != this->members.end();
+}
+
+// Callers check empty() first
+const std::string &HashRing::owner(const std::string &key) const {
+    auto it = this->points.lower_bound(hash(key));
+    if (it == this->points.end()) it = this->points.begin();
+    return it->second;
+}
+
+const std::vector<std::string> &HashRing::nodes() const {
+    return this->members;
+}
+
+bool loadClusterConfig(const std::string &path, HashRing &ring) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream iss(line);
+        std::string node;
+        int weight = 1;
+        if (!(iss >> node)) continue;
+        if (!(iss >> weight)) weight = 1;
+        std::string host;
+        int port;
+        if (!splitHostPort(node, host, port)) return false;
+        ring.addNode(node, weight);
+    }
+    return !ring.empty();
+}
+
+bool splitHostPort(const std::string &node, std::string &host, int &port) {
+    size_t col = node.rfind(':');
+    if (col == std::string::npos || col == 0) return false;
+    char *end = nullptr;
+    long p = std::strtol(node.c_str() + col + 1, &end, 10);
+    if (*end != '\0' || p <= 0 || p > 65535) return false;
+    host = node.substr(0, col);
+    port = static_cast<int>(p);
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef HASH_RING_H
+#define HASH_RING_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define HASH_RING_VNODES 128
+
+/*
+HashRing
+--------
+
+    Consistent-hash ring used by the cluster mode of the file server. Every
+    node ("host:port") is placed on a 64-bit ring at HASH_RING_VNODES points
+    per unit of weight; a logical path belongs to the first node point at or
+    after the path's hash (wrapping around).
+
+    Adding or removing a node only moves the paths in the ranges next to
+    that node's points, roughly 1/N of the data, and every other path keeps
+    its owner. server/rebalance.cpp moves exactly those files.
+
+    The hash is FNV-1a 64 followed by a 64-bit finalizer so that similar
+    keys ("node#1", "node#2", "logs/a", "logs/b") spread over the ring.
+
+Cluster file (one node per line, '#' starts a comment):
+    localhost:5432
+    localhost:5433  2      optional weight (more virtual nodes)
+*/
+
+class HashRing {
+    private:
+        int vnodes;
+        std::map<uint64_t, std::string> points;
+        std::vector<std::string> members;
+
+    public:
+        explicit HashRing(int vnodes = HASH_RING_VNODES);
+        void addNode(const std::string &node, int weight = 1);
+        void removeNode(const std::string &node);
+        bool empty() const;
+        bool contains(const std::string &node) const;
+        const std::string &owner(const std::string &key) const;
+        const std::vector<std::string> &nodes() const;
+        static uint64_t hash(const std::string &key);
+};
+
+bool loadClusterConfig(const std::string &path, HashRing &ring);
+
+// "host:port" -> host, port; false if the port is missing or invalid
+bool splitHostPort(const std::string &node, std::string &host, int &port);
+
+#endif // HASH_RING_H
@@ -0,0 +1,266 @@
+#include "Mux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void putU32(char *p, uint32_t v) {
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+static uint32_t getU32(const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | (uint32_t)u[3];
+}
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+MuxSession::MuxSession(int sock, bool initiator, StreamAcceptor onStream)
+    : sock(sock), initiator(initiator), onStream(onStream), stopping(false), nextId(1), lastPeerId(0), outOff(0) {
+    this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+MuxSession::~MuxSession() {
+    for (auto &entry : this->streams) close(entry.second.fd);
+    for (auto &entry : this->opened) close(entry.second);
+    if (this->wakeFd >= 0) close(this->wakeFd);
+}
+
+int MuxSession::openStream() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return -1;
+    setNonBlocking(sv[0]);
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->opened.emplace_back(this->nextId, sv[0]);
+        this->nextId += 2;
+    }
+    uint64_t one = 1;
+    if (write(this->wakeFd, &one, sizeof(one)) < 0) {}
+    return sv[1];
+}
+
+void MuxSession::stop() {
+    this->stopping = true;
+    uint64_t one = 1;
+    if (write(this->wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+void MuxSession::queueFrame(uint8_t type, uint32_t id, const char *data, uint32_t len) {
+    char header[MUX_HEADER_BYTES];
+    header[0] = static_cast<char>(type);
+    putU32(header + 1, id);
+    putU32(header + 5, len);
+    this->out.append(header, sizeof(header));
+    if (len > 0) this->out.append(data, len);
+}
+
+MuxSession::Stream &MuxSession::addStream(uint32_t id, int fd) {
+    Stream &st = this->streams[id];
+    st.fd = fd;
+    st.sendWindow = MUX_WINDOW_BYTES;
+    st.recvWindow = MUX_WINDOW_BYTES;
+    st.ungranted = 0;
+    st.localEof = st.peerFin = st.shutWr = false;
+    return st;
+}
+
+void MuxSession::closeStream(uint32_t id, bool reset) {
+    auto it = this->streams.find(id);
+    if (it == this->streams.end()) return;
+    if (reset) this->queueFrame(MUX_RESET, id, nullptr, 0);
+    close(it->second.fd);
+    this->streams.erase(it);
+}
+
+// Write what the peer sent into the stream's socket; credit goes back as it is consumed
+void MuxSession::deliver(uint32_t id, Stream &st) {
+    while (!st.pending.empty()) {
+        ssize_t n = send(st.fd, st.pending.data(), st.pending.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            this->closeStream(id, true);     // the local reader went away
+            return;
+        }
+        st.pending.erase(0, static_cast<size_t>(n));
+        st.ungranted += static_cast<uint32_t>(n);
+    }
+    if (st.ungranted >= MUX_WINDOW_BYTES / 4) {
+        char credit[4];
+        putU32(credit, st.ungranted);
+        this->queueFrame(MUX_WINDOW, id, credit, sizeof(credit));
+        st.recvWindow += st.ungranted;
+        st.ungranted = 0;
+    }
+    if (st.peerFin && st.pending.empty() && !st.shutWr) {
+        shutdown(st.fd, SHUT_WR);
+        st.shutWr = true;
+    }
+    if (st.localEof && st.shutWr) this->closeStream(id, false);
+}
+
+// false on a protocol violation (the session is torn down)
+bool MuxSession::handleFrame(uint8_t type, uint32_t id, const char *data, uint32_t len) {
+    auto it = this->streams.find(id);
+    if (it == this->streams.end()) {
+        // the first frame of a peer-initiated stream opens it; anything else
+        // is for a stream we already closed
+        bool peerId = this->initiator ? (id % 2 == 0) : (id % 2 == 1);
+        if (type != MUX_DATA || !peerId || id <= this->lastPeerId || !this->onStream) return true;
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+            this->queueFrame(MUX_RESET, id, nullptr, 0);
+            return true;
+        }
+        setNonBlocking(sv[0]);
+        this->lastPeerId = id;
+        this->addStream(id, sv[0]);
+        this->onStream(sv[1]);
+        it = this->streams.find(id);
+    }
+    Stream &st = it->second;
+    switch (type) {
+        case MUX_DATA:
+            if (st.peerFin || len > st.recvWindow) return false;
+            st.recvWindow -= len;
+            st.pending.append(data, len);
+            this->deliver(id, st);
+            return true;
+        case MUX_FIN:
+            st.peerFin = true;
+            this->deliver(id, st);
+            return true;
+        case MUX_WINDOW:
+            if (len != 4) return false;
+            st.sendWindow += getU32(data);
+            return true;
+        case MUX_RESET:
+            this->closeStream(id, false);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MuxSession::flushOut() {
+    while (this->outOff < this->out.size()) {
+        ssize_t n = send(this->sock, this->out.data() + this->outOff, this->out.size() - this->outOff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        this->outOff += static_cast<size_t>(n);
+    }
+    if (this->outOff == this->out.size()) {
+        this->out.clear();
+        this->outOff = 0;
+    }
+    return true;
+}
+
+void MuxSession::run() {
+    int savedFlags = fcntl(this->sock, F_GETFL);
+    setNonBlocking(this->sock);
+    std::vector<char> buf(MUX_CHUNK);
+    std::vector<struct pollfd> pfds;
+    std::vector<uint32_t> ids;
+
+    while (!this->stopping) {
+        {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            for (auto &entry : this->opened) this->addStream(entry.first, entry.second);
+            this->opened.clear();
+        }
+
+        // Poll group: the socket, the wake-up eventfd and every stream that can move
+        bool roomOut = this->out.size() - this->outOff < MUX_OUTBUF_LIMIT;
+        pfds.clear();
+        ids.clear();
+        pfds.push_back({this->sock, static_cast<short>(POLLIN | (this->outOff < this->out.size() ? POLLOUT : 0)), 0});
+        pfds.push_back({this->wakeFd, POLLIN, 0});
+        for (auto &entry : this->streams) {
+            Stream &st = entry.second;
+            short events = 0;
+            if (!st.localEof && st.sendWindow > 0 && roomOut) events |= POLLIN;
+            if (!st.pending.empty()) events |= POLLOUT;
+            if (!events) continue;
+            pfds.push_back({st.fd, events, 0});
+            ids.push_back(entry.first);
+        }
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[1].revents) {
+            uint64_t v;
+            if (read(this->wakeFd, &v, sizeof(v)) < 0) {}
+        }
+
+        // Inbound group: parse every complete frame the peer sent
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            bool closed = false;
+            while (true) {
+                ssize_t n = recv(this->sock, buf.data(), buf.size(), 0);
+                if (n > 0) { this->in.append(buf.data(), static_cast<size_t>(n)); continue; }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) closed = true;
+                if (n < 0 && errno == EINTR) continue;
+                break;
+            }
+            size_t pos = 0;
+            bool ok = true;
+            while (ok && this->in.size() - pos >= MUX_HEADER_BYTES) {
+                uint8_t type = static_cast<uint8_t>(this->in[pos]);
+                uint32_t id = getU32(&this->in[pos + 1]);
+                uint32_t len = getU32(&this->in[pos + 5]);
+                if (len > MUX_WINDOW_BYTES) { ok = false; break; }
+                if (this->in.size() - pos - MUX_HEADER_BYTES < len) break;
+                ok = this->handleFrame(type, id, this->in.data() + pos + MUX_HEADER_BYTES, len);
+                pos += MUX_HEADER_BYTES + len;
+            }
+            this->in.erase(0, pos);
+            if (closed || !ok) break;
+        }
+
+        // Stream group: one chunk per ready stream, then flush what the peer consumed
+        for (size_t i = 0; i < ids.size(); i++) {
+            short revents = pfds[i + 2].revents;
+            auto it = this->streams.find(ids[i]);
+            if (!revents || it == this->streams.end()) continue;
+            Stream &st = it->second;
+            if ((revents & POLLOUT) || ((revents & (POLLHUP | POLLERR)) && !st.pending.empty())) {
+                this->deliver(ids[i], st);
+                it = this->streams.find(ids[i]);
+                if (it == this->streams.end()) continue;
+            }
+            if (!(revents & (POLLIN | POLLHUP | POLLERR)) || st.localEof || st.sendWindow == 0) continue;
+            size_t want = std::min<size_t>(buf.size(), st.sendWindow);
+            ssize_t n = recv(st.fd, buf.data(), want, 0);
+            if (n > 0) {
+                this->queueFrame(MUX_DATA, ids[i], buf.data(), static_cast<uint32_t>(n));
+                st.sendWindow -= static_cast<uint32_t>(n);
+            } else if (n == 0) {
+                this->queueFrame(MUX_FIN, ids[i], nullptr, 0);
+                st.localEof = true;
+                if (st.shutWr) this->closeStream(ids[i], false);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                this->closeStream(ids[i], true);
+            }
+        }
+
+        if (!this->flushOut()) break;
+    }
+
+    // Teardown: every stream end sees EOF
+    for (auto &entry : this->streams) close(entry.second.fd);
+    this->streams.clear();
+    fcntl(this->sock, F_SETFL, savedFlags);
+}
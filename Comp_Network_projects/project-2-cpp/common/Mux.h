@@ -0,0 +1,106 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+MuxSession
+----------
+
+    Many concurrent streams over one connection, so a large get no longer
+    blocks the small requests queued behind it (head-of-line blocking).
+    Negotiated with `mux\n` / `OK\n`; from then on the socket carries only
+    frames:
+
+        type (1 byte) | stream id (4 bytes, big endian) | length (4 bytes, big endian) | payload
+
+        MUX_DATA    payload bytes of the stream
+        MUX_FIN     the sender will send no more data on this stream
+        MUX_WINDOW  4-byte payload: the receiver grants that many more bytes
+        MUX_RESET   the stream is abandoned, drop it
+
+    A stream is a virtual connection: the exact byte stream an ordinary
+    connection would carry (header lines, paths, bodies) travels as its DATA
+    frames. Each side of a stream is a socketpair end handed to ordinary
+    blocking code, so the server runs its normal per-connection loop on every
+    stream and the client its normal builtins. The initiator (client) opens
+    streams with odd ids; the first frame for a new id opens it on the other
+    side, which calls `onStream` with its end.
+
+    Flow control: every stream may have at most MUX_WINDOW unacknowledged
+    bytes in flight in each direction. The receiver grants credit back
+    (MUX_WINDOW frames) as the bytes are actually consumed by the stream's
+    reader, so a slow reader only stalls its own stream.
+
+    Scheduling: the pump takes at most one MUX_CHUNK from every ready stream
+    per round and stops reading from streams while more than
+    MUX_OUTBUF_LIMIT bytes wait for the socket, so a small request's frames
+    go out right behind at most a chunk of every bulk transfer.
+
+    `run` is the pump; it returns when the connection closes (all stream ends
+    then see EOF) or after `stop`.
+*/
+
+#define MUX_DATA 0
+#define MUX_FIN 1
+#define MUX_WINDOW 2
+#define MUX_RESET 3
+#define MUX_HEADER_BYTES 9
+#define MUX_CHUNK (16 * 1024)
+#define MUX_WINDOW_BYTES (256 * 1024)
+#define MUX_OUTBUF_LIMIT (64 * 1024)
+
+class MuxSession {
+    public:
+        typedef std::function<void(int streamFd)> StreamAcceptor;
+
+        MuxSession(int sock, bool initiator, StreamAcceptor onStream = nullptr);
+        ~MuxSession();
+        // Initiator side: a new stream; the returned socket behaves like a
+        // plain connection to the peer. -1 on failure. Thread-safe.
+        int openStream();
+        void run();
+        void stop();
+
+    private:
+        struct Stream {
+            int fd;                 // pump end of the socketpair (non-blocking)
+            uint32_t sendWindow;    // bytes we may still send to the peer
+            uint32_t recvWindow;    // bytes the peer may still send us
+            uint32_t ungranted;     // consumed since the last MUX_WINDOW we sent
+            std::string pending;    // from the peer, not yet written to fd
+            bool localEof;          // fd reached EOF and MUX_FIN went out
+            bool peerFin;           // peer sent MUX_FIN
+            bool shutWr;            // peerFin delivered as shutdown(SHUT_WR)
+        };
+
+        int sock;
+        bool initiator;
+        StreamAcceptor onStream;
+        int wakeFd;
+        std::atomic<bool> stopping;
+        std::mutex mtx;
+        uint32_t nextId;
+        std::vector<std::pair<uint32_t, int>> opened;   // from openStream, for the pump
+        std::map<uint32_t, Stream> streams;
+        uint32_t lastPeerId;
+        std::string out;
+        size_t outOff;
+        std::string in;
+
+        void queueFrame(uint8_t type, uint32_t id, const char *data, uint32_t len);
+        Stream &addStream(uint32_t id, int fd);
+        void closeStream(uint32_t id, bool reset);
+        bool handleFrame(uint8_t type, uint32_t id, const char *data, uint32_t len);
+        void deliver(uint32_t id, Stream &st);
+        bool flushOut();
+};
+
+#endif // MUX_H
@@ -0,0 +1,48 @@
+#include "NetIO.h"
+#include <errno.h>
+
+bool sendAll(int sock, const void* buf, size_t len) {
+    const char* p = static_cast<const char*>(buf);
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = send(sock, p + total, len - total, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool recvExact(int sock, void* buf, size_t len) {
+    char* p = static_cast<char*>(buf);
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = recv(sock, p + total, len - total, 0);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool recvLine(int sock, std::string &out) {
+    out.clear();
+    char ch;
+    while (true) {
+        ssize_t n = recv(sock, &ch, 1, 0);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ch == '\n') break;
+        out.push_back(ch);
+        if (out.size() > 4096) return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef NET_IO_H
+#define NET_IO_H
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+NetIO
+-----
+
+    Framing helpers shared by the client, the server and the bench tools.
+    They were originally static helpers inside client.cpp; they live here so
+    every program that speaks the put/get protocol uses the same code path.
+
+    - sendAll   : send exactly len bytes (loops over short writes / EINTR)
+    - recvExact : receive exactly len bytes (false on EOF or error)
+    - recvLine  : receive a '\n' terminated line, bounded to 4096 bytes
+*/
+
+// Helper: send exactly len bytes
+// Returns false on error/EOF; loops until all bytes are sent
+bool sendAll(int sock, const void* buf, size_t len);
+
+// Helper: receive exactly len bytes
+// Returns false on error/EOF; loops until all bytes are read
+bool recvExact(int sock, void* buf, size_t len);
+
+// Helper: receive a line ending with \n (not including the \n)
+// Bounded to 4096 bytes to avoid unbounded growth
+bool recvLine(int sock, std::string &out);
+
+#endif // NET_IO_H
@@ -0,0 +1,109 @@
+#include "PathUtil.h"
+#include <atomic>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static std::atomic<int> activeLayout(LAYOUT_FLAT);
+
+void setStorageLayout(StorageLayout layout) {
+    activeLayout = layout;
+}
+
+StorageLayout storageLayout() {
+    return static_cast<StorageLayout>(activeLayout.load());
+}
+
+static bool namesFit(const std::string& localPath) {
+    size_t start = 0;
+    while (start <= localPath.size()) {
+        size_t slash = localPath.find('/', start);
+        if (slash == std::string::npos) slash = localPath.size();
+        if (slash - start > STORAGE_NAME_MAX) return false;
+        start = slash + 1;
+    }
+    return true;
+}
+
+static bool escapesRoot(const std::string& requested) {
+    return (!requested.empty() && requested[0] == '/') || requested.find("..") != std::string::npos;
+}
+
+bool sanitizePath(const std::string& requested, std::string& safeOut) {
+    if (escapesRoot(requested)) return false;
+    safeOut = storagePathFor(requested, storageLayout());
+    return namesFit(safeOut);
+}
+
+bool pathTooLong(const std::string& requested) {
+    // traversal outranks length: such a path is bad, not merely too long
+    if (escapesRoot(requested)) return false;
+    return !namesFit(storagePathFor(requested, storageLayout()));
+}
+
+uint32_t pathHash(const std::string& logical) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : logical) {
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+std::string escapeFanoutName(const std::string& logical) {
+    std::string out;
+    out.reserve(logical.size() + 8);
+    for (char c : logical) {
+        if (c == '%') out += "%25";
+        else if (c == '/') out += "%2F";
+        else out.push_back(c);
+    }
+    return out;
+}
+
+bool unescapeFanoutName(const std::string& name, std::string& logicalOut) {
+    logicalOut.clear();
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] != '%') {
+            logicalOut.push_back(name[i]);
+            continue;
+        }
+        if (name.compare(i, 3, "%25") == 0) logicalOut.push_back('%');
+        else if (name.compare(i, 3, "%2F") == 0) logicalOut.push_back('/');
+        else return false;
+        i += 2;
+    }
+    return true;
+}
+
+std::string storagePathFor(const std::string& logical, StorageLayout layout) {
+    if (layout == LAYOUT_FLAT) return std::string(STORAGE_ROOT "/") + logical;
+
+    static const char hex[] = "0123456789abcdef";
+    uint32_t h = pathHash(logical);
+    std::string out(STORAGE_ROOT "/");
+    out.reserve(out.size() + 6 + logical.size() + 8);
+    out.push_back(hex[(h >> 28) & 0xf]);
+    out.push_back(hex[(h >> 24) & 0xf]);
+    out.push_back('/');
+    out.push_back(hex[(h >> 20) & 0xf]);
+    out.push_back(hex[(h >> 16) & 0xf]);
+    out.push_back('/');
+    out += escapeFanoutName(logical);
+    return out;
+}
+
+bool ensureParentDirs(const std::string& path) {
+    for (size_t pos = path.find('/'); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        if (pos == 0) continue;
+        std::string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+std::string tempPathFor(const std::string& path) {
+    static std::atomic<unsigned long> nextTemp(0);
+    return path + "." + std::to_string(getpid()) + "." + std::to_string(nextTemp++) + ".part";
+}
@@ -0,0 +1,69 @@
+#ifndef PATH_UTIL_H
+#define PATH_UTIL_H
+
+#include <string>
+#include <cstdint>
+
+/*
+PathUtil
+--------
+
+    Path validation and on-disk layout for the file server. Moved out of the
+    Server class so the bench tools can exercise exactly the code that runs
+    on every put/get.
+
+    - sanitizePath   : reject absolute paths and ".." traversal, then map the
+                       logical path to its server-local path under
+                       `server_storage/` using the active storage layout.
+    - storagePathFor : the layout mapping on its own (logical -> local path).
+    - pathTooLong    : true only for a path without traversal that
+                       sanitizePath refuses because one name on disk (after
+                       layout mapping, plus the temp suffix) would exceed
+                       STORAGE_NAME_MAX.
+
+Storage layouts:
+    - LAYOUT_FLAT   : `server_storage/<logical path>` (the original layout).
+    - LAYOUT_FANOUT : `server_storage/ab/cd/<escaped logical path>` where
+                      `abcd` are the first two bytes (hex) of the FNV-1a hash
+                      of the logical path and the escaped name encodes '/'
+                      as %2F and '%' as %25. Every directory stays small
+                      (65536 buckets) no matter how many files are stored,
+                      and a lookup is one hash plus one open().
+                      The whole logical path becomes one directory entry,
+                      so deeply nested paths hit the name limit sooner
+                      than in the flat layout; they are rejected up front.
+    The layout is process-wide and chosen once at startup; it is invisible
+    to the protocol. server/migrate_storage.cpp converts existing trees.
+*/
+
+#define STORAGE_ROOT "server_storage"
+
+// longest single name allowed on disk: NAME_MAX (255) less room for the
+// `.<pid>.<n>.part` suffix tempPathFor appends while a file is written
+#define STORAGE_NAME_MAX 215
+
+enum StorageLayout { LAYOUT_FLAT, LAYOUT_FANOUT };
+
+void setStorageLayout(StorageLayout layout);
+StorageLayout storageLayout();
+
+bool sanitizePath(const std::string& requested, std::string& safeOut);
+bool pathTooLong(const std::string& requested);
+
+std::string storagePathFor(const std::string& logical, StorageLayout layout);
+
+// FNV-1a over the logical path; also used to pick the fan-out buckets
+uint32_t pathHash(const std::string& logical);
+
+// fan-out file name <-> logical path
+std::string escapeFanoutName(const std::string& logical);
+bool unescapeFanoutName(const std::string& name, std::string& logicalOut);
+
+// mkdir -p for every directory component of `path` (not the last one)
+bool ensureParentDirs(const std::string& path);
+
+// `<path>.<pid>.<n>.part`: a temp file name no other writer (thread or
+// process) uses, with the .part suffix the storage scanners skip
+std::string tempPathFor(const std::string& path);
+
+#endif // PATH_UTIL_H
@@ -0,0 +1,106 @@
+#include "Sha256.h"
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256() : totalBytes(0), blockLen(0) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(this->state, init, sizeof(init));
+}
+
+void Sha256::compress(const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | (uint32_t)p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+    uint32_t e = this->state[4], f = this->state[5], g = this->state[6], h = this->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    this->state[0] += a; this->state[1] += b; this->state[2] += c; this->state[3] += d;
+    this->state[4] += e; this->state[5] += f; this->state[6] += g; this->state[7] += h;
+}
+
+void Sha256::update(const void *data, size_t len) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    this->totalBytes += len;
+    if (this->blockLen > 0) {
+        size_t take = std::min(len, sizeof(this->block) - this->blockLen);
+        memcpy(this->block + this->blockLen, p, take);
+        this->blockLen += take;
+        p += take;
+        len -= take;
+        if (this->blockLen < sizeof(this->block)) return;
+        this->compress(this->block);
+        this->blockLen = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) this->compress(p);
+    memcpy(this->block, p, len);
+    this->blockLen = len;
+}
+
+std::string Sha256::hexDigest() {
+    // Padding group: 0x80, zeros, then the message length in bits (big endian)
+    uint64_t bits = this->totalBytes * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padLen = (this->blockLen < 56 ? 56 : 120) - this->blockLen;
+    for (int i = 0; i < 8; i++) pad[padLen + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+    this->update(pad, padLen + 8);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(64);
+    for (uint32_t word : this->state) {
+        for (int shift = 28; shift >= 0; shift -= 4) out.push_back(hex[(word >> shift) & 0xf]);
+    }
+    return out;
+}
+
+bool sha256File(const std::string &path, std::string &hexOut) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    Sha256 sha;
+    PooledBuffer buffer;
+    off_t offset = 0;
+    while (true) {
+        ssize_t n = pread(fd, buffer.data(), buffer.size(), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) { close(fd); return false; }
+        if (n == 0) break;
+        sha.update(buffer.data(), static_cast<size_t>(n));
+        offset += n;
+    }
+    close(fd);
+    hexOut = sha.hexDigest();
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+Sha256
+------
+
+    SHA-256 (FIPS 180-4), used as the content checksum of stored files:
+    `stat` reports it, hash-first uploads and conditional gets compare it.
+    Feed data with `update` in any chunking, then `hexDigest` once.
+
+    - sha256File : digest of a whole file read with pread in I/O buffer
+                   sized chunks; false if it cannot be read.
+*/
+
+class Sha256 {
+    private:
+        uint32_t state[8];
+        uint64_t totalBytes;
+        unsigned char block[64];
+        size_t blockLen;
+
+        void compress(const unsigned char *p);
+
+    public:
+        Sha256();
+        void update(const void *data, size_t len);
+        // 64 lowercase hex digits; the object must not be updated afterwards
+        std::string hexDigest();
+};
+
+bool sha256File(const std::string &path, std::string &hexOut);
+
+#endif // SHA256_H
@@ -0,0 +1,249 @@
+#include "ShmRing.h"
+#include "UnixSock.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Each control block gets its own page ahead of the data areas
+#define SHM_CONTROL_SIZE 4096
+// Polls of the peer's counter before falling back to the eventfd
+#define SHM_SPIN_ITERS 2000
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+ShmRing::ShmRing() : ctrl(nullptr), data(nullptr), capacity(0), dataEfd(-1), spaceEfd(-1), peerSock(-1) {}
+
+void ShmRing::bind(ShmRingControl *c, char *d, uint64_t cap, int dEfd, int sEfd, int sock) {
+    ctrl = c;
+    data = d;
+    capacity = cap;
+    dataEfd = dEfd;
+    spaceEfd = sEfd;
+    peerSock = sock;
+}
+
+// Block until `efd` is signalled. Returns false if the ring was closed or
+// the control connection went away while we were waiting.
+bool ShmRing::sleepOn(int efd) {
+    struct pollfd fds[2];
+    fds[0].fd = efd;
+    fds[0].events = POLLIN;
+    fds[1].fd = peerSock;
+    fds[1].events = POLLRDHUP;
+    while (true) {
+        if (ctrl->closed.load(std::memory_order_acquire)) return false;
+        int n = poll(fds, peerSock >= 0 ? 2 : 1, 1000);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) continue;   // recheck closed
+        if (peerSock >= 0 && (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR))) return false;
+        if (fds[0].revents & POLLIN) {
+            uint64_t v;
+            ssize_t r = ::read(efd, &v, sizeof(v));
+            (void)r;
+            return true;
+        }
+    }
+}
+
+void ShmRing::wake(int efd) {
+    uint64_t one = 1;
+    ssize_t r = ::write(efd, &one, sizeof(one));
+    (void)r;
+}
+
+bool ShmRing::write(const void *buf, size_t len) {
+    const char *src = (const char *)buf;
+    const uint64_t cap = capacity;
+    while (len > 0) {
+        uint64_t head = ctrl->head.load(std::memory_order_relaxed);
+        uint64_t tail = ctrl->tail.load(std::memory_order_acquire);
+        if (head - tail > cap) {
+            // the peer scribbled on the counters
+            close();
+            return false;
+        }
+        uint64_t space = cap - (head - tail);
+        for (int i = 0; space == 0 && i < SHM_SPIN_ITERS; i++) {
+            cpuRelax();
+            tail = ctrl->tail.load(std::memory_order_acquire);
+            space = head - tail > cap ? 0 : cap - (head - tail);
+        }
+        if (space == 0) {
+            // Announce the wait, then re-check so a consumer that freed space
+            // in between is guaranteed to have seen the flag
+            ctrl->writerWaiting.store(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            tail = ctrl->tail.load(std::memory_order_acquire);
+            if (head - tail >= cap && !sleepOn(spaceEfd)) {
+                ctrl->writerWaiting.store(0, std::memory_order_relaxed);
+                return false;
+            }
+            ctrl->writerWaiting.store(0, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Copy up to the end of the buffer; a wrap takes another iteration
+        size_t off = head % cap;
+        size_t n = (size_t)std::min<uint64_t>(std::min<uint64_t>(space, len), cap - off);
+        memcpy(data + off, src, n);
+        ctrl->head.store(head + n, std::memory_order_release);
+        src += n;
+        len -= n;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ctrl->readerWaiting.load(std::memory_order_relaxed)) wake(dataEfd);
+    }
+    return true;
+}
+
+bool ShmRing::read(void *buf, size_t len) {
+    char *dst = (char *)buf;
+    const uint64_t cap = capacity;
+    while (len > 0) {
+        uint64_t tail = ctrl->tail.load(std::memory_order_relaxed);
+        uint64_t head = ctrl->head.load(std::memory_order_acquire);
+        uint64_t avail = head - tail;
+        for (int i = 0; avail == 0 && i < SHM_SPIN_ITERS; i++) {
+            cpuRelax();
+            head = ctrl->head.load(std::memory_order_acquire);
+            avail = head - tail;
+        }
+        if (avail > cap) {
+            close();
+            return false;
+        }
+        if (avail == 0) {
+            ctrl->readerWaiting.store(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            head = ctrl->head.load(std::memory_order_acquire);
+            if (head == tail && !sleepOn(dataEfd)) {
+                ctrl->readerWaiting.store(0, std::memory_order_relaxed);
+                return false;
+            }
+            ctrl->readerWaiting.store(0, std::memory_order_relaxed);
+            continue;
+        }
+
+        size_t off = tail % cap;
+        size_t n = (size_t)std::min<uint64_t>(std::min<uint64_t>(avail, len), cap - off);
+        memcpy(dst, data + off, n);
+        ctrl->tail.store(tail + n, std::memory_order_release);
+        dst += n;
+        len -= n;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ctrl->writerWaiting.load(std::memory_order_relaxed)) wake(spaceEfd);
+    }
+    return true;
+}
+
+// Mark the ring dead and kick both sides out of any wait
+void ShmRing::close() {
+    if (ctrl == nullptr) return;
+    ctrl->closed.store(1, std::memory_order_release);
+    wake(dataEfd);
+    wake(spaceEfd);
+}
+
+ShmTransport::ShmTransport() : base(MAP_FAILED), mapLen(0) {
+    for (int &fd : fds) fd = -1;
+}
+
+ShmTransport::~ShmTransport() {
+    if (base != MAP_FAILED) munmap(base, mapLen);
+    for (int fd : fds) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+// Map layout: [control c2s][control s2c][data c2s][data s2c]
+static bool mapRings(int memfd, size_t capacity, void *&base, size_t &mapLen,
+                     ShmRingControl *&c2s, ShmRingControl *&s2c) {
+    mapLen = 2 * SHM_CONTROL_SIZE + 2 * capacity;
+    base = mmap(nullptr, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED) return false;
+    c2s = (ShmRingControl *)base;
+    s2c = (ShmRingControl *)((char *)base + SHM_CONTROL_SIZE);
+    return true;
+}
+
+bool ShmTransport::create(size_t capacity, int peerSock) {
+    if (capacity == 0 || capacity > SHM_RING_MAX_CAPACITY) return false;
+    capacity = (capacity + SHM_CONTROL_SIZE - 1) / SHM_CONTROL_SIZE * SHM_CONTROL_SIZE;
+
+    fds[0] = memfd_create("shm-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds[0] < 0) return false;
+    if (ftruncate(fds[0], 2 * SHM_CONTROL_SIZE + 2 * capacity) < 0) return false;
+    // the client gets a writable fd: fix the size so it cannot shrink the
+    // mapping under us (a ring access past EOF would SIGBUS the server)
+    if (fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) return false;
+    for (int i = 1; i < 5; i++) {
+        fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fds[i] < 0) return false;
+    }
+
+    ShmRingControl *c2s, *s2c;
+    if (!mapRings(fds[0], capacity, base, mapLen, c2s, s2c)) return false;
+    // memfd pages start zeroed, so head/tail/flags are already 0
+    c2s->capacity = capacity;
+    s2c->capacity = capacity;
+    char *dataBase = (char *)base + 2 * SHM_CONTROL_SIZE;
+    toServer.bind(c2s, dataBase, capacity, fds[1], fds[2], peerSock);
+    toClient.bind(s2c, dataBase + capacity, capacity, fds[3], fds[4], peerSock);
+    return true;
+}
+
+bool ShmTransport::attach(const int received[5], int peerSock) {
+    for (int i = 0; i < 5; i++) fds[i] = received[i];
+    for (int i = 0; i < 5; i++) {
+        if (fds[i] < 0) return false;
+    }
+
+    // Read the capacity from the first control page before mapping everything
+    uint64_t capacity = 0;
+    if (pread(fds[0], &capacity, sizeof(capacity), offsetof(ShmRingControl, capacity)) != sizeof(capacity)) return false;
+    if (capacity == 0 || capacity > SHM_RING_MAX_CAPACITY) return false;
+
+    ShmRingControl *c2s, *s2c;
+    if (!mapRings(fds[0], capacity, base, mapLen, c2s, s2c)) return false;
+    char *dataBase = (char *)base + 2 * SHM_CONTROL_SIZE;
+    toServer.bind(c2s, dataBase, capacity, fds[1], fds[2], peerSock);
+    toClient.bind(s2c, dataBase + capacity, capacity, fds[3], fds[4], peerSock);
+    return true;
+}
+
+bool ShmTransport::sendFds(int unixSock) const {
+    static const char tags[5] = {'M', 'a', 'b', 'c', 'd'};
+    for (int i = 0; i < 5; i++) {
+        if (!sendFd(unixSock, tags[i], fds[i])) return false;
+    }
+    return true;
+}
+
+bool ShmTransport::recvFds(int unixSock, int out[5]) {
+    static const char tags[5] = {'M', 'a', 'b', 'c', 'd'};
+    for (int i = 0; i < 5; i++) out[i] = -1;
+    for (int i = 0; i < 5; i++) {
+        char tag;
+        if (!recvFd(unixSock, tag, out[i]) || tag != tags[i] || out[i] < 0) {
+            for (int j = 0; j <= i; j++) {
+                if (out[j] >= 0) ::close(out[j]);
+                out[j] = -1;
+            }
+            return false;
+        }
+    }
+    return true;
+}
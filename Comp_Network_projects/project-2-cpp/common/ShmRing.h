@@ -0,0 +1,102 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ShmRing
+-------
+
+    Shared-memory transport for bulk data between a client and the server
+    on the same host. It is negotiated over a Unix-domain connection:
+
+        client: shm <capacity>\n
+        server: OK\n  followed by five SCM_RIGHTS messages (common/UnixSock)
+                'M' memfd holding both rings
+                'a' eventfd: client->server data available
+                'b' eventfd: client->server space available
+                'c' eventfd: server->client data available
+                'd' eventfd: server->client space available
+        (or ERR ...\n if the server cannot set it up)
+
+    After that, protocol headers and status lines still travel over the
+    socket, but file bodies of put/get move through the rings: the sender
+    memcpy's into the ring and the receiver memcpy's out, with no TCP stack
+    or socket buffer copies in between.
+
+    Each ring is single-producer/single-consumer. Head and tail are
+    monotonically increasing byte counters in the shared control block.
+    A side that finds the ring empty (or full) spins briefly, then announces
+    it is sleeping (readerWaiting / writerWaiting) and blocks on an eventfd;
+    the peer only signals the eventfd when that flag is set, so a steady
+    stream costs no syscalls at all. Sleeping also polls the control socket so a peer that
+    exits never leaves the other side blocked forever.
+
+    The control block is writable by the peer, so nothing in it is trusted
+    for addressing: each side keeps the capacity it mapped in its own
+    ShmRing, and counters that claim more than a full ring close the ring
+    (read/write fail, and the server drops the connection).
+*/
+
+#define SHM_RING_CAPACITY (8 * 1024 * 1024)
+#define SHM_RING_MAX_CAPACITY (256 * 1024 * 1024)
+
+struct ShmRingControl {
+    alignas(64) std::atomic<uint64_t> head;     // bytes written by the producer
+    alignas(64) std::atomic<uint64_t> tail;     // bytes consumed by the consumer
+    alignas(64) std::atomic<uint32_t> readerWaiting;
+    std::atomic<uint32_t> writerWaiting;
+    std::atomic<uint32_t> closed;
+    uint64_t capacity;      // set by the server for attach(); never used for addressing
+};
+
+class ShmRing {
+    private:
+        ShmRingControl *ctrl;
+        char *data;
+        uint64_t capacity;  // our own copy, the shared one can be rewritten by the peer
+        int dataEfd;    // signalled by the producer when data arrives
+        int spaceEfd;   // signalled by the consumer when space frees up
+        int peerSock;   // control connection, watched while sleeping
+
+        bool sleepOn(int efd);
+        void wake(int efd);
+
+    public:
+        ShmRing();
+        void bind(ShmRingControl *ctrl, char *data, uint64_t capacity, int dataEfd, int spaceEfd, int peerSock);
+        bool write(const void *buf, size_t len);
+        bool read(void *buf, size_t len);
+        void close();
+};
+
+/*
+ShmTransport
+------------
+    One shared mapping with two rings (client->server and server->client)
+    plus their four eventfds. `create` is called by the server, `attach` by
+    the client with the descriptors it received. The memfd is sealed
+    against resizing before it is sent, so a client cannot truncate the
+    mapping the server is using.
+*/
+class ShmTransport {
+    private:
+        void *base;
+        size_t mapLen;
+        int fds[5];     // memfd, c2s data, c2s space, s2c data, s2c space
+
+    public:
+        ShmRing toServer;
+        ShmRing toClient;
+
+        ShmTransport();
+        ~ShmTransport();
+        bool create(size_t capacity, int peerSock);
+        bool attach(const int received[5], int peerSock);
+        bool sendFds(int unixSock) const;
+        static bool recvFds(int unixSock, int out[5]);
+};
+
+#endif // SHM_RING_H
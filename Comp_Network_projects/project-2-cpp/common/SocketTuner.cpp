@@ -0,0 +1,154 @@
+#include "SocketTuner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Process-wide counters behind statsText
+static std::atomic<unsigned long> tunedSockets(0);
+static std::atomic<unsigned long> samples(0);
+static std::atomic<unsigned long> sndbufRaises(0);
+static std::atomic<unsigned long> rcvbufRaises(0);
+static std::atomic<unsigned long> cappedRaises(0);
+static std::atomic<unsigned long> chunkChanges(0);
+static std::atomic<uint64_t> maxSndbuf(0);
+static std::atomic<uint64_t> maxRcvbuf(0);
+static std::atomic<uint64_t> maxChunk(0);
+static std::atomic<uint64_t> lastRttUs(0);
+static std::atomic<uint64_t> lastRateBps(0);
+
+static void raiseMax(std::atomic<uint64_t> &max, uint64_t value) {
+    uint64_t seen = max.load();
+    while (value > seen && !max.compare_exchange_weak(seen, value)) {}
+}
+
+// net.core.wmem_max / rmem_max: the most a plain SO_SNDBUF/SO_RCVBUF may ask for
+static uint64_t sysctlLimit(const char *path) {
+    std::ifstream in(path);
+    uint64_t value = 0;
+    if (!(in >> value)) value = 208 * 1024;
+    return value;
+}
+
+static uint64_t sysctlLimitFor(int option) {
+    static const uint64_t wmemMax = sysctlLimit("/proc/sys/net/core/wmem_max");
+    static const uint64_t rmemMax = sysctlLimit("/proc/sys/net/core/rmem_max");
+    return option == SO_SNDBUF ? wmemMax : rmemMax;
+}
+
+SocketTuner::SocketTuner(int sock)
+    : sock(sock), tcp(false), chunk(BUFFER_POOL_BUF_SIZE), windowStart(std::chrono::steady_clock::now()),
+      windowBytes(0), rttUs(0), rateBps(0) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (sock >= 0 && getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        this->tcp = true;
+        tunedSockets++;
+    }
+}
+
+void SocketTuner::begin() {
+    this->windowStart = std::chrono::steady_clock::now();
+    this->windowBytes = 0;
+}
+
+// The kernel reports (and charges) twice the value asked for, hence the halving
+bool SocketTuner::raiseBuffer(int option, int forceOption, uint64_t target) {
+    target = std::min<uint64_t>(target, TUNE_MAX_BUF);
+    int current = 0;
+    socklen_t len = sizeof(current);
+    if (getsockopt(this->sock, SOL_SOCKET, option, &current, &len) != 0) return false;
+    if (static_cast<uint64_t>(current) >= target) return false;
+
+    int ask = static_cast<int>(target / 2);
+    if (setsockopt(this->sock, SOL_SOCKET, forceOption, &ask, sizeof(ask)) != 0) {
+        // unprivileged: the sysctl caps the request, and locking a smaller buffer would hurt
+        uint64_t limit = sysctlLimitFor(option);
+        if (limit * 2 <= static_cast<uint64_t>(current)) {
+            cappedRaises++;
+            return false;
+        }
+        if (static_cast<uint64_t>(ask) > limit) {
+            cappedRaises++;
+            ask = static_cast<int>(limit);
+        }
+        if (setsockopt(this->sock, SOL_SOCKET, option, &ask, sizeof(ask)) != 0) return false;
+    }
+    len = sizeof(current);
+    if (getsockopt(this->sock, SOL_SOCKET, option, &current, &len) != 0) return false;
+    raiseMax(option == SO_SNDBUF ? maxSndbuf : maxRcvbuf, static_cast<uint64_t>(current));
+    return true;
+}
+
+bool SocketTuner::progress(size_t bytes, bool sending) {
+    if (!this->tcp) return false;
+    this->windowBytes += bytes;
+    auto now = std::chrono::steady_clock::now();
+    auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(now - this->windowStart).count();
+    if (elapsedUs < TUNE_SAMPLE_MS * 1000) return false;
+
+    // Measure group: RTT from the kernel, throughput over the window just ended
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(this->sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        this->tcp = false;
+        return false;
+    }
+    uint32_t rtt = !sending && info.tcpi_rcv_rtt > 0 ? info.tcpi_rcv_rtt : info.tcpi_rtt;
+    this->rttUs = rtt > 0 ? rtt : 1;
+    this->rateBps = static_cast<double>(this->windowBytes) * 1e6 / static_cast<double>(elapsedUs);
+    this->begin();
+    samples++;
+    lastRttUs = this->rttUs;
+    lastRateBps = static_cast<uint64_t>(this->rateBps);
+
+    // Decide group: buffers follow the BDP, the chunk follows the rate
+    uint64_t bdp = static_cast<uint64_t>(this->rateBps * this->rttUs / 1e6);
+    bool changed = sending ? this->raiseBuffer(SO_SNDBUF, SO_SNDBUFFORCE, 2 * bdp)
+                           : this->raiseBuffer(SO_RCVBUF, SO_RCVBUFFORCE, 2 * bdp);
+    if (changed) (sending ? sndbufRaises : rcvbufRaises)++;
+    uint64_t want = std::max<uint64_t>(static_cast<uint64_t>(this->rateBps * TUNE_CHUNK_US / 1e6), bdp / 4);
+    size_t next = TUNE_MIN_CHUNK;
+    while (next < want && next < TUNE_MAX_CHUNK) next *= 2;
+    if (next != this->chunk) {
+        this->chunk = next;
+        chunkChanges++;
+        raiseMax(maxChunk, next);
+        changed = true;
+    }
+    return changed;
+}
+
+std::string SocketTuner::describe() const {
+    int snd = 0, rcv = 0;
+    socklen_t len = sizeof(int);
+    getsockopt(this->sock, SOL_SOCKET, SO_SNDBUF, &snd, &len);
+    len = sizeof(int);
+    getsockopt(this->sock, SOL_SOCKET, SO_RCVBUF, &rcv, &len);
+    return "rtt " + std::to_string(this->rttUs) + " us, rate " + std::to_string(static_cast<uint64_t>(this->rateBps / 1024)) +
+           " KiB/s, sndbuf " + std::to_string(snd) + ", rcvbuf " + std::to_string(rcv) + ", chunk " + std::to_string(this->chunk);
+}
+
+std::string SocketTuner::statsText() {
+    std::string out;
+    out += "tune.tcp_sockets " + std::to_string(tunedSockets.load()) + "\n";
+    out += "tune.samples " + std::to_string(samples.load()) + "\n";
+    out += "tune.sndbuf_raises " + std::to_string(sndbufRaises.load()) + "\n";
+    out += "tune.rcvbuf_raises " + std::to_string(rcvbufRaises.load()) + "\n";
+    out += "tune.capped_raises " + std::to_string(cappedRaises.load()) + "\n";
+    out += "tune.chunk_changes " + std::to_string(chunkChanges.load()) + "\n";
+    out += "tune.max_sndbuf " + std::to_string(maxSndbuf.load()) + "\n";
+    out += "tune.max_rcvbuf " + std::to_string(maxRcvbuf.load()) + "\n";
+    out += "tune.max_chunk " + std::to_string(maxChunk.load()) + "\n";
+    out += "tune.last_rtt_us " + std::to_string(lastRttUs.load()) + "\n";
+    out += "tune.last_rate_bps " + std::to_string(lastRateBps.load()) + "\n";
+    return out;
+}
+
+char *ChunkBuffer::get(size_t n) {
+    if (n <= BUFFER_POOL_BUF_SIZE && this->large.empty()) return this->pooled.data();
+    if (this->large.size() < n) this->large.resize(n);
+    return this->large.data();
+}
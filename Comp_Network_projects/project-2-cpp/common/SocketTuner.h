@@ -0,0 +1,97 @@
+#ifndef SOCKET_TUNER_H
+#define SOCKET_TUNER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+
+// how often a busy connection re-reads TCP_INFO and re-tunes
+#define TUNE_SAMPLE_MS 200
+// a chunk is about what the link moves in this long, or a quarter of the BDP
+#define TUNE_CHUNK_US 2000
+#define TUNE_MIN_CHUNK (16 * 1024)
+#define TUNE_MAX_CHUNK (512 * 1024)
+// socket buffers are never raised beyond this
+#define TUNE_MAX_BUF (64 * 1024 * 1024)
+
+/*
+SocketTuner
+-----------
+
+    Per-connection sizing from the measured bandwidth-delay product. The
+    transfer loops report every chunk they move (`progress`); at most every
+    TUNE_SAMPLE_MS the tuner reads TCP_INFO for the RTT (rcv_rtt on the
+    receiving side, where the kernel's srtt only sees our small replies),
+    divides the bytes moved by the elapsed time for the throughput and
+    derives
+
+        bdp     = throughput * rtt
+        buffers = 2 * bdp                 (SO_SNDBUF when sending, SO_RCVBUF when receiving)
+        chunk   = max(throughput * TUNE_CHUNK_US, bdp / 4), power of two,
+                  TUNE_MIN_CHUNK .. TUNE_MAX_CHUNK
+
+    A window-limited link measures throughput = buffer / rtt, so the target
+    is twice the current buffer and keeps doubling until the link (or
+    TUNE_MAX_BUF) is the limit: high-latency paths ramp up on their own.
+
+    Buffers are only ever raised. Setting one turns off the kernel's own
+    auto-tuning for that socket, so the tuner leaves a buffer alone while
+    the kernel's value is already large enough, and it does not lock one
+    it cannot actually raise: SO_SNDBUFFORCE/SO_RCVBUFFORCE are tried first,
+    then the plain option, which net.core.[wr]mem_max caps. A capped
+    request is counted in the stats.
+
+    Only TCP sockets are tuned; on anything else (Unix sockets, mux
+    streams, shared-memory bodies) `chunkSize` stays BUFFER_POOL_BUF_SIZE.
+    Every decision is counted process-wide; `statsText` gives the `tune.*`
+    lines of the server's stats command.
+*/
+
+class SocketTuner {
+    private:
+        int sock;
+        bool tcp;
+        size_t chunk;
+        std::chrono::steady_clock::time_point windowStart;
+        uint64_t windowBytes;
+        uint32_t rttUs;
+        double rateBps;
+
+        bool raiseBuffer(int option, int forceOption, uint64_t target);
+
+    public:
+        explicit SocketTuner(int sock = -1);
+        int socket() const { return this->sock; }
+        // start of a transfer: idle time before it must not count as slow
+        void begin();
+        // `bytes` more moved in the given direction; true if a setting changed
+        bool progress(size_t bytes, bool sending);
+        size_t chunkSize() const { return this->chunk; }
+        // "rtt .. rate .. chunk .." for logs
+        std::string describe() const;
+        // process-wide "tune.* value" lines for the stats command
+        static std::string statsText();
+};
+
+/*
+ChunkBuffer
+-----------
+    Transfer buffer for tuned chunk sizes: a PooledBuffer up to
+    BUFFER_POOL_BUF_SIZE, a heap buffer (kept for the rest of the transfer)
+    for larger chunks. `get(n)` returns room for n bytes.
+*/
+class ChunkBuffer {
+    private:
+        PooledBuffer pooled;
+        std::vector<char> large;
+
+    public:
+        char *get(size_t n);
+};
+
+#endif // SOCKET_TUNER_H
@@ -0,0 +1,80 @@
+#include "SparseIO.h"
+#include "NetIO.h"
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <string>
+#include <unistd.h>
+
+static bool allZero(const char *buf, size_t len) {
+    static const char zeros[4096] = {0};
+    for (size_t off = 0; off < len; off += sizeof(zeros)) {
+        size_t n = std::min(len - off, sizeof(zeros));
+        if (memcmp(buf + off, zeros, n) != 0) return false;
+    }
+    return true;
+}
+
+// Send one data region [start, end) as extents, skipping zero-filled buffers
+static bool sendRegion(int fd, size_t start, size_t end, int headerSock, const BodySender &sendBody,
+                       PooledBuffer &buffer, size_t &sent) {
+    while (start < end) {
+        size_t want = std::min(end - start, buffer.size());
+        ssize_t got = pread(fd, buffer.data(), want, static_cast<off_t>(start));
+        if (got <= 0) return false;
+        size_t n = static_cast<size_t>(got);
+        if (n < buffer.size() || !allZero(buffer.data(), n)) {
+            std::string header = std::to_string(start) + " " + std::to_string(n) + "\n";
+            if (!sendAll(headerSock, header.data(), header.size()) || !sendBody(buffer.data(), n)) return false;
+            sent += n;
+        }
+        start += n;
+    }
+    return true;
+}
+
+bool sendSparseExtents(int fd, size_t size, int headerSock, const BodySender &sendBody, size_t *bytesSent) {
+    PooledBuffer buffer;
+    size_t sent = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        off_t data = lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;              // only a hole is left
+            data = static_cast<off_t>(pos);          // no SEEK_DATA support: all data
+        }
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0 || static_cast<size_t>(hole) > size) hole = static_cast<off_t>(size);
+        if (!sendRegion(fd, static_cast<size_t>(data), static_cast<size_t>(hole), headerSock, sendBody, buffer, sent)) return false;
+        pos = static_cast<size_t>(hole);
+    }
+    if (bytesSent) *bytesSent = sent;
+    std::string end = "0 0\n";
+    return sendAll(headerSock, end.data(), end.size());
+}
+
+bool recvSparseExtents(int headerSock, const BodyReceiver &recvBody, int fd, size_t size, bool &diskOk, size_t *bytesWritten) {
+    PooledBuffer buffer;
+    size_t written = 0;
+    diskOk = true;
+    while (true) {
+        std::string line;
+        unsigned long long offset = 0, len = 0;
+        if (!recvLine(headerSock, line) || sscanf(line.c_str(), "%llu %llu", &offset, &len) != 2) return false;
+        if (len == 0) break;
+        if (offset > size || len > size - offset) return false;
+        // keep reading after a write error so the connection stays in sync
+        for (unsigned long long got = 0; got < len;) {
+            size_t chunk = static_cast<size_t>(std::min<unsigned long long>(len - got, buffer.size()));
+            if (!recvBody(buffer.data(), chunk)) return false;
+            if (fd >= 0 && diskOk && pwrite(fd, buffer.data(), chunk, static_cast<off_t>(offset + got)) != static_cast<ssize_t>(chunk)) diskOk = false;
+            got += chunk;
+        }
+        written += static_cast<size_t>(len);
+    }
+    if (bytesWritten) *bytesWritten = written;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef SPARSE_IO_H
+#define SPARSE_IO_H
+
+#include <cstddef>
+#include <functional>
+
+/*
+SparseIO
+--------
+
+    Extent framing for sparse files (VM images, database snapshots), used by
+    the `sput` / `sget` commands. Instead of `size` raw bytes the body is a
+    list of data extents, each announced by a header line on the socket:
+
+        <offset> <len>\n [<len bytes>]
+        ...
+        0 0\n                       end of the file
+
+    The extent bytes go through the same body channel as put/get (the socket,
+    or the shared-memory ring on a local connection).
+
+    - sendSparseExtents : walks the file with SEEK_DATA / SEEK_HOLE and sends
+                          only data regions. Blocks of zeros inside a data
+                          region (a file that was copied without sparse
+                          awareness) are skipped too, in units of the I/O
+                          buffer. Filesystems without SEEK_DATA report the
+                          whole file as one data region.
+    - recvSparseExtents : writes every extent with pwrite into `fd`, which
+                          the caller has already ftruncate'd to the full size,
+                          so whatever is not written stays a hole. fd < 0
+                          reads and drops the extents (rejected upload).
+                          Extents outside [0, size) are an error. It
+                          returns false only if the stream itself broke; a
+                          failed pwrite clears `diskOk` but the remaining
+                          extents are still consumed.
+
+    `bytesSent` / `bytesWritten` (optional) return the data bytes moved, so
+    callers can report how much of the file was holes.
+*/
+
+typedef std::function<bool(const void *, size_t)> BodySender;
+typedef std::function<bool(void *, size_t)> BodyReceiver;
+
+bool sendSparseExtents(int fd, size_t size, int headerSock, const BodySender &sendBody, size_t *bytesSent = nullptr);
+bool recvSparseExtents(int headerSock, const BodyReceiver &recvBody, int fd, size_t size, bool &diskOk,
+                       size_t *bytesWritten = nullptr);
+
+#endif // SPARSE_IO_H
@@ -0,0 +1,820 @@
+#include "UdpTransfer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#define UDP_TYPE_DATA 1
+#define UDP_TYPE_ACK 2
+// ACK: header, delayUs, then (start, end) pairs
+#define UDP_ACK_FIXED 40
+
+// Process-wide counters behind udpStatsText
+static std::atomic<unsigned long> transfersSent(0);
+static std::atomic<unsigned long> transfersReceived(0);
+static std::atomic<unsigned long> transferTimeouts(0);
+static std::atomic<uint64_t> datagramsSent(0);
+static std::atomic<uint64_t> datagramsReceived(0);
+static std::atomic<uint64_t> retransmits(0);
+static std::atomic<uint64_t> badDatagrams(0);
+static std::atomic<uint64_t> impairedDrops(0);
+static std::atomic<uint64_t> lastRateMbps(0);
+static std::atomic<uint64_t> lastSrttUs(0);
+
+// Link impairment (`--udp-impair`), set once at startup
+static bool impaired = false;
+static double impairLoss = 0;
+static uint64_t impairDelayUs = 0;
+static double impairRateMbps = 0;
+
+static uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void put16(char *p, uint16_t v) { v = htobe16(v); memcpy(p, &v, sizeof(v)); }
+static void put32(char *p, uint32_t v) { v = htobe32(v); memcpy(p, &v, sizeof(v)); }
+static void put64(char *p, uint64_t v) { v = htobe64(v); memcpy(p, &v, sizeof(v)); }
+static uint16_t get16(const char *p) { uint16_t v; memcpy(&v, p, sizeof(v)); return be16toh(v); }
+static uint32_t get32(const char *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return be32toh(v); }
+static uint64_t get64(const char *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return be64toh(v); }
+
+// CRC-32C (Castagnoli): SSE4.2 where the CPU has it, slicing-by-8 tables otherwise
+struct CrcTables {
+    uint32_t t[8][256];
+
+    CrcTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+            this->t[0][i] = crc;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t i = 0; i < 256; i++) this->t[k][i] = (this->t[k - 1][i] >> 8) ^ this->t[0][this->t[k - 1][i] & 0xff];
+        }
+    }
+};
+
+static uint32_t crc32cSoft(uint32_t crc, const unsigned char *p, size_t n) {
+    static const CrcTables tables;
+    const uint32_t (*t)[256] = tables.t;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    while (n >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        p += 8;
+        n -= 8;
+    }
+#endif
+    while (n--) crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHard(uint32_t crc, const unsigned char *p, size_t n) {
+    uint64_t c = crc;
+    while (n >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        c = __builtin_ia32_crc32di(c, word);
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<uint32_t>(c);
+    while (n--) crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+static uint32_t crc32c(uint32_t crc, const void *data, size_t n) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__)
+    static const bool hard = __builtin_cpu_supports("sse4.2");
+    if (hard) return crc32cHard(crc, p, n);
+#endif
+    return crc32cSoft(crc, p, n);
+}
+
+// Everything after the checksum field: the rest of the header, then the payload
+static uint32_t datagramChecksum(const char *head, size_t headLen, const void *payload, size_t payloadLen) {
+    uint32_t crc = crc32c(0xFFFFFFFFu, head + 4, headLen - 4);
+    if (payloadLen > 0) crc = crc32c(crc, payload, payloadLen);
+    return ~crc;
+}
+
+static void setSocketBuffers(int fd) {
+    int size = UDP_SOCKET_BUF;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) != 0) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+// Wait for the UDP socket or the control connection, at most timeoutUs (-1: forever)
+static void waitReadable(struct pollfd *fds, int64_t timeoutUs) {
+    fds[0].revents = fds[1].revents = 0;
+    if (timeoutUs < 0) {
+        ppoll(fds, 2, nullptr, nullptr);
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeoutUs / 1000000);
+    ts.tv_nsec = static_cast<long>((timeoutUs % 1000000) * 1000);
+    ppoll(fds, 2, &ts, nullptr);
+}
+
+std::string UdpTransferStats::describe() const {
+    char line[256];
+    double mb = static_cast<double>(this->bytes) / (1024 * 1024);
+    snprintf(line, sizeof(line), "%.1f MB in %.2f s (%.1f MB/s), %llu datagrams, %llu retransmitted, %llu bad, rate %.0f Mbit/s",
+             mb, this->seconds, this->seconds > 0 ? mb / this->seconds : 0.0, static_cast<unsigned long long>(this->datagrams),
+             static_cast<unsigned long long>(this->retransmits), static_cast<unsigned long long>(this->badDatagrams),
+             this->rateMbps);
+    std::string out = line;
+    // only the sender measures RTT
+    if (this->srttUs > 0) out += ", srtt " + std::to_string(this->srttUs) + " us";
+    return out;
+}
+
+UdpChannel::UdpChannel(int fd, uint32_t session, bool peerKnown)
+    : fd(fd), session(session), peerKnown(peerKnown), bottleneckFreeUs(0) {}
+
+UdpChannel::~UdpChannel() {
+    if (this->fd >= 0) close(this->fd);
+}
+
+int UdpChannel::connectTo(const std::string &host, int port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res) return -1;
+    int fd = ::socket(res->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) setSocketBuffers(fd);
+    return fd;
+}
+
+int UdpChannel::bindAny(int &port) {
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    setSocketBuffers(fd);
+    return fd;
+}
+
+bool UdpChannel::impair(const std::string &spec) {
+    double loss = 0, rate = 0;
+    unsigned long delay = 0;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        std::string part = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t eq = part.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = part.substr(0, eq);
+        const char *value = part.c_str() + eq + 1;
+        char *end = nullptr;
+        if (key == "loss") loss = strtod(value, &end);
+        else if (key == "delay") delay = strtoul(value, &end, 10);
+        else if (key == "rate") rate = strtod(value, &end);
+        else return false;
+        if (end == value || *end != '\0') return false;
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    if (loss < 0 || loss >= 1 || rate < 0) return false;
+    impairLoss = loss;
+    impairDelayUs = static_cast<uint64_t>(delay) * 1000;
+    impairRateMbps = rate;
+    impaired = loss > 0 || delay > 0 || rate > 0;
+    return true;
+}
+
+// sendmmsg until every datagram is out; a hard error (e.g. ECONNREFUSED
+// from an ICMP port unreachable) drops the rest like a lost packet
+void UdpChannel::transmit(struct mmsghdr *msgs, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        int n = sendmmsg(this->fd, msgs + done, static_cast<unsigned>(count - done), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        done += static_cast<size_t>(n);
+    }
+    datagramsSent += count;
+}
+
+void UdpChannel::send(struct iovec *iovs, size_t count) {
+    if (!this->peerKnown) return;
+    for (size_t i = 0; i < count; i++) {
+        char *head = static_cast<char *>(iovs[2 * i].iov_base);
+        put32(head + 8, this->session);
+        put32(head, datagramChecksum(head, iovs[2 * i].iov_len, iovs[2 * i + 1].iov_base, iovs[2 * i + 1].iov_len));
+    }
+    if (!impaired) {
+        struct mmsghdr msgs[UDP_BATCH];
+        while (count > 0) {
+            size_t n = std::min<size_t>(count, UDP_BATCH);
+            memset(msgs, 0, sizeof(msgs[0]) * n);
+            for (size_t i = 0; i < n; i++) {
+                msgs[i].msg_hdr.msg_iov = iovs + 2 * i;
+                msgs[i].msg_hdr.msg_iovlen = 2;
+            }
+            this->transmit(msgs, n);
+            iovs += 2 * n;
+            count -= n;
+        }
+        return;
+    }
+
+    // Impairment group: drop, queue behind the emulated bottleneck, delay
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    uint64_t now = nowUs();
+    for (size_t i = 0; i < count; i++) {
+        size_t bytes = iovs[2 * i].iov_len + iovs[2 * i + 1].iov_len;
+        if (impairLoss > 0 && coin(rng) < impairLoss) {
+            impairedDrops++;
+            continue;
+        }
+        uint64_t departUs = now;
+        if (impairRateMbps > 0) {
+            uint64_t start = std::max(now, this->bottleneckFreeUs);
+            if (start - now > UDP_IMPAIR_QUEUE_US) {
+                impairedDrops++;
+                continue;
+            }
+            this->bottleneckFreeUs = start + static_cast<uint64_t>(bytes * 8 / impairRateMbps);
+            departUs = this->bottleneckFreeUs;
+        }
+        Delayed d;
+        d.dueUs = departUs + impairDelayUs;
+        d.bytes.assign(static_cast<const char *>(iovs[2 * i].iov_base), iovs[2 * i].iov_len);
+        d.bytes.append(static_cast<const char *>(iovs[2 * i + 1].iov_base), iovs[2 * i + 1].iov_len);
+        this->delayed.push_back(std::move(d));
+    }
+    this->flushDelayed();
+}
+
+int UdpChannel::flushDelayed() {
+    uint64_t now = nowUs();
+    while (!this->delayed.empty() && this->delayed.front().dueUs <= now) {
+        struct mmsghdr msgs[UDP_BATCH];
+        struct iovec iov[UDP_BATCH];
+        size_t n = 0;
+        for (auto it = this->delayed.begin(); it != this->delayed.end() && n < UDP_BATCH && it->dueUs <= now; ++it, n++) {
+            iov[n].iov_base = &it->bytes[0];
+            iov[n].iov_len = it->bytes.size();
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+        }
+        this->transmit(msgs, n);
+        this->delayed.erase(this->delayed.begin(), this->delayed.begin() + static_cast<long>(n));
+    }
+    if (this->delayed.empty()) return -1;
+    return static_cast<int>((this->delayed.front().dueUs - now + 999) / 1000);
+}
+
+size_t UdpChannel::receive(char *bufs, size_t *lens, uint64_t &bad) {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct sockaddr_storage from[UDP_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < UDP_BATCH; i++) {
+        iov[i].iov_base = bufs + i * (UDP_HEADER + UDP_PAYLOAD);
+        iov[i].iov_len = UDP_HEADER + UDP_PAYLOAD;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+    int n = recvmmsg(this->fd, msgs, UDP_BATCH, MSG_DONTWAIT, nullptr);
+    if (n <= 0) return 0;
+    datagramsReceived += static_cast<uint64_t>(n);
+
+    // Check group: keep datagrams of this session with a good checksum, packed to the front
+    size_t kept = 0;
+    for (int i = 0; i < n; i++) {
+        char *buf = bufs + static_cast<size_t>(i) * (UDP_HEADER + UDP_PAYLOAD);
+        size_t len = msgs[i].msg_len;
+        if (len < UDP_HEADER || get32(buf + 8) != this->session ||
+            get32(buf) != datagramChecksum(buf, len, nullptr, 0)) {
+            bad++;
+            badDatagrams++;
+            continue;
+        }
+        // the first good datagram tells the server where the client is
+        if (!this->peerKnown) {
+            if (connect(this->fd, reinterpret_cast<struct sockaddr *>(&from[i]), msgs[i].msg_hdr.msg_namelen) != 0) continue;
+            this->peerKnown = true;
+        }
+        if (static_cast<size_t>(i) != kept) memmove(bufs + kept * (UDP_HEADER + UDP_PAYLOAD), buf, len);
+        lens[kept++] = len;
+    }
+    return kept;
+}
+
+/*
+    Sender state machine behind udpSendFile. Each block is unsent, in flight
+    (sent, not acked, not yet declared lost), lost (queued for
+    retransmission) or acked.
+*/
+class UdpSender {
+    private:
+        enum : uint8_t { UNSENT, IN_FLIGHT, LOST, ACKED };
+
+        UdpChannel &channel;
+        int fileFd;
+        size_t size;
+        uint64_t blocks;
+        std::vector<uint8_t> state;
+        std::vector<uint64_t> sentUs;
+        std::deque<uint64_t> lost;
+        uint64_t nextNew, cum, acked, inflight, lostCount;
+        uint64_t latestAckedSentUs;         // RACK: send time of the newest transmission that arrived
+        double srttUs, rttvarUs;
+        uint64_t minRttUs, minRttStampUs;
+        uint64_t lastAckUs, lastRtoScanUs;
+
+        // Rate group: delivery rounds, the bandwidth max-filter and the gain cycle
+        uint64_t roundStartUs, roundAcked, roundSent, roundLost, roundCount;
+        double bwRounds[UDP_BW_ROUNDS];
+        double btlBw, fullBw;
+        int fullBwRounds;
+        bool startup;
+        int cycle;
+        double pacingRate, tokens;
+        uint64_t lastTokenUs;
+
+        std::vector<char> headers;
+        std::vector<char> payloads;
+
+        void markAcked(uint64_t block);
+        void markLost(uint64_t block);
+        void onAck(const char *buf, size_t len, uint64_t now);
+        void detectTimeouts(uint64_t now);
+        void updateRate(uint64_t now);
+        double cwnd() const;
+        uint64_t rtoUs() const;
+        bool sendBatch(uint64_t now, size_t budget);
+
+    public:
+        UdpTransferStats stats;
+
+        UdpSender(UdpChannel &channel, int fileFd, size_t size);
+        bool run(int controlSock);
+};
+
+UdpSender::UdpSender(UdpChannel &channel, int fileFd, size_t size)
+    : channel(channel), fileFd(fileFd), size(size), blocks((size + UDP_PAYLOAD - 1) / UDP_PAYLOAD),
+      state(blocks, UNSENT), sentUs(blocks, 0), nextNew(0), cum(0), acked(0), inflight(0), lostCount(0), latestAckedSentUs(0),
+      srttUs(0), rttvarUs(0), minRttUs(0), minRttStampUs(0), lastAckUs(0), lastRtoScanUs(0),
+      roundStartUs(0), roundAcked(0), roundSent(0), roundLost(0), roundCount(0), btlBw(UDP_INITIAL_RATE), fullBw(0), fullBwRounds(0),
+      startup(true), cycle(0), pacingRate(UDP_INITIAL_RATE), tokens(0), lastTokenUs(0),
+      headers(UDP_BATCH * UDP_HEADER), payloads(UDP_BATCH * UDP_PAYLOAD) {
+    for (double &bw : this->bwRounds) bw = 0;
+}
+
+void UdpSender::markAcked(uint64_t block) {
+    uint8_t &s = this->state[block];
+    if (s == ACKED || s == UNSENT) return;
+    if (s == IN_FLIGHT) this->inflight--;
+    s = ACKED;
+    this->acked++;
+}
+
+void UdpSender::markLost(uint64_t block) {
+    this->state[block] = LOST;
+    this->inflight--;
+    this->lostCount++;
+    this->lost.push_back(block);
+}
+
+void UdpSender::onAck(const char *buf, size_t len, uint64_t now) {
+    if (buf[4] != UDP_TYPE_ACK || len < UDP_ACK_FIXED) return;
+    size_t ranges = get16(buf + 6);
+    if (len < UDP_ACK_FIXED + ranges * 16) return;
+    uint64_t cumAck = std::min(get64(buf + 16), this->blocks);
+    uint64_t echoUs = get64(buf + 24);
+    uint64_t delayUs = get64(buf + 32);
+    this->lastAckUs = now;
+
+    // RTT group: RFC 6298 smoothing, plus the windowed minimum for the flight cap.
+    // The echo names the exact transmission that arrived, so unlike sentUs of
+    // an acked block it is not fooled by an original overtaking a retransmission.
+    this->latestAckedSentUs = std::max(this->latestAckedSentUs, echoUs);
+    if (echoUs > 0 && now > echoUs + delayUs) {
+        double sample = static_cast<double>(now - echoUs - delayUs);
+        if (this->srttUs == 0) {
+            this->srttUs = sample;
+            this->rttvarUs = sample / 2;
+        } else {
+            this->rttvarUs = 0.75 * this->rttvarUs + 0.25 * std::fabs(this->srttUs - sample);
+            this->srttUs = 0.875 * this->srttUs + 0.125 * sample;
+        }
+        if (this->minRttUs == 0 || sample < this->minRttUs || now - this->minRttStampUs > 10000000) {
+            this->minRttUs = static_cast<uint64_t>(sample);
+            this->minRttStampUs = now;
+        }
+        if (this->roundStartUs == 0) {
+            this->roundStartUs = now;
+            this->roundAcked = this->acked;
+            this->roundSent = this->stats.datagrams;
+            this->roundLost = this->lostCount;
+        }
+    }
+
+    // Ack group: everything below cumAck, then the SACK ranges
+    for (uint64_t b = this->cum; b < cumAck; b++) this->markAcked(b);
+    this->cum = std::max(this->cum, cumAck);
+    for (size_t i = 0; i < ranges; i++) {
+        uint64_t start = std::max(get64(buf + UDP_ACK_FIXED + 16 * i), this->cum);
+        uint64_t end = std::min(get64(buf + UDP_ACK_FIXED + 16 * i + 8), this->nextNew);
+        for (uint64_t b = start; b < end; b++) this->markAcked(b);
+    }
+    while (this->cum < this->blocks && this->state[this->cum] == ACKED) this->cum++;
+
+    // Loss group (RACK): sent well before something that has arrived since
+    uint64_t reorderUs = std::max<uint64_t>(static_cast<uint64_t>(this->srttUs / 8), 1000);
+    for (uint64_t b = this->cum; b < this->nextNew; b++) {
+        if (this->state[b] == IN_FLIGHT && this->sentUs[b] + reorderUs < this->latestAckedSentUs) this->markLost(b);
+    }
+}
+
+uint64_t UdpSender::rtoUs() const {
+    if (this->srttUs == 0) return 200000;
+    return std::max<uint64_t>(static_cast<uint64_t>(1.25 * this->srttUs + 4 * this->rttvarUs) + UDP_ACK_DELAY_US, UDP_MIN_RTO_US);
+}
+
+// The tail has nothing sent after it to reveal a loss: time it out
+void UdpSender::detectTimeouts(uint64_t now) {
+    uint64_t rto = this->rtoUs();
+    if (now - this->lastRtoScanUs < rto / 4) return;
+    this->lastRtoScanUs = now;
+    for (uint64_t b = this->cum; b < this->nextNew; b++) {
+        if (this->state[b] == IN_FLIGHT && now - this->sentUs[b] > rto) this->markLost(b);
+    }
+}
+
+void UdpSender::updateRate(uint64_t now) {
+    if (this->roundStartUs == 0) return;
+    uint64_t roundUs = std::max<uint64_t>(static_cast<uint64_t>(this->srttUs), UDP_MIN_ROUND_US);
+    if (now - this->roundStartUs < roundUs) return;
+
+    // Round group: delivery rate of the round into the max-filter. Acks held
+    // back by a full SACK list arrive in a burst, so a round never counts more
+    // than it sent.
+    uint64_t sent = this->stats.datagrams - this->roundSent;
+    uint64_t lostNow = this->lostCount - this->roundLost;
+    uint64_t delivered = std::min(this->acked - this->roundAcked, sent);
+    this->bwRounds[this->roundCount++ % UDP_BW_ROUNDS] = static_cast<double>(delivered) * 1e6 / static_cast<double>(now - this->roundStartUs);
+    this->roundStartUs = now;
+    this->roundAcked = this->acked;
+    this->roundSent = this->stats.datagrams;
+    this->roundLost = this->lostCount;
+    this->btlBw = UDP_MIN_RATE;
+    for (double bw : this->bwRounds) this->btlBw = std::max(this->btlBw, bw);
+
+    // Gain group: startup until the estimate stops growing or a round loses
+    // more than random loss would explain (the queue overflowed), then
+    // probe/drain/cruise
+    static const double gains[8] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+    if (this->startup) {
+        if (sent > 0 && lostNow * 100 > sent * UDP_STARTUP_LOSS_PCT) {
+            this->startup = false;
+            this->cycle = 1;
+        } else if (this->btlBw >= this->fullBw * 1.25) {
+            this->fullBw = this->btlBw;
+            this->fullBwRounds = 0;
+        } else if (++this->fullBwRounds >= 3) {
+            this->startup = false;
+            this->cycle = 1;        // drain what startup queued first
+        }
+    } else {
+        this->cycle = (this->cycle + 1) % 8;
+    }
+    double rate = this->btlBw * (this->startup ? 2.89 : gains[this->cycle]);
+    if (this->startup) rate = std::max(rate, this->pacingRate);
+    this->pacingRate = std::min(std::max(rate, static_cast<double>(UDP_MIN_RATE)), static_cast<double>(UDP_MAX_RATE));
+}
+
+double UdpSender::cwnd() const {
+    if (this->minRttUs == 0) return std::max(this->pacingRate * 0.2, 4.0 * UDP_BATCH);
+    double gain = this->startup ? 2.89 : 2.0;
+    return std::max(gain * this->btlBw * static_cast<double>(this->minRttUs) / 1e6, 4.0 * UDP_BATCH);
+}
+
+// Up to `budget` datagrams: retransmissions first, then a run of new blocks read with one pread
+bool UdpSender::sendBatch(uint64_t now, size_t budget) {
+    struct iovec iovs[2 * UDP_BATCH];
+    uint64_t ids[UDP_BATCH];
+    size_t n = 0;
+    budget = std::min<size_t>(budget, UDP_BATCH);
+    while (n < budget && !this->lost.empty()) {
+        uint64_t b = this->lost.front();
+        this->lost.pop_front();
+        if (this->state[b] != LOST) continue;
+        size_t len = static_cast<size_t>(std::min<uint64_t>(UDP_PAYLOAD, this->size - b * UDP_PAYLOAD));
+        if (pread(this->fileFd, &this->payloads[n * UDP_PAYLOAD], len, static_cast<off_t>(b * UDP_PAYLOAD)) != static_cast<ssize_t>(len)) return false;
+        this->stats.retransmits++;
+        retransmits++;
+        ids[n++] = b;
+    }
+    if (n < budget && this->nextNew < this->blocks) {
+        uint64_t first = this->nextNew;
+        size_t count = static_cast<size_t>(std::min<uint64_t>(budget - n, this->blocks - first));
+        size_t bytes = static_cast<size_t>(std::min<uint64_t>(count * UDP_PAYLOAD, this->size - first * UDP_PAYLOAD));
+        size_t got = 0;
+        while (got < bytes) {
+            ssize_t r = pread(this->fileFd, &this->payloads[n * UDP_PAYLOAD] + got, bytes - got, static_cast<off_t>(first * UDP_PAYLOAD + got));
+            if (r <= 0) return false;
+            got += static_cast<size_t>(r);
+        }
+        for (size_t i = 0; i < count; i++) ids[n++] = first + i;
+        this->nextNew += count;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t b = ids[i];
+        size_t len = static_cast<size_t>(std::min<uint64_t>(UDP_PAYLOAD, this->size - b * UDP_PAYLOAD));
+        char *head = &this->headers[i * UDP_HEADER];
+        memset(head, 0, UDP_HEADER);
+        head[4] = UDP_TYPE_DATA;
+        put16(head + 6, static_cast<uint16_t>(len));
+        put64(head + 16, b);
+        put64(head + 24, now);
+        iovs[2 * i].iov_base = head;
+        iovs[2 * i].iov_len = UDP_HEADER;
+        iovs[2 * i + 1].iov_base = &this->payloads[i * UDP_PAYLOAD];
+        iovs[2 * i + 1].iov_len = len;
+        this->state[b] = IN_FLIGHT;
+        this->sentUs[b] = now;
+        this->inflight++;
+    }
+    this->channel.send(iovs, n);
+    this->stats.datagrams += n;
+    this->tokens -= static_cast<double>(n);
+    return true;
+}
+
+bool UdpSender::run(int controlSock) {
+    uint64_t start = nowUs();
+    this->lastAckUs = this->lastTokenUs = start;
+    std::vector<char> bufs(UDP_BATCH * (UDP_HEADER + UDP_PAYLOAD));
+    size_t lens[UDP_BATCH];
+    struct pollfd fds[2];
+    fds[0].fd = this->channel.socket();
+    fds[0].events = POLLIN;
+    fds[1].fd = controlSock;
+    fds[1].events = POLLIN;
+    bool ok = true;
+
+    while (true) {
+        // Receive group: drain the ACKs that are waiting
+        uint64_t now = nowUs();
+        size_t got;
+        do {
+            got = this->channel.receive(bufs.data(), lens, this->stats.badDatagrams);
+            for (size_t i = 0; i < got; i++) this->onAck(&bufs[i * (UDP_HEADER + UDP_PAYLOAD)], lens[i], now);
+        } while (got == UDP_BATCH);
+        if (now - this->lastAckUs > static_cast<uint64_t>(UDP_IDLE_TIMEOUT_MS) * 1000) {
+            ok = false;
+            break;
+        }
+        this->detectTimeouts(now);
+        this->updateRate(now);
+
+        // Send group: as many datagrams as the pacing tokens and the flight cap allow
+        this->tokens = std::min(this->tokens + this->pacingRate * static_cast<double>(now - this->lastTokenUs) / 1e6,
+                                std::max(static_cast<double>(UDP_BATCH), this->pacingRate / 1000));
+        this->lastTokenUs = now;
+        bool work = this->channel.hasPeer() && (!this->lost.empty() || this->nextNew < this->blocks);
+        bool readFailed = false;
+        while (work && this->tokens >= 1 && static_cast<double>(this->inflight) < this->cwnd()) {
+            size_t room = static_cast<size_t>(std::min(this->tokens, this->cwnd() - static_cast<double>(this->inflight)));
+            if (room == 0) break;
+            if (!this->sendBatch(now, room)) {
+                readFailed = true;
+                break;
+            }
+            work = !this->lost.empty() || this->nextNew < this->blocks;
+        }
+        if (readFailed) {
+            ok = false;
+            break;
+        }
+
+        // Wait group: until a token is due, an ACK or the verdict arrives, or the tail times out
+        int64_t waitUs = static_cast<int64_t>(this->rtoUs() / 4);
+        if (work && static_cast<double>(this->inflight) < this->cwnd()) {
+            waitUs = std::min<int64_t>(waitUs, static_cast<int64_t>((1 - this->tokens) * 1e6 / this->pacingRate) + 1);
+        }
+        int delayedMs = this->channel.flushDelayed();
+        if (delayedMs >= 0) waitUs = std::min<int64_t>(waitUs, static_cast<int64_t>(delayedMs) * 1000);
+        waitReadable(fds, std::max<int64_t>(waitUs, 0));
+        if (fds[1].revents) break;
+    }
+
+    this->stats.bytes = this->size;
+    this->stats.seconds = static_cast<double>(nowUs() - start) / 1e6;
+    this->stats.rateMbps = this->pacingRate * (UDP_HEADER + UDP_PAYLOAD) * 8 / 1e6;
+    this->stats.srttUs = static_cast<uint32_t>(this->srttUs);
+    lastRateMbps = static_cast<uint64_t>(this->stats.rateMbps);
+    lastSrttUs = this->stats.srttUs;
+    return ok;
+}
+
+bool udpSendFile(UdpChannel &channel, int fileFd, size_t size, int controlSock, UdpTransferStats &stats) {
+    transfersSent++;
+    UdpSender sender(channel, fileFd, size);
+    bool ok = sender.run(controlSock);
+    if (!ok) transferTimeouts++;
+    stats = sender.stats;
+    return ok;
+}
+
+// ACK: cumulative point, the received ranges above it, and the RTT echo
+static void sendAck(UdpChannel &channel, const std::vector<uint8_t> &have, uint64_t cum, uint64_t highest,
+                    uint64_t echoUs, uint64_t delayUs) {
+    char ack[UDP_ACK_FIXED + 16 * UDP_SACK_RANGES];
+    memset(ack, 0, UDP_ACK_FIXED);
+    ack[4] = UDP_TYPE_ACK;
+    put64(ack + 16, cum);
+    put64(ack + 24, echoUs);
+    put64(ack + 32, delayUs);
+    size_t ranges = 0;
+    uint64_t b = cum;
+    while (b < highest && ranges < UDP_SACK_RANGES) {
+        while (b < highest && !have[b]) b++;
+        if (b >= highest) break;
+        uint64_t start = b;
+        while (b < highest && have[b]) b++;
+        put64(ack + UDP_ACK_FIXED + 16 * ranges, start);
+        put64(ack + UDP_ACK_FIXED + 16 * ranges + 8, b);
+        ranges++;
+    }
+    put16(ack + 6, static_cast<uint16_t>(ranges));
+    struct iovec iov[2];
+    iov[0].iov_base = ack;
+    iov[0].iov_len = UDP_ACK_FIXED + 16 * ranges;
+    iov[1].iov_base = nullptr;
+    iov[1].iov_len = 0;
+    channel.send(iov, 1);
+}
+
+bool udpReceiveFile(UdpChannel &channel, int fileFd, size_t size, int controlSock, UdpTransferStats &stats,
+                    std::string &error) {
+    transfersReceived++;
+    uint64_t blocks = (size + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+    std::vector<uint8_t> have(blocks, 0);
+    std::vector<char> bufs(UDP_BATCH * (UDP_HEADER + UDP_PAYLOAD));
+    size_t lens[UDP_BATCH];
+    uint64_t cum = 0, highest = 0, received = 0, pending = 0;
+    uint64_t start = nowUs(), lastDataUs = start, firstPendingUs = 0, lastAckSentUs = 0;
+    uint64_t echoUs = 0, echoArrivalUs = 0;
+    struct pollfd fds[2];
+    fds[0].fd = channel.socket();
+    fds[0].events = POLLIN;
+    fds[1].fd = controlSock;
+    fds[1].events = POLLIN;
+    stats = UdpTransferStats();
+
+    while (received < blocks) {
+        uint64_t now = nowUs();
+        size_t got = channel.receive(bufs.data(), lens, stats.badDatagrams);
+
+        // Write group: runs of consecutive new blocks go out in one pwritev
+        struct iovec run[UDP_BATCH];
+        size_t runLen = 0;
+        uint64_t runStart = 0;
+        std::vector<uint64_t> written;
+        auto flush = [&]() {
+            if (runLen == 0) return true;
+            size_t bytes = 0;
+            for (size_t i = 0; i < runLen; i++) bytes += run[i].iov_len;
+            ssize_t w = pwritev(fileFd, run, static_cast<int>(runLen), static_cast<off_t>(runStart * UDP_PAYLOAD));
+            runLen = 0;
+            return w == static_cast<ssize_t>(bytes);
+        };
+        for (size_t i = 0; i < got; i++) {
+            char *buf = &bufs[i * (UDP_HEADER + UDP_PAYLOAD)];
+            if (buf[4] != UDP_TYPE_DATA) continue;
+            uint64_t block = get64(buf + 16);
+            size_t len = get16(buf + 6);
+            if (block >= blocks || len != std::min<uint64_t>(UDP_PAYLOAD, size - block * UDP_PAYLOAD) || lens[i] != UDP_HEADER + len) {
+                stats.badDatagrams++;
+                continue;
+            }
+            stats.datagrams++;
+            lastDataUs = now;
+            echoUs = get64(buf + 24);
+            echoArrivalUs = now;
+            if (pending++ == 0) firstPendingUs = now;
+            if (have[block]) continue;
+            if (runLen > 0 && block != runStart + runLen && !flush()) {
+                error = "write_failed";
+                return false;
+            }
+            if (runLen == 0) runStart = block;
+            run[runLen].iov_base = buf + UDP_HEADER;
+            run[runLen].iov_len = len;
+            runLen++;
+            written.push_back(block);
+        }
+        if (!flush()) {
+            error = "write_failed";
+            return false;
+        }
+        for (uint64_t block : written) {
+            if (!have[block]) {
+                have[block] = 1;
+                received++;
+            }
+            highest = std::max(highest, block + 1);
+        }
+        while (cum < blocks && have[cum]) cum++;
+
+        // Ack group: every UDP_ACK_EVERY datagrams, after UDP_ACK_DELAY_US, at
+        // the end, and as a keepalive (the get sender learns our address from it)
+        bool due = pending > 0 && (pending >= UDP_ACK_EVERY || now - firstPendingUs >= UDP_ACK_DELAY_US || received == blocks);
+        if (due || (channel.hasPeer() && now - lastAckSentUs >= static_cast<uint64_t>(UDP_KEEPALIVE_MS) * 1000)) {
+            sendAck(channel, have, cum, highest, echoUs, echoUs ? now - echoArrivalUs : 0);
+            pending = 0;
+            lastAckSentUs = now;
+        }
+        if (received == blocks) break;
+        if (got == UDP_BATCH) continue;
+
+        if (now - lastDataUs > static_cast<uint64_t>(UDP_IDLE_TIMEOUT_MS) * 1000) {
+            transferTimeouts++;
+            error = "udp_timeout";
+            return false;
+        }
+        int64_t waitUs = static_cast<int64_t>(UDP_KEEPALIVE_MS) * 1000 - static_cast<int64_t>(now - lastAckSentUs);
+        if (pending > 0) waitUs = std::min<int64_t>(waitUs, static_cast<int64_t>(UDP_ACK_DELAY_US) - static_cast<int64_t>(now - firstPendingUs));
+        int delayedMs = channel.flushDelayed();
+        if (delayedMs >= 0) waitUs = std::min<int64_t>(waitUs, static_cast<int64_t>(delayedMs) * 1000);
+        waitReadable(fds, std::max<int64_t>(waitUs, 0));
+        if (fds[1].revents) {
+            error = "aborted";
+            return false;
+        }
+    }
+
+    // Linger group: the final ACK may be lost or delayed; the impairment queue must drain too
+    int delayedMs;
+    while ((delayedMs = channel.flushDelayed()) >= 0) usleep(static_cast<useconds_t>(delayedMs) * 1000);
+    stats.bytes = size;
+    stats.seconds = static_cast<double>(nowUs() - start) / 1e6;
+    stats.rateMbps = stats.seconds > 0 ? static_cast<double>(size) * 8 / 1e6 / stats.seconds : 0;
+    return true;
+}
+
+std::string udpStatsText() {
+    std::string out;
+    out += "udp.transfers_sent " + std::to_string(transfersSent.load()) + "\n";
+    out += "udp.transfers_received " + std::to_string(transfersReceived.load()) + "\n";
+    out += "udp.timeouts " + std::to_string(transferTimeouts.load()) + "\n";
+    out += "udp.datagrams_sent " + std::to_string(datagramsSent.load()) + "\n";
+    out += "udp.datagrams_received " + std::to_string(datagramsReceived.load()) + "\n";
+    out += "udp.retransmits " + std::to_string(retransmits.load()) + "\n";
+    out += "udp.bad_datagrams " + std::to_string(badDatagrams.load()) + "\n";
+    out += "udp.impaired_drops " + std::to_string(impairedDrops.load()) + "\n";
+    out += "udp.last_rate_mbps " + std::to_string(lastRateMbps.load()) + "\n";
+    out += "udp.last_srtt_us " + std::to_string(lastSrttUs.load()) + "\n";
+    return out;
+}
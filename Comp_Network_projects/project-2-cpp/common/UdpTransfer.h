@@ -0,0 +1,159 @@
+#ifndef UDP_TRANSFER_H
+#define UDP_TRANSFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <sys/socket.h>
+
+// 32-byte header + payload = 1432-byte datagrams, inside a 1500-byte MTU
+#define UDP_HEADER 32
+#define UDP_PAYLOAD 1400
+// datagrams per sendmmsg/recvmmsg call
+#define UDP_BATCH 32
+// the receiver acks after this many datagrams or this long after the first unacked one
+#define UDP_ACK_EVERY 64
+#define UDP_ACK_DELAY_US 2000
+// receiver keepalive while idle (also how a get's sender learns the address)
+#define UDP_KEEPALIVE_MS 50
+#define UDP_SACK_RANGES 64
+// pacing rate bounds, datagrams per second
+#define UDP_INITIAL_RATE 4096
+#define UDP_MIN_RATE 256
+#define UDP_MAX_RATE 1000000
+// rounds the bandwidth max-filter remembers
+#define UDP_BW_ROUNDS 10
+// startup ends early on a round losing more than this percentage of what it sent
+#define UDP_STARTUP_LOSS_PCT 15
+#define UDP_MIN_ROUND_US 8000
+#define UDP_MIN_RTO_US 20000
+// either side gives up after this long without a valid datagram from the other
+#define UDP_IDLE_TIMEOUT_MS 10000
+#define UDP_SOCKET_BUF (8 * 1024 * 1024)
+// emulated bottleneck queue (udp impairment with rate=)
+#define UDP_IMPAIR_QUEUE_US 50000
+
+/*
+UdpTransfer
+-----------
+
+    Bulk data channel for `uput` / `uget`, for long fat lossy links where a
+    single TCP stream collapses. The TCP connection stays the control
+    channel: it carries the request, the UDP port and a random session id
+    chosen by the server, and at the end exactly one verdict line from the
+    receiver (`OK` or an `ERR`). Nothing else is written to it during the
+    transfer, and the sender stops as soon as the verdict is readable.
+
+    Datagrams (all integers big-endian):
+
+        DATA  crc32c | 1 | 0 | len     | session | 0 | block   | sendUs  | payload
+        ACK   crc32c | 2 | 0 | nRanges | session | 0 | cumAck  | echoUs  | delayUs | nRanges x (start, end)
+
+    Block b covers bytes [b * UDP_PAYLOAD, ...). The CRC-32C covers
+    everything after the checksum field; a bad checksum or a foreign session
+    drops the datagram. The server learns the client's address from the
+    first valid datagram (for uget, the receiver's keepalive ACK).
+
+    Receiver: batches with recvmmsg, writes runs of consecutive blocks with
+    one pwritev, and acks every UDP_ACK_EVERY datagrams or UDP_ACK_DELAY_US.
+    An ACK holds the cumulative point (first missing block), up to
+    UDP_SACK_RANGES received ranges above it, and the send time of the
+    newest datagram with how long it was held, for the sender's RTT.
+
+    Sender: sendmmsg batches (a header and a payload iovec per datagram;
+    new data is read with one pread per batch) paced by a token bucket.
+    Losses are found RACK-style (a block sent well before one that has
+    since been acked is lost) plus a retransmission timeout for the tail,
+    and lost blocks go out before new ones.
+
+    Congestion control is rate-based, in the style of BBR, because random
+    loss must not be mistaken for congestion: every round (max(srtt,
+    UDP_MIN_ROUND_US)) measures the delivery rate, the bottleneck estimate
+    is its max over UDP_BW_ROUNDS rounds, and the pacing rate is that
+    estimate times a gain: 2.9 in startup (until the estimate stops growing
+    by 25% for three rounds, or a round loses over UDP_STARTUP_LOSS_PCT),
+    then cycling 1.25, 0.75, 1 x 6 to probe for more and drain the queue
+    the probe built. Data in flight is capped at twice estimate x min RTT.
+    A 1% loss rate costs about 1% throughput, where TCP would halve its
+    window on every loss.
+
+    Testing: `--udp-impair loss=<fraction>,delay=<ms>[,rate=<Mbit/s>]` on
+    the server and the client emulates a link in user space: every
+    outgoing datagram is dropped with the given probability, held for the
+    one-way delay, and with rate= serialized through a drop-tail bottleneck
+    queue of UDP_IMPAIR_QUEUE_US. With root, netem does the same for TCP and
+    UDP alike, for a TCP comparison:
+
+        tc qdisc add dev lo root netem delay 25ms loss 1%
+*/
+
+// What one transfer did, for logs
+struct UdpTransferStats {
+    uint64_t bytes = 0;
+    uint64_t datagrams = 0;
+    uint64_t retransmits = 0;
+    uint64_t badDatagrams = 0;
+    double seconds = 0;
+    double rateMbps = 0;        // final pacing rate (sender) or goodput (receiver)
+    uint32_t srttUs = 0;
+
+    std::string describe() const;
+};
+
+/*
+UdpChannel
+----------
+    One transfer's UDP socket: batched, checksummed send/receive plus the
+    optional link impairment. `connectTo` (client) opens a socket aimed at
+    the server; `bindAny` (server) opens one on an ephemeral port that
+    locks onto the first peer with the right session. Closes the socket.
+*/
+class UdpChannel {
+    private:
+        struct Delayed {
+            uint64_t dueUs;
+            std::string bytes;
+        };
+
+        int fd;
+        uint32_t session;
+        bool peerKnown;
+        std::deque<Delayed> delayed;    // impaired datagrams waiting to leave
+        uint64_t bottleneckFreeUs;      // when the emulated bottleneck drains
+
+        void transmit(struct mmsghdr *msgs, size_t count);
+
+    public:
+        UdpChannel(int fd, uint32_t session, bool peerKnown);
+        ~UdpChannel();
+        UdpChannel(const UdpChannel &) = delete;
+        UdpChannel &operator=(const UdpChannel &) = delete;
+
+        static int connectTo(const std::string &host, int port);
+        // port is set to the ephemeral port bound
+        static int bindAny(int &port);
+        // "loss=0.01,delay=25,rate=100" for every channel of the process; false if malformed
+        static bool impair(const std::string &spec);
+
+        int socket() const { return this->fd; }
+        bool hasPeer() const { return this->peerKnown; }
+        // checksum and send datagrams given as (32-byte header, payload) iovec pairs
+        void send(struct iovec *iovs, size_t count);
+        // up to UDP_BATCH valid datagrams into bufs (UDP_BATCH x (UDP_HEADER + UDP_PAYLOAD)); lens get their sizes
+        size_t receive(char *bufs, size_t *lens, uint64_t &bad);
+        // release impaired datagrams that are due; ms until the next one (-1 none)
+        int flushDelayed();
+};
+
+// Send `size` bytes of fileFd until the receiver's verdict is readable on
+// controlSock (the caller reads it). False if the receiver went silent.
+bool udpSendFile(UdpChannel &channel, int fileFd, size_t size, int controlSock, UdpTransferStats &stats);
+// Receive `size` bytes into fileFd. False with `error` set to the ERR line
+// reason ("udp_timeout", "write_failed", "aborted") otherwise.
+bool udpReceiveFile(UdpChannel &channel, int fileFd, size_t size, int controlSock, UdpTransferStats &stats,
+                    std::string &error);
+// process-wide "udp.* value" lines for the stats command
+std::string udpStatsText();
+
+#endif // UDP_TRANSFER_H
@@ -1,10 +1,12 @@
 #include "proxy.h"
 
 void forwardData(int fromSock, int toSock) {
-    char buffer[BUFFER_SIZE];
+    // pooled: each connection runs two of these loops on fresh threads
+    PooledBuffer buffer;
     ssize_t n;
-    while ((n = recv(fromSock, buffer, sizeof(buffer), 0)) > 0) {
-        if (send(toSock, buffer, n, 0) <= 0) break;
+    while ((n = recv(fromSock, buffer.data(), buffer.size(), 0)) > 0) {
+        // MSG_NOSIGNAL: a peer that hung up ends this connection, not the proxy
+        if (send(toSock, buffer.data(), n, MSG_NOSIGNAL) <= 0) break;
     }
     shutdown(toSock, SHUT_WR);
     shutdown(fromSock, SHUT_RD);
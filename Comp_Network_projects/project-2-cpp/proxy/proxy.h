@@ -13,8 +13,8 @@
 #include <sys/socket.h>
 #include <thread>
 #include <sstream>
+#include "../common/BufferPool.h"
 
 #define PROXY_PORT 5465
-#define BUFFER_SIZE 65536
 
 #endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "ContentIndex.h"
+
+#include <algorithm>
+
+ContentIndex::ContentIndex(MetadataCache &metaCache, StorageTiers &tiers)
+    : metaCache(metaCache), tiers(tiers), stopping(false), dedupHits(0), dedupMisses(0), dropped(0) {}
+
+ContentIndex::~ContentIndex() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    if (this->worker.joinable()) this->worker.join();
+}
+
+void ContentIndex::start() {
+    this->worker = std::thread(&ContentIndex::workerLoop, this);
+}
+
+void ContentIndex::note(const std::string &localPath) {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if (this->queue.size() >= CONTENT_INDEX_QUEUE) {
+            this->dropped++;
+            return;
+        }
+        this->queue.push_back(localPath);
+    }
+    this->cv.notify_one();
+}
+
+void ContentIndex::workerLoop() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (true) {
+        this->cv.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+        if (this->stopping) return;
+        std::string localPath = this->queue.front();
+        this->queue.pop_front();
+        lock.unlock();
+        FileMeta meta;
+        if (this->metaCache.lookup(this->tiers.locate(localPath), meta)) this->add(meta.sha256, localPath);
+        lock.lock();
+    }
+}
+
+// Forget the checksum recorded for a path (called with mtx held)
+void ContentIndex::unlink(const std::string &localPath) {
+    auto it = this->hashOf.find(localPath);
+    if (it == this->hashOf.end()) return;
+    auto paths = this->byHash.find(it->second);
+    if (paths != this->byHash.end()) {
+        paths->second.erase(std::remove(paths->second.begin(), paths->second.end(), localPath), paths->second.end());
+        if (paths->second.empty()) this->byHash.erase(paths);
+    }
+    this->hashOf.erase(it);
+}
+
+void ContentIndex::add(const std::string &sha256, const std::string &localPath) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto known = this->hashOf.find(localPath);
+    if (known != this->hashOf.end() && known->second == sha256) return;
+    this->unlink(localPath);
+    std::vector<std::string> &paths = this->byHash[sha256];
+    if (paths.size() >= CONTENT_INDEX_PATHS) {
+        this->hashOf.erase(paths.front());
+        paths.erase(paths.begin());
+    }
+    paths.push_back(localPath);
+    this->hashOf[localPath] = sha256;
+}
+
+bool ContentIndex::find(const std::string &sha256, size_t size, std::string &localPathOut) {
+    std::vector<std::string> candidates;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto it = this->byHash.find(sha256);
+        if (it != this->byHash.end()) candidates = it->second;
+    }
+    // Verify group: the content may have changed since it was indexed
+    for (const std::string &candidate : candidates) {
+        FileMeta meta;
+        if (this->metaCache.lookup(this->tiers.locate(candidate), meta) && meta.sha256 == sha256 && meta.size == size) {
+            localPathOut = candidate;
+            this->dedupHits++;
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto known = this->hashOf.find(candidate);
+        if (known != this->hashOf.end() && known->second == sha256) this->unlink(candidate);
+    }
+    this->dedupMisses++;
+    return false;
+}
+
+std::string ContentIndex::statsText() {
+    size_t hashes, paths, queued;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        hashes = this->byHash.size();
+        paths = this->hashOf.size();
+        queued = this->queue.size();
+    }
+    std::string out;
+    out += "dedup.hashes " + std::to_string(hashes) + "\n";
+    out += "dedup.paths " + std::to_string(paths) + "\n";
+    out += "dedup.queued " + std::to_string(queued) + "\n";
+    out += "dedup.dropped " + std::to_string(this->dropped.load()) + "\n";
+    out += "dedup.hits " + std::to_string(this->dedupHits.load()) + "\n";
+    out += "dedup.misses " + std::to_string(this->dedupMisses.load()) + "\n";
+    return out;
+}
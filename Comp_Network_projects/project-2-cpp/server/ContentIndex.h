@@ -0,0 +1,71 @@
+#ifndef CONTENT_INDEX_H
+#define CONTENT_INDEX_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MetadataCache.h"
+#include "StorageTiers.h"
+
+#define CONTENT_INDEX_QUEUE 1024
+// stored paths remembered per checksum
+#define CONTENT_INDEX_PATHS 4
+
+/*
+ContentIndex
+------------
+
+    SHA-256 -> stored paths, so `hput` can satisfy an upload from content the
+    server already has. The index is in memory and starts empty; it learns
+    from the server's own writes:
+
+    - note  : a put / copy / move / sput just committed `localPath`. The path
+              is queued and a background thread hashes it through the
+              MetadataCache (which then also answers `stat` for it without
+              reading it again), so plain puts do not pay for hashing. The
+              queue is bounded; extra notes are dropped.
+    - add   : the checksum is already known (a verified hput, a stat).
+    - find  : a stored path whose current content has this checksum and
+              size. Candidates are re-checked through the MetadataCache
+              before they are returned, so an entry made stale by a later
+              put, append or move is simply dropped.
+*/
+
+class ContentIndex {
+    private:
+        MetadataCache &metaCache;
+        StorageTiers &tiers;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::unordered_map<std::string, std::vector<std::string>> byHash;
+        std::unordered_map<std::string, std::string> hashOf;    // path -> checksum in byHash
+        std::deque<std::string> queue;
+        std::thread worker;
+        bool stopping;
+
+        void workerLoop();
+        void unlink(const std::string &localPath);
+
+    public:
+        std::atomic<unsigned long> dedupHits;
+        std::atomic<unsigned long> dedupMisses;
+        std::atomic<unsigned long> dropped;
+
+        ContentIndex(MetadataCache &metaCache, StorageTiers &tiers);
+        ~ContentIndex();
+        void start();
+        void note(const std::string &localPath);
+        void add(const std::string &sha256, const std::string &localPath);
+        bool find(const std::string &sha256, size_t size, std::string &localPathOut);
+        // "dedup.* value" lines for the stats command
+        std::string statsText();
+};
+
+#endif // CONTENT_INDEX_H
@@ -0,0 +1,114 @@
+#include "MetadataCache.h"
+#include "../common/Sha256.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+static int64_t nanos(const struct timespec &ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+MetadataCache::MetadataCache() : hits(0), misses(0), xattrHits(0), xattrWrites(0) {}
+
+// Checksum stored with the file, if it was computed for this size and mtime
+static bool readXattr(const std::string &path, const struct stat &st, std::string &sha) {
+    char value[160];
+    ssize_t n = getxattr(path.c_str(), METADATA_XATTR, value, sizeof(value) - 1);
+    if (n <= 0) return false;
+    value[n] = '\0';
+    unsigned long long size;
+    long long mtimeNs;
+    char hex[65];
+    if (sscanf(value, "%llu %lld %64s", &size, &mtimeNs, hex) != 3 || strlen(hex) != 64) return false;
+    if (size != static_cast<unsigned long long>(st.st_size) || mtimeNs != nanos(st.st_mtim)) return false;
+    sha = hex;
+    return true;
+}
+
+bool MetadataCache::lookup(const std::string &path, FileMeta &out, bool hash) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    out.size = static_cast<size_t>(st.st_size);
+    out.mtime = static_cast<int64_t>(st.st_mtim.tv_sec);
+
+    // Cache group: same file, same version -> known checksum
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto it = this->entries.find(path);
+        if (it != this->entries.end()) {
+            Entry &e = it->second;
+            if (e.dev == st.st_dev && e.ino == st.st_ino && e.size == out.size &&
+                e.mtimeNs == nanos(st.st_mtim) && e.ctimeNs == nanos(st.st_ctim)) {
+                this->lru.splice(this->lru.begin(), this->lru, e.lru);
+                out.sha256 = e.sha256;
+                this->hits++;
+                return true;
+            }
+        }
+    }
+
+    // Hash group: the xattr if it matches, else read the file and keep the
+    // result only if it did not change while we were reading it
+    this->misses++;
+    if (readXattr(path, st, out.sha256)) {
+        this->xattrHits++;
+    } else if (!hash) {
+        out.sha256.clear();
+        return true;
+    } else {
+        if (!sha256File(path, out.sha256)) return false;
+        struct stat after;
+        if (stat(path.c_str(), &after) != 0 || after.st_ino != st.st_ino || after.st_size != st.st_size ||
+            nanos(after.st_mtim) != nanos(st.st_mtim) || nanos(after.st_ctim) != nanos(st.st_ctim)) {
+            return true;
+        }
+        std::string value = std::to_string(out.size) + " " + std::to_string(nanos(st.st_mtim)) + " " + out.sha256;
+        if (setxattr(path.c_str(), METADATA_XATTR, value.data(), value.size(), 0) == 0) {
+            this->xattrWrites++;
+            // only the ctime may differ now; anything else means a writer got in
+            if (stat(path.c_str(), &after) != 0 || after.st_ino != st.st_ino || after.st_size != st.st_size ||
+                nanos(after.st_mtim) != nanos(st.st_mtim)) {
+                return true;
+            }
+            st = after;
+        }
+    }
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->entries.find(path);
+    if (it == this->entries.end()) {
+        if (this->entries.size() >= METADATA_CACHE_ENTRIES) {
+            this->entries.erase(this->lru.back());
+            this->lru.pop_back();
+        }
+        this->lru.push_front(path);
+        it = this->entries.emplace(path, Entry()).first;
+        it->second.lru = this->lru.begin();
+    } else {
+        this->lru.splice(this->lru.begin(), this->lru, it->second.lru);
+    }
+    Entry &e = it->second;
+    e.dev = st.st_dev;
+    e.ino = st.st_ino;
+    e.size = out.size;
+    e.mtimeNs = nanos(st.st_mtim);
+    e.ctimeNs = nanos(st.st_ctim);
+    e.sha256 = out.sha256;
+    return true;
+}
+
+std::string MetadataCache::statsText() {
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        count = this->entries.size();
+    }
+    std::string out;
+    out += "meta.entries " + std::to_string(count) + "\n";
+    out += "meta.hits " + std::to_string(this->hits.load()) + "\n";
+    out += "meta.misses " + std::to_string(this->misses.load()) + "\n";
+    out += "meta.xattr_hits " + std::to_string(this->xattrHits.load()) + "\n";
+    out += "meta.xattr_writes " + std::to_string(this->xattrWrites.load()) + "\n";
+    return out;
+}
@@ -0,0 +1,76 @@
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define METADATA_CACHE_ENTRIES 65536
+// "<size> <mtime ns> <sha256>" of the version the checksum was computed for
+#define METADATA_XATTR "user.cnp.sha256"
+
+/*
+MetadataCache
+-------------
+
+    Size, mtime and SHA-256 of stored files, so `stat` does not re-read a
+    file whose checksum it already knows. An entry is keyed by the path it
+    was computed for and stays valid while stat() still reports the same
+    device, inode, size, mtime and ctime (ns); any write, rename over the
+    path or demotion from the hot tier changes one of them, and the next
+    lookup hashes the file again. The newest METADATA_CACHE_ENTRIES entries
+    are kept (LRU).
+
+    Hashing runs without the lock, so two threads may hash the same file at
+    the same time; the result is identical either way.
+
+    Checksums also persist in the file's METADATA_XATTR extended attribute,
+    so they survive restarts and LRU eviction: a miss first reads the
+    xattr and only hashes if it is missing or was written for another size
+    or mtime. (Writing the xattr changes the ctime, which is why the xattr
+    cannot be keyed on it; the in-memory entry takes the ctime after the
+    write.) Filesystems without user xattrs (older tmpfs) just rehash.
+    Checksums double as the ETags of `get-if-changed`. A lookup with
+    `hash` false stops after the cache and the xattr (a metadata lookup)
+    and leaves sha256 empty when neither knows the current version.
+*/
+
+struct FileMeta {
+    size_t size;
+    int64_t mtime;          // seconds since the epoch
+    std::string sha256;     // lowercase hex
+};
+
+class MetadataCache {
+    private:
+        struct Entry {
+            uint64_t dev, ino;
+            size_t size;
+            int64_t mtimeNs, ctimeNs;
+            std::string sha256;
+            std::list<std::string>::iterator lru;
+        };
+
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru;     // most recently used first
+
+    public:
+        std::atomic<unsigned long> hits;
+        std::atomic<unsigned long> misses;
+        std::atomic<unsigned long> xattrHits;
+        std::atomic<unsigned long> xattrWrites;
+
+        MetadataCache();
+        // false if `path` is not a readable regular file; with !hash an
+        // unknown checksum is left empty instead of reading the file
+        bool lookup(const std::string &path, FileMeta &out, bool hash = true);
+        // "meta.* value" lines for the stats command
+        std::string statsText();
+};
+
+#endif // METADATA_CACHE_H
@@ -0,0 +1,181 @@
+#include "NotifyHub.h"
+#include "../common/PathUtil.h"
+
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// inotify events are held back this long so the in-process publish for the
+// same change (which runs right after the rename/close) is seen first
+#define INOTIFY_SETTLE_MS 100
+
+static uint64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NotifyHub::NotifyHub() : inotifyFd(-1), stopping(false) {
+    this->lastVersion = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+NotifyHub::~NotifyHub() {
+    this->stopping = true;
+    if (this->inotifyThread.joinable()) this->inotifyThread.join();
+    if (this->inotifyFd >= 0) close(this->inotifyFd);
+}
+
+uint64_t NotifyHub::publishLocked(const std::string &path, size_t size) {
+    this->history.push_back(ChangeEvent{++this->lastVersion, path, size});
+    if (this->history.size() > NOTIFY_HISTORY) this->history.pop_front();
+    this->cv.notify_all();
+    return this->lastVersion;
+}
+
+uint64_t NotifyHub::publish(const std::string &path, size_t size) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (this->inotifyFd >= 0) {
+        uint64_t now = nowMs();
+        if (this->recentLocal.size() > NOTIFY_HISTORY) {
+            for (auto it = this->recentLocal.begin(); it != this->recentLocal.end();) {
+                if (now - it->second.ms > NOTIFY_DEDUP_MS) it = this->recentLocal.erase(it);
+                else ++it;
+            }
+        }
+        auto entry = this->recentLocal.find(path);
+        if (entry == this->recentLocal.end() || now - entry->second.ms > NOTIFY_DEDUP_MS) {
+            this->recentLocal[path] = LocalChange{size, now, 1};
+        } else {
+            entry->second.size = size;
+            entry->second.ms = now;
+            entry->second.unmatched++;
+        }
+    }
+    return this->publishLocked(path, size);
+}
+
+uint64_t NotifyHub::currentVersion() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->lastVersion;
+}
+
+bool NotifyHub::waitFor(const std::string &prefix, uint64_t since, long timeoutMs,
+                        const std::function<bool()> &cancelled, ChangeEvent &out) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (true) {
+        // history is ordered by version, so scan back to the first one past `since`
+        auto it = this->history.end();
+        while (it != this->history.begin() && std::prev(it)->version > since) --it;
+        for (; it != this->history.end(); ++it) {
+            if (it->path.compare(0, prefix.size(), prefix) == 0) {
+                out = *it;
+                return true;
+            }
+        }
+        since = this->lastVersion;
+
+        // short waits so a dropped client or a draining server is noticed
+        auto step = std::chrono::steady_clock::now() + std::chrono::milliseconds(250);
+        if (timeoutMs >= 0 && step > deadline) step = deadline;
+        this->cv.wait_until(lock, step);
+        if (this->lastVersion != since) continue;
+        if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline) return false;
+        lock.unlock();
+        bool stop = cancelled();
+        lock.lock();
+        if (stop) return false;
+    }
+}
+
+bool NotifyHub::startInotify(const std::string &root) {
+    this->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotifyFd < 0) return false;
+    this->inotifyThread = std::thread(&NotifyHub::inotifyLoop, this, root);
+    return true;
+}
+
+// Watch `dir` and everything below it; `rel` is its path relative to the root
+static void addWatches(int fd, const std::string &root, const std::string &rel,
+                       std::unordered_map<int, std::string> &dirs) {
+    std::string full = rel.empty() ? root : root + "/" + rel;
+    int wd = inotify_add_watch(fd, full.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd < 0) return;
+    dirs[wd] = rel;
+    DIR *d = opendir(full.c_str());
+    if (!d) return;
+    while (struct dirent *e = readdir(d)) {
+        if (e->d_type != DT_DIR || strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        addWatches(fd, root, rel.empty() ? e->d_name : rel + "/" + e->d_name, dirs);
+    }
+    closedir(d);
+}
+
+// Map a file below the root back to the logical path clients use
+static bool logicalPathFor(const std::string &rel, std::string &out) {
+    if (storageLayout() == LAYOUT_FLAT) {
+        out = rel;
+        return true;
+    }
+    if (rel.size() < 7 || rel[2] != '/' || rel[5] != '/') return false;
+    return unescapeFanoutName(rel.substr(6), out);
+}
+
+void NotifyHub::inotifyLoop(std::string root) {
+    std::unordered_map<int, std::string> dirs;
+    addWatches(this->inotifyFd, root, "", dirs);
+    std::vector<std::pair<uint64_t, std::string>> pending;   // (seen at ms, rel path)
+    alignas(struct inotify_event) char buf[64 * 1024];
+
+    while (!this->stopping) {
+        struct pollfd pfd;
+        pfd.fd = this->inotifyFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 50) > 0) {
+            ssize_t n = read(this->inotifyFd, buf, sizeof(buf));
+            for (ssize_t off = 0; n > 0 && off < n;) {
+                struct inotify_event *ev = (struct inotify_event *)(buf + off);
+                off += sizeof(struct inotify_event) + ev->len;
+                auto dir = dirs.find(ev->wd);
+                if (dir == dirs.end() || ev->len == 0) continue;
+                std::string rel = dir->second.empty() ? ev->name : dir->second + "/" + ev->name;
+                if (ev->mask & IN_ISDIR) {
+                    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) addWatches(this->inotifyFd, root, rel, dirs);
+                    continue;
+                }
+                if (!(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) continue;
+                if (rel.size() > 5 && rel.compare(rel.size() - 5, 5, ".part") == 0) continue;
+                pending.emplace_back(nowMs(), rel);
+            }
+        }
+
+        // Settle group: publish what the server did not already report itself
+        uint64_t now = nowMs();
+        size_t kept = 0;
+        for (auto &p : pending) {
+            if (now - p.first < INOTIFY_SETTLE_MS) {
+                pending[kept++] = p;
+                continue;
+            }
+            std::string logical;
+            struct stat st;
+            if (!logicalPathFor(p.second, logical) || stat((root + "/" + p.second).c_str(), &st) != 0) continue;
+            std::lock_guard<std::mutex> lock(this->mtx);
+            auto local = this->recentLocal.find(logical);
+            // the file may have changed again since; compare with the latest publish
+            if (local != this->recentLocal.end() && local->second.size == (size_t)st.st_size &&
+                now - local->second.ms <= NOTIFY_DEDUP_MS) {
+                if (--local->second.unmatched == 0) this->recentLocal.erase(local);
+                continue;
+            }
+            this->publishLocked(logical, (size_t)st.st_size);
+        }
+        pending.resize(kept);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef NOTIFY_HUB_H
+#define NOTIFY_HUB_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#define NOTIFY_HISTORY 4096
+// inotify events that match an in-process event this recently are duplicates
+#define NOTIFY_DEDUP_MS 2000
+
+/*
+NotifyHub
+---------
+
+    In-process change feed behind the `watch` command. Every successful
+    put / copy / move / append publishes a ChangeEvent with the logical
+    path, the new size and a version; `watch` connections block in
+    `waitFor` until an event under their prefix shows up.
+
+    Versions are strictly increasing and start from the wall clock (in
+    microseconds) so a server started by a hot upgrade continues above the
+    versions its predecessor handed out. The last NOTIFY_HISTORY events are
+    kept, so a watcher that passes the version it saw last does not miss
+    changes that happened between two `watch` calls.
+
+    `startInotify` optionally adds a watcher thread on the storage root for
+    out-of-band changes (files dropped into server_storage/ by other tools).
+    Changes the server itself made are filtered out by path and size so
+    they are reported only once.
+*/
+
+struct ChangeEvent {
+    uint64_t version;
+    std::string path;   // logical path as used in the protocol
+    size_t size;
+};
+
+class NotifyHub {
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<ChangeEvent> history;
+        uint64_t lastVersion;
+        // recent in-process events per path, matched against inotify events
+        struct LocalChange {
+            size_t size;        // latest size published
+            uint64_t ms;        // when it was published
+            int unmatched;      // publishes not yet seen by inotify
+        };
+        std::unordered_map<std::string, LocalChange> recentLocal;
+        int inotifyFd;
+        std::atomic<bool> stopping;
+        std::thread inotifyThread;
+
+        uint64_t publishLocked(const std::string &path, size_t size);
+        void inotifyLoop(std::string root);
+
+    public:
+        NotifyHub();
+        ~NotifyHub();
+        uint64_t publish(const std::string &path, size_t size);
+        uint64_t currentVersion();
+        // First event under `prefix` newer than `since`. Waits up to
+        // timeoutMs (< 0: forever), calling `cancelled` between short waits;
+        // false on timeout or cancellation.
+        bool waitFor(const std::string &prefix, uint64_t since, long timeoutMs,
+                     const std::function<bool()> &cancelled, ChangeEvent &out);
+        bool startInotify(const std::string &root);
+};
+
+#endif // NOTIFY_HUB_H
@@ -0,0 +1,111 @@
+#include "Prefetcher.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// how many hinted paths are remembered to suppress duplicate hints
+#define PREFETCH_RECENT 1024
+
+Prefetcher::Prefetcher() : stopping(false), hinted(0), dropped(0) {}
+
+Prefetcher::~Prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    for (auto &t : this->workers) t.join();
+}
+
+void Prefetcher::start() {
+    for (int i = 0; i < PREFETCH_THREADS; i++) {
+        this->workers.emplace_back(&Prefetcher::workerLoop, this);
+    }
+}
+
+void Prefetcher::hint(const std::string &localPath) {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if (this->workers.empty() || this->queued.count(localPath) || this->recentSet.count(localPath)) return;
+        if (this->queue.size() >= PREFETCH_QUEUE) {
+            this->dropped++;
+            return;
+        }
+        this->queue.push_back(localPath);
+        this->queued.insert(localPath);
+    }
+    this->cv.notify_one();
+}
+
+void Prefetcher::workerLoop() {
+    while (true) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->cv.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+            if (this->stopping) return;
+            path = this->queue.front();
+            this->queue.pop_front();
+            this->queued.erase(path);
+            this->recent.push_back(path);
+            this->recentSet.insert(path);
+            if (this->recent.size() > PREFETCH_RECENT) {
+                this->recentSet.erase(this->recent.front());
+                this->recent.pop_front();
+            }
+        }
+        // WILLNEED starts asynchronous readahead of the whole file
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+        this->hinted++;
+    }
+}
+
+// Parse "<n>" as a size; false on anything else
+static bool parseSize(const std::string &tok, size_t &out) {
+    if (tok.empty()) return false;
+    char *end = nullptr;
+    unsigned long v = std::strtoul(tok.c_str(), &end, 10);
+    if (*end != '\0') return false;
+    out = static_cast<size_t>(v);
+    return true;
+}
+
+void Prefetcher::scanQueued(int sock, bool bodiesInBand, std::vector<std::string> &pathsOut) {
+    char buf[PREFETCH_PEEK_BYTES];
+    ssize_t n = recv(sock, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+    if (n <= 0) return;
+
+    // Walk the queued requests; each step must know exactly how long the request is
+    size_t pos = 0, seen = 0;
+    while (pos < static_cast<size_t>(n) && seen < PREFETCH_DEPTH) {
+        const char *nl = static_cast<const char *>(memchr(buf + pos, '\n', n - pos));
+        if (!nl) return;
+        std::istringstream iss(std::string(buf + pos, nl - buf - pos));
+        pos = nl - buf + 1;
+        std::string cmd, a, b;
+        iss >> cmd >> a >> b;
+        size_t len1 = 0, len2 = 0;
+        if ((cmd == "get" || cmd == "get-if-changed" || cmd == "getr" || cmd == "sget" || cmd == "uget") && parseSize(a, len1)) {
+            if (pos + len1 > static_cast<size_t>(n)) return;
+            pathsOut.emplace_back(buf + pos, len1);
+            pos += len1;
+        } else if ((cmd == "put" || cmd == "append") && parseSize(a, len1) && parseSize(b, len2)) {
+            pos += len1 + (bodiesInBand ? len2 : 0);
+        } else if ((cmd == "copy" || cmd == "move") && parseSize(a, len1) && parseSize(b, len2)) {
+            pos += len1 + len2;
+        } else if ((cmd == "watch" || cmd == "uput") && parseSize(a, len1)) {
+            pos += len1;
+        } else {
+            return;
+        }
+        seen++;
+    }
+}
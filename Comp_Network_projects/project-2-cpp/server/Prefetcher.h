@@ -0,0 +1,67 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#define PREFETCH_THREADS 2
+#define PREFETCH_QUEUE 256
+// pipelined requests looked at per scan, and bytes peeked to find them
+#define PREFETCH_DEPTH 8
+#define PREFETCH_PEEK_BYTES 4096
+
+/*
+Prefetcher
+----------
+
+    Overlaps disk reads with network sends for pipelined / batched gets.
+
+    Before a connection executes a request, `scanQueued` peeks (MSG_PEEK,
+    non-blocking) at what the client has already queued on the socket and
+    picks out the paths of the next PREFETCH_DEPTH `get` requests. They are
+    handed to `hint`, and a small pool of worker threads issues
+    posix_fadvise(POSIX_FADV_WILLNEED) for each file, so the kernel reads
+    them into the page cache while the current file is still being sent.
+
+    Hints are best effort: the queue is bounded (extra hints are dropped),
+    a path hinted recently is not hinted again, and a scan stops at the
+    first request it cannot frame (an unknown verb or a put body that is
+    not fully in the peek window).
+*/
+
+class Prefetcher {
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::string> queue;
+        std::unordered_set<std::string> queued;     // paths in `queue`
+        std::deque<std::string> recent;             // recently hinted, oldest first
+        std::unordered_set<std::string> recentSet;
+        std::vector<std::thread> workers;
+        bool stopping;
+
+        void workerLoop();
+
+    public:
+        std::atomic<unsigned long> hinted;
+        std::atomic<unsigned long> dropped;
+
+        Prefetcher();
+        ~Prefetcher();
+        void start();
+        void hint(const std::string &localPath);
+
+        // Logical paths of the gets queued on `sock` behind the request being
+        // served. `bodiesInBand` is false when put bodies travel outside the
+        // socket (shared-memory rings).
+        static void scanQueued(int sock, bool bodiesInBand, std::vector<std::string> &pathsOut);
+};
+
+#endif // PREFETCHER_H
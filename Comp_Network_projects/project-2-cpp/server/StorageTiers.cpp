@@ -0,0 +1,342 @@
+#include "StorageTiers.h"
+#include "../common/PathUtil.h"
+#include "../common/BufferPool.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Whole-file copy between tiers (sendfile, or read/write where it is not supported)
+static bool copyFile(const std::string &src, const std::string &dst) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0 && errno == ENOENT && ensureParentDirs(dst)) out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    bool ok = true;
+    while (true) {
+        ssize_t n = sendfile(out, in, nullptr, 1 << 30);
+        if (n > 0) continue;
+        if (n == 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EINVAL && errno != ENOSYS) { ok = false; break; }
+        PooledBuffer buffer;
+        while ((n = read(in, buffer.data(), buffer.size())) > 0) {
+            if (write(out, buffer.data(), static_cast<size_t>(n)) != n) { ok = false; break; }
+        }
+        if (n < 0) ok = false;
+        break;
+    }
+    close(in);
+    if (close(out) != 0) ok = false;
+    return ok;
+}
+
+StorageTiers::StorageTiers()
+    : capacity(static_cast<size_t>(TIER_DEFAULT_CAPACITY_MB) << 20), hotBytes(0), nextGeneration(0),
+      stopping(false), hotReads(0), diskReads(0), promotions(0), demotions(0) {}
+
+StorageTiers::~StorageTiers() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    if (this->mover.joinable()) this->mover.join();
+}
+
+void StorageTiers::configure(const std::string &hotRoot, size_t capacityBytes) {
+    this->hotRoot = hotRoot;
+    while (this->hotRoot.size() > 1 && this->hotRoot.back() == '/') this->hotRoot.pop_back();
+    this->capacity = capacityBytes;
+}
+
+void StorageTiers::start() {
+    if (!this->enabled()) return;
+    ensureParentDirs(this->hotRoot + "/" + STORAGE_ROOT + "/");
+    this->scanExisting();
+    std::cout << "hot tier: " << this->hotRoot << " (" << this->hot.size() << " files, "
+              << this->hotBytes << " of " << this->capacity << " bytes)" << std::endl;
+    this->mover = std::thread(&StorageTiers::moverLoop, this);
+}
+
+std::string StorageTiers::hotPath(const std::string &localPath) const {
+    return this->hotRoot + "/" + localPath;
+}
+
+// Hot files left by a previous run are newer than disk as far as we know
+void StorageTiers::scanExisting() {
+    std::function<void(const std::string &)> walk = [&](const std::string &rel) {
+        DIR *dir = opendir(this->hotPath(rel).c_str());
+        if (!dir) return;
+        while (struct dirent *ent = readdir(dir)) {
+            std::string name = ent->d_name;
+            if (name == "." || name == "..") continue;
+            std::string child = rel + "/" + name;
+            struct stat st;
+            if (lstat(this->hotPath(child).c_str(), &st) != 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                walk(child);
+            } else if (name.size() > 5 && name.compare(name.size() - 5, 5, ".part") == 0) {
+                unlink(this->hotPath(child).c_str());
+            } else if (S_ISREG(st.st_mode)) {
+                Entry &e = this->hot[child];
+                e.size = static_cast<size_t>(st.st_size);
+                e.dirty = true;
+                e.generation = ++this->nextGeneration;
+                e.readers = 0;
+                e.lastRead = std::chrono::steady_clock::now();
+                this->hotBytes += e.size;
+            }
+        }
+        closedir(dir);
+    };
+    walk(STORAGE_ROOT);
+}
+
+std::string StorageTiers::placeForWrite(const std::string &localPath, size_t size) {
+    if (!this->enabled()) return localPath;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->hot.find(localPath);
+    size_t replaced = it != this->hot.end() ? it->second.size : 0;
+    if (this->hotBytes - replaced + size > this->capacity) return localPath;
+    return this->hotPath(localPath);
+}
+
+bool StorageTiers::commit(const std::string &tmpPath, const std::string &placedPath) {
+    if (!this->enabled()) return std::rename(tmpPath.c_str(), placedPath.c_str()) == 0;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (std::rename(tmpPath.c_str(), placedPath.c_str()) != 0) return false;
+    std::string prefix = this->hotRoot + "/";
+    if (placedPath.compare(0, prefix.size(), prefix) == 0) {
+        std::string localPath = placedPath.substr(prefix.size());
+        struct stat st;
+        size_t size = stat(placedPath.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        auto it = this->hot.find(localPath);
+        if (it == this->hot.end()) {
+            it = this->hot.emplace(localPath, Entry()).first;
+            it->second.size = 0;
+            it->second.readers = 0;
+        }
+        Entry &e = it->second;
+        this->hotBytes = this->hotBytes - e.size + size;
+        e.size = size;
+        e.dirty = true;
+        e.generation = ++this->nextGeneration;
+        e.lastRead = std::chrono::steady_clock::now();
+        this->coldHits.erase(localPath);
+        return true;
+    }
+    // the new disk copy supersedes any hot one
+    auto it = this->hot.find(placedPath);
+    if (it != this->hot.end()) {
+        unlink(this->hotPath(placedPath).c_str());
+        this->hotBytes -= it->second.size;
+        this->hot.erase(it);
+    }
+    return true;
+}
+
+std::string StorageTiers::locate(const std::string &localPath) {
+    if (!this->enabled()) return localPath;
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->hot.count(localPath) ? this->hotPath(localPath) : localPath;
+}
+
+void StorageTiers::moverLoop() {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    while (!this->stopping) {
+        this->cv.wait_for(lock, std::chrono::milliseconds(TIER_SCAN_MS),
+                          [this]() { return this->stopping || !this->promoteQueue.empty(); });
+        if (this->stopping) break;
+
+        // Selection group: cold files first, then least recently read while over capacity
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::string> promote(this->promoteQueue.begin(), this->promoteQueue.end());
+        this->promoteQueue.clear();
+        std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>> byAge;
+        for (auto &entry : this->hot) {
+            if (entry.second.readers == 0) byAge.emplace_back(entry.second.lastRead, entry.first);
+        }
+        std::sort(byAge.begin(), byAge.end());
+        std::vector<std::string> victims;
+        size_t projected = this->hotBytes;
+        for (auto &candidate : byAge) {
+            bool cold = now - candidate.first >= std::chrono::seconds(TIER_COLD_SECS);
+            if (!cold && projected <= this->capacity) break;
+            victims.push_back(candidate.second);
+            projected -= this->hot[candidate.second].size;
+        }
+        lock.unlock();
+
+        // Move group: copies run without the index lock
+        {
+            std::lock_guard<std::mutex> moving(this->moverMtx);
+            for (const std::string &path : victims) this->demote(path, false);
+            for (const std::string &path : promote) this->promote(path);
+        }
+        lock.lock();
+    }
+}
+
+// Bring the disk copy up to date and drop the hot one. Without `force` a
+// file that is being read keeps its (now clean) hot copy for the next round.
+// Called with moverMtx held.
+bool StorageTiers::demote(const std::string &localPath, bool force) {
+    uint64_t generation;
+    bool dirty;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        auto it = this->hot.find(localPath);
+        if (it == this->hot.end()) return true;
+        generation = it->second.generation;
+        dirty = it->second.dirty;
+    }
+    std::string hp = this->hotPath(localPath);
+    std::string tmpPath = localPath + "." + std::to_string(getpid()) + ".tier.part";
+    if (dirty && !copyFile(hp, tmpPath)) {
+        unlink(tmpPath.c_str());
+        std::cerr << "hot tier: cannot demote " << localPath << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    auto it = this->hot.find(localPath);
+    if (it == this->hot.end() || it->second.generation != generation) {
+        // replaced by a newer put while we were copying
+        if (dirty) unlink(tmpPath.c_str());
+        return false;
+    }
+    if (dirty) {
+        if (std::rename(tmpPath.c_str(), localPath.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        it->second.dirty = false;
+    }
+    if (!force && it->second.readers > 0) return false;
+    unlink(hp.c_str());
+    this->hotBytes -= it->second.size;
+    this->hot.erase(it);
+    this->demotions++;
+    return true;
+}
+
+// Copy a frequently read disk file up. Called with moverMtx held.
+bool StorageTiers::promote(const std::string &localPath) {
+    struct stat before;
+    if (stat(localPath.c_str(), &before) != 0 || !S_ISREG(before.st_mode)) return false;
+    size_t size = static_cast<size_t>(before.st_size);
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        if (this->hot.count(localPath) || this->writers.count(localPath) || this->hotBytes + size > this->capacity) return false;
+    }
+    std::string hp = this->hotPath(localPath);
+    std::string tmpPath = hp + ".part";
+    if (!copyFile(localPath, tmpPath)) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    // Commit group: only if nobody wrote the file while it was copied
+    std::lock_guard<std::mutex> lock(this->mtx);
+    struct stat after;
+    bool unchanged = stat(localPath.c_str(), &after) == 0 && after.st_ino == before.st_ino &&
+                     after.st_size == before.st_size && after.st_mtim.tv_sec == before.st_mtim.tv_sec &&
+                     after.st_mtim.tv_nsec == before.st_mtim.tv_nsec;
+    if (!unchanged || this->hot.count(localPath) || this->writers.count(localPath) ||
+        std::rename(tmpPath.c_str(), hp.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    Entry &e = this->hot[localPath];
+    e.size = size;
+    e.dirty = false;
+    e.generation = ++this->nextGeneration;
+    e.readers = 0;
+    e.lastRead = std::chrono::steady_clock::now();
+    this->hotBytes += size;
+    this->promotions++;
+    return true;
+}
+
+std::string StorageTiers::statsText() {
+    size_t files, bytes;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        files = this->hot.size();
+        bytes = this->hotBytes;
+    }
+    std::string out;
+    out += "tier.hot_capacity " + std::to_string(this->enabled() ? this->capacity : 0) + "\n";
+    out += "tier.hot_files " + std::to_string(files) + "\n";
+    out += "tier.hot_bytes " + std::to_string(bytes) + "\n";
+    out += "tier.hot_reads " + std::to_string(this->hotReads.load()) + "\n";
+    out += "tier.disk_reads " + std::to_string(this->diskReads.load()) + "\n";
+    out += "tier.promotions " + std::to_string(this->promotions.load()) + "\n";
+    out += "tier.demotions " + std::to_string(this->demotions.load()) + "\n";
+    return out;
+}
+
+TierRead::TierRead(StorageTiers &tiers, const std::string &localPath)
+    : tiers(tiers), localPath(localPath), current(localPath), pinned(false) {
+    if (!tiers.enabled()) return;
+    std::lock_guard<std::mutex> lock(tiers.mtx);
+    auto now = std::chrono::steady_clock::now();
+    auto it = tiers.hot.find(localPath);
+    if (it != tiers.hot.end()) {
+        it->second.readers++;
+        it->second.lastRead = now;
+        this->current = tiers.hotPath(localPath);
+        this->pinned = true;
+        tiers.hotReads++;
+        return;
+    }
+
+    // Tracker group: count reads of disk files; hot enough ones are queued for promotion
+    tiers.diskReads++;
+    if (tiers.coldHits.size() >= TIER_TRACK_MAX && !tiers.coldHits.count(localPath)) tiers.coldHits.clear();
+    StorageTiers::ColdHits &hits = tiers.coldHits[localPath];
+    if (hits.hits == 0 || now - hits.first > std::chrono::seconds(TIER_PROMOTE_WINDOW_SECS)) {
+        hits.hits = 0;
+        hits.first = now;
+    }
+    if (++hits.hits >= TIER_PROMOTE_HITS) {
+        tiers.coldHits.erase(localPath);
+        tiers.promoteQueue.insert(localPath);
+        tiers.cv.notify_one();
+    }
+}
+
+TierRead::~TierRead() {
+    if (!this->pinned) return;
+    std::lock_guard<std::mutex> lock(this->tiers.mtx);
+    auto it = this->tiers.hot.find(this->localPath);
+    if (it != this->tiers.hot.end() && it->second.readers > 0) it->second.readers--;
+}
+
+TierWrite::TierWrite(StorageTiers &tiers, const std::string &localPath) : tiers(tiers), localPath(localPath), demoted(true) {
+    if (!tiers.enabled()) return;
+    std::lock_guard<std::mutex> moving(tiers.moverMtx);
+    this->demoted = tiers.demote(localPath, true);
+    std::lock_guard<std::mutex> lock(tiers.mtx);
+    tiers.writers[localPath]++;
+    tiers.coldHits.erase(localPath);
+}
+
+TierWrite::~TierWrite() {
+    if (!this->tiers.enabled()) return;
+    std::lock_guard<std::mutex> lock(this->tiers.mtx);
+    auto it = this->tiers.writers.find(this->localPath);
+    if (it != this->tiers.writers.end() && --it->second == 0) this->tiers.writers.erase(it);
+}
@@ -0,0 +1,155 @@
+#ifndef STORAGE_TIERS_H
+#define STORAGE_TIERS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#define TIER_DEFAULT_CAPACITY_MB 256
+// a hot file not read for this long is moved down to disk
+#define TIER_COLD_SECS 30
+#define TIER_SCAN_MS 1000
+// a disk file read this often within the window is copied up
+#define TIER_PROMOTE_HITS 3
+#define TIER_PROMOTE_WINDOW_SECS 10
+// disk files whose reads are being counted
+#define TIER_TRACK_MAX 4096
+
+/*
+StorageTiers
+------------
+
+    A RAM-backed hot tier in front of `server_storage/`. With
+    `--hot-tier <dir>` (normally on tmpfs, e.g. /dev/shm/...) a file's hot
+    copy lives at `<dir>/<its server_storage path>`; without it every call
+    below is a no-op and files only live on disk.
+
+    - placeForWrite / commit : a put whose size fits in the tier's free
+                               capacity is written and renamed into the hot
+                               tier (dirty: newer than any disk copy). A put
+                               that does not fit goes to disk and drops any
+                               hot copy.
+    - TierRead               : get/getr/sget read whichever copy is current.
+                               A hot copy is pinned while it is being read;
+                               every read feeds the access tracker.
+    - TierWrite              : commands that change a stored file in place
+                               (append, copy, move, sput) first push its hot
+                               copy down, so they always work on disk, and
+                               keep it from being promoted until they finish.
+                               If that demotion fails they answer
+                               `ERR 500 tier_busy` and leave the file alone.
+
+    A background mover runs every TIER_SCAN_MS. It demotes hot files that
+    were not read for TIER_COLD_SECS, and the least recently read ones while
+    the tier is over capacity: a dirty file is copied to `<path>.<pid>.tier.part`
+    on disk and renamed into place, then its hot copy is unlinked. Disk
+    files read TIER_PROMOTE_HITS times within TIER_PROMOTE_WINDOW_SECS are
+    copied up (clean: dropping them later costs nothing). A copy made while
+    the file changed (a newer put, a write in progress) is thrown away.
+
+    Durability: a put acknowledged into the hot tier is in RAM until it is
+    demoted. Hot files surviving a restart (tmpfs outlives the process) are
+    picked up again by `start`, but a reboot loses them.
+*/
+
+class StorageTiers {
+    private:
+        struct Entry {
+            size_t size;
+            bool dirty;             // newer than the disk copy
+            uint64_t generation;    // bumped by every commit, so a stale demotion can tell
+            int readers;
+            std::chrono::steady_clock::time_point lastRead;
+        };
+        struct ColdHits {
+            unsigned hits;
+            std::chrono::steady_clock::time_point first;
+        };
+
+        std::string hotRoot;
+        size_t capacity;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::unordered_map<std::string, Entry> hot;     // keyed by server_storage path
+        size_t hotBytes;
+        uint64_t nextGeneration;
+        std::unordered_map<std::string, ColdHits> coldHits;
+        std::unordered_set<std::string> promoteQueue;
+        std::unordered_map<std::string, int> writers;
+        std::mutex moverMtx;                            // one demotion/promotion at a time
+        std::thread mover;
+        bool stopping;
+
+        std::string hotPath(const std::string &localPath) const;
+        void moverLoop();
+        bool demote(const std::string &localPath, bool force);
+        bool promote(const std::string &localPath);
+        void scanExisting();
+
+        friend class TierRead;
+        friend class TierWrite;
+
+    public:
+        std::atomic<unsigned long> hotReads;
+        std::atomic<unsigned long> diskReads;
+        std::atomic<unsigned long> promotions;
+        std::atomic<unsigned long> demotions;
+
+        StorageTiers();
+        ~StorageTiers();
+        void configure(const std::string &hotRoot, size_t capacityBytes);
+        bool enabled() const { return !this->hotRoot.empty(); }
+        void start();
+
+        // where a new file of `size` bytes for `localPath` should be written
+        std::string placeForWrite(const std::string &localPath, size_t size);
+        // rename `tmpPath` to `placedPath` (a result of placeForWrite) and
+        // record the new copy; false if the rename failed
+        bool commit(const std::string &tmpPath, const std::string &placedPath);
+        // current copy of `localPath`, without counting a read
+        std::string locate(const std::string &localPath);
+        // "tier.* value" lines for the stats command
+        std::string statsText();
+};
+
+/*
+TierRead / TierWrite
+--------------------
+    Scoped access to one stored file. `path()` of a TierRead is the copy to
+    open (hot or disk).
+*/
+class TierRead {
+    private:
+        StorageTiers &tiers;
+        std::string localPath;
+        std::string current;
+        bool pinned;
+
+    public:
+        TierRead(StorageTiers &tiers, const std::string &localPath);
+        ~TierRead();
+        const std::string &path() const { return this->current; }
+};
+
+class TierWrite {
+    private:
+        StorageTiers &tiers;
+        std::string localPath;
+        bool demoted;
+
+    public:
+        TierWrite(StorageTiers &tiers, const std::string &localPath);
+        ~TierWrite();
+        // false if the hot copy could not be pushed down: the disk copy is
+        // stale, so the command must fail instead of writing to it
+        bool ok() const { return this->demoted; }
+};
+
+#endif // STORAGE_TIERS_H
@@ -0,0 +1,119 @@
+#include "TransferScheduler.h"
+
+#include <errno.h>
+#include <poll.h>
+
+static double priority(uint64_t remaining, std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point now) {
+    double ageMs = std::chrono::duration<double, std::milli>(now - start).count();
+    return static_cast<double>(remaining) - ageMs * SRPT_AGING_BYTES_PER_MS;
+}
+
+TransferScheduler::TransferScheduler()
+    : slots(0), active(0), turns(0), queuedTurns(0), agedTurns(0), maxWaiters(0) {}
+
+void TransferScheduler::setSlots(unsigned slots) {
+    this->slots = slots;
+}
+
+void TransferScheduler::acquire(uint64_t remaining, std::chrono::steady_clock::time_point start) {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->turns++;
+    if (this->active < this->slots && this->waiters.empty()) {
+        this->active++;
+        return;
+    }
+    // Queue group: wait until a finishing chunk hands this transfer its slot
+    Waiter self;
+    self.remaining = remaining;
+    self.start = start;
+    self.granted = false;
+    this->waiters.push_back(&self);
+    this->queuedTurns++;
+    if (this->waiters.size() > this->maxWaiters) this->maxWaiters = this->waiters.size();
+    self.cv.wait(lock, [&self]() { return self.granted; });
+}
+
+// A holder keeps its slot for the next chunk unless a waiter now ranks ahead of it
+bool TransferScheduler::keep(uint64_t remaining, std::chrono::steady_clock::time_point start) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->turns++;
+    auto now = std::chrono::steady_clock::now();
+    double own = priority(remaining, start, now);
+    for (Waiter *w : this->waiters) {
+        if (priority(w->remaining, w->start, now) < own) return false;
+    }
+    return true;
+}
+
+// The slot passes straight to the best waiter, so `active` only drops when nobody waits
+void TransferScheduler::release() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    if (this->waiters.empty()) {
+        this->active--;
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto best = this->waiters.end();
+    auto shortest = this->waiters.end();
+    double bestScore = 0;
+    for (auto it = this->waiters.begin(); it != this->waiters.end(); ++it) {
+        double score = priority((*it)->remaining, (*it)->start, now);
+        if (best == this->waiters.end() || score < bestScore) {
+            best = it;
+            bestScore = score;
+        }
+        if (shortest == this->waiters.end() || (*it)->remaining < (*shortest)->remaining) shortest = it;
+    }
+    if ((*best)->remaining != (*shortest)->remaining) this->agedTurns++;
+    Waiter *w = *best;
+    this->waiters.erase(best);
+    w->granted = true;
+    w->cv.notify_one();
+}
+
+std::string TransferScheduler::statsText() {
+    size_t waiting;
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        waiting = this->waiters.size();
+    }
+    std::string out;
+    out += "srpt.slots " + std::to_string(this->slots) + "\n";
+    out += "srpt.turns " + std::to_string(this->turns.load()) + "\n";
+    out += "srpt.queued_turns " + std::to_string(this->queuedTurns.load()) + "\n";
+    out += "srpt.aged_turns " + std::to_string(this->agedTurns.load()) + "\n";
+    out += "srpt.waiting " + std::to_string(waiting) + "\n";
+    out += "srpt.max_waiting " + std::to_string(this->maxWaiters.load()) + "\n";
+    return out;
+}
+
+ScheduledTransfer::ScheduledTransfer(TransferScheduler &sched, uint64_t size, int readySock, short events)
+    : sched(sched), remaining(size), start(std::chrono::steady_clock::now()),
+      readySock(readySock), events(events), holding(false) {}
+
+ScheduledTransfer::~ScheduledTransfer() {
+    if (this->holding) this->sched.release();
+}
+
+void ScheduledTransfer::beginChunk() {
+    if (this->sched.slotCount() == 0) return;
+    if (this->holding) {
+        struct pollfd pfd = {this->readySock, this->events, 0};
+        bool ready = this->readySock < 0 || poll(&pfd, 1, 0) > 0;
+        if (ready && this->sched.keep(this->remaining, this->start)) return;
+        this->sched.release();
+        this->holding = false;
+    }
+    // only ask for a turn once the chunk can move right away
+    if (this->readySock >= 0) {
+        struct pollfd pfd = {this->readySock, this->events, 0};
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+    }
+    this->sched.acquire(this->remaining, this->start);
+    this->holding = true;
+}
+
+void ScheduledTransfer::endChunk(size_t moved) {
+    this->remaining -= moved < this->remaining ? moved : this->remaining;
+}
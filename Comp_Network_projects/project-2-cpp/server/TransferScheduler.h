@@ -0,0 +1,96 @@
+#ifndef TRANSFER_SCHEDULER_H
+#define TRANSFER_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+
+// bytes of priority a waiting transfer gains per millisecond since it started
+#define SRPT_AGING_BYTES_PER_MS (8 * 1024)
+// turns when --srpt-slots is not given: the CPU count, but at least this many
+#define SRPT_MIN_SLOTS 4
+
+/*
+TransferScheduler
+-----------------
+
+    Shortest-remaining-first ordering of file bodies across connections.
+    Every put/get/getr body is a `ScheduledTransfer` that knows how many
+    bytes are left (the put header's fileSize, the size computed for a get).
+    Before moving each buffer-sized chunk the transfer waits until its
+    socket is ready (so a slow peer never holds a turn while it blocks) and
+    then asks for one of `slots` turns. A transfer keeps its turn from
+    chunk to chunk while its socket stays ready and no waiter ranks ahead
+    of it. When more transfers are ready than there are slots, a freed
+    turn goes to the one with the smallest
+
+        remaining - SRPT_AGING_BYTES_PER_MS * msSinceTheTransferStarted
+
+    so small requests overtake bulk ones, and a large transfer that keeps
+    losing gains priority until it wins (anti-starvation aging).
+
+    With enough free slots a turn is granted without waiting, so the
+    scheduler only changes anything when transfers contend. `slots` 0
+    disables it (every turn is granted immediately).
+*/
+
+class TransferScheduler {
+    private:
+        struct Waiter {
+            uint64_t remaining;
+            std::chrono::steady_clock::time_point start;
+            bool granted;
+            std::condition_variable cv;
+        };
+
+        std::mutex mtx;
+        std::list<Waiter *> waiters;
+        unsigned slots;
+        unsigned active;
+
+    public:
+        std::atomic<unsigned long> turns;
+        std::atomic<unsigned long> queuedTurns;     // turns that had to wait for a slot
+        std::atomic<unsigned long> agedTurns;       // granted to a waiter that was not the shortest
+        std::atomic<unsigned long> maxWaiters;
+
+        TransferScheduler();
+        void setSlots(unsigned slots);
+        unsigned slotCount() const { return this->slots; }
+        void acquire(uint64_t remaining, std::chrono::steady_clock::time_point start);
+        bool keep(uint64_t remaining, std::chrono::steady_clock::time_point start);
+        void release();
+        // "srpt.* value" lines for the stats command
+        std::string statsText();
+};
+
+/*
+ScheduledTransfer
+-----------------
+    One body moving through the scheduler. Call `beginChunk` before and
+    `endChunk` after every chunk; `readySock` is polled for `events` first
+    (-1 skips the poll, e.g. for shared-memory bodies). The turn is held
+    across chunks and released when the transfer is destroyed.
+*/
+class ScheduledTransfer {
+    private:
+        TransferScheduler &sched;
+        uint64_t remaining;
+        std::chrono::steady_clock::time_point start;
+        int readySock;
+        short events;
+        bool holding;
+
+    public:
+        ScheduledTransfer(TransferScheduler &sched, uint64_t size, int readySock, short events);
+        ~ScheduledTransfer();
+        void beginChunk();
+        void endChunk(size_t moved);
+};
+
+#endif // TRANSFER_SCHEDULER_H
@@ -0,0 +1,140 @@
+/*
+migrate_storage
+---------------
+
+    Converts an existing `server_storage/` tree between the flat layout and
+    the hashed fan-out layout (see common/PathUtil.h). Run it with the server
+    stopped, then start the server with the matching `--layout`.
+
+Usage:
+    ./migrate.out [--to fanout|flat] [-n] [root]
+
+      --to fanout   (default) move every file to ab/cd/<escaped logical path>
+      --to flat     move fan-out files back to <logical path>
+      -n            dry run: print the moves without touching the tree
+      root          storage directory (default server_storage)
+
+    Every move is a rename() inside the same directory tree, so no file data
+    is copied. Files that are already in the target layout and `.part`
+    leftovers of interrupted uploads are skipped; directories the moves
+    left empty are removed (directories that were empty before are kept).
+    Moving to fanout fails for a path whose escaped name exceeds
+    STORAGE_NAME_MAX; the server would refuse that path in fanout mode.
+*/
+
+#include "../common/PathUtil.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+// True if `rel` (relative to the root) is a fan-out location ab/cd/<name>
+// whose bucket matches the hash of the logical path encoded in <name>.
+static bool isFanoutLocation(const std::string &rel, std::string &logicalOut) {
+    if (rel.size() < 7 || rel[2] != '/' || rel[5] != '/') return false;
+    std::string name = rel.substr(6);
+    if (name.find('/') != std::string::npos) return false;
+    if (!unescapeFanoutName(name, logicalOut)) return false;
+    std::string expect = storagePathFor(logicalOut, LAYOUT_FANOUT);
+    return expect.compare(expect.size() - rel.size(), rel.size(), rel) == 0;
+}
+
+static std::string toRoot(const std::string &root, const std::string &storagePath) {
+    // storagePathFor() builds paths under STORAGE_ROOT; re-anchor them on root
+    return root + storagePath.substr(strlen(STORAGE_ROOT));
+}
+
+int main(int argc, char* argv[]) {
+    StorageLayout target = LAYOUT_FANOUT;
+    bool dryRun = false;
+    std::string root = STORAGE_ROOT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            std::string t = argv[++i];
+            if (t == "fanout") target = LAYOUT_FANOUT;
+            else if (t == "flat") target = LAYOUT_FLAT;
+            else {
+                std::cerr << "unknown layout: " << t << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            dryRun = true;
+        } else if (argv[i][0] != '-') {
+            root = argv[i];
+        } else {
+            std::cerr << "usage: migrate.out [--to fanout|flat] [-n] [root]" << std::endl;
+            return 1;
+        }
+    }
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    // Scan group: collect moves first so renames never disturb the iteration
+    std::vector<std::pair<std::string, std::string>> moves;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file()) continue;
+        std::string rel = fs::relative(it->path(), root).generic_string();
+        if (rel.size() > 5 && rel.compare(rel.size() - 5, 5, ".part") == 0) continue;
+
+        std::string logical;
+        bool fanned = isFanoutLocation(rel, logical);
+        if (!fanned) logical = rel;
+        if (target == LAYOUT_FANOUT && fanned) continue;
+        if (target == LAYOUT_FLAT && !fanned) continue;
+
+        std::string dest = toRoot(root, storagePathFor(logical, target));
+        moves.emplace_back(it->path().string(), dest);
+    }
+    if (ec) {
+        std::cerr << "migrate: cannot scan " << root << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    // Move group
+    size_t moved = 0, failed = 0;
+    std::set<std::string> vacated;
+    for (const auto &m : moves) {
+        if (dryRun) {
+            std::cout << m.first << " -> " << m.second << std::endl;
+            continue;
+        }
+        if (fs::exists(m.second, ec)) {
+            std::cerr << "migrate: skipping " << m.first << ", " << m.second << " already exists" << std::endl;
+            failed++;
+            continue;
+        }
+        if (target == LAYOUT_FANOUT && fs::path(m.second).filename().string().size() > STORAGE_NAME_MAX) {
+            std::cerr << "migrate: skipping " << m.first << ", name too long for the fanout layout" << std::endl;
+            failed++;
+            continue;
+        }
+        if (!ensureParentDirs(m.second) || std::rename(m.first.c_str(), m.second.c_str()) != 0) {
+            perror(("migrate: " + m.first).c_str());
+            failed++;
+            continue;
+        }
+        moved++;
+        vacated.insert(fs::path(m.first).parent_path().string());
+    }
+
+    // Cleanup group: drop directories emptied by the moves, deepest first,
+    // climbing while a parent is left empty too; never the root itself
+    std::vector<std::string> dirs(vacated.begin(), vacated.end());
+    std::sort(dirs.begin(), dirs.end(), [](const std::string &a, const std::string &b) { return a.size() > b.size(); });
+    for (const std::string &start : dirs) {
+        for (fs::path d = start; d.string().size() > root.size(); d = d.parent_path()) {
+            if (!fs::is_empty(d, ec) || ec || !fs::remove(d, ec)) break;
+        }
+    }
+
+    std::cout << (dryRun ? "would move " : "moved ") << (dryRun ? moves.size() : moved)
+              << " file(s) to the " << (target == LAYOUT_FANOUT ? "fanout" : "flat")
+              << " layout" << (failed ? ", " + std::to_string(failed) + " failed" : "") << std::endl;
+    return failed ? 2 : 0;
+}
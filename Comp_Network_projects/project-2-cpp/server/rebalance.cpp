@@ -0,0 +1,165 @@
+/*
+rebalance
+---------
+
+    Moves the files a cluster node no longer owns to their new owner after
+    the cluster file changed (a node was added or removed). Because the ring
+    is consistent (common/HashRing.h), only the paths in the affected ranges
+    move; everything else stays where it is.
+
+Usage:
+    ./rebalance.out --cluster <new file> --self <host:port> [--layout flat|fanout] [-n] [root]
+
+      --cluster   the new cluster file, as the servers will be started with it
+      --self      this node's entry (it may be absent from the new file when
+                  the node is being removed: then every file moves)
+      --layout    storage layout of root (default flat)
+      -n          dry run: print what would move where
+      root        storage directory of this node (default server_storage)
+
+    Each file is uploaded to its owner with a normal put (straight to the
+    owner's port, not through the proxy) and removed locally only after the
+    owner answered OK. Start the new node first, run this on every old node,
+    then restart the old nodes with the new cluster file.
+*/
+
+#include "../common/HashRing.h"
+#include "../common/NetIO.h"
+#include "../common/PathUtil.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static int connectTo(const std::string &node) {
+    std::string host;
+    int port;
+    if (!splitHostPort(node, host, port)) return -1;
+    struct hostent *hp = gethostbyname(host.c_str());
+    if (!hp) return -1;
+    struct sockaddr_in sin;
+    bzero((char *)&sin, sizeof(sin));
+    sin.sin_family = AF_INET;
+    bcopy(hp->h_addr, (char *)&sin.sin_addr, hp->h_length);
+    sin.sin_port = htons(port);
+    int s = socket(PF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// put <pathLen> <size>\n<path><bytes>, then expect OK
+static bool pushFile(int s, const std::string &logical, const std::string &local) {
+    std::ifstream in(local, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    size_t size = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    std::string header = "put " + std::to_string(logical.size()) + " " + std::to_string(size) + "\n";
+    if (!sendAll(s, header.data(), header.size()) || !sendAll(s, logical.data(), logical.size())) return false;
+    std::vector<char> buffer(64 * 1024);
+    size_t remaining = size;
+    while (remaining > 0) {
+        in.read(buffer.data(), static_cast<std::streamsize>(std::min(remaining, buffer.size())));
+        std::streamsize got = in.gcount();
+        if (got <= 0 || !sendAll(s, buffer.data(), static_cast<size_t>(got))) return false;
+        remaining -= static_cast<size_t>(got);
+    }
+    std::string resp;
+    if (!recvLine(s, resp)) return false;
+    if (resp.rfind("OK", 0) != 0) {
+        std::cerr << "rebalance: " << logical << ": " << resp << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    std::string clusterFile, self, root = STORAGE_ROOT;
+    StorageLayout layout = LAYOUT_FLAT;
+    bool dryRun = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc) clusterFile = argv[++i];
+        else if (strcmp(argv[i], "--self") == 0 && i + 1 < argc) self = argv[++i];
+        else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) layout = strcmp(argv[++i], "fanout") == 0 ? LAYOUT_FANOUT : LAYOUT_FLAT;
+        else if (strcmp(argv[i], "-n") == 0) dryRun = true;
+        else if (argv[i][0] != '-') root = argv[i];
+        else {
+            clusterFile.clear();
+            break;
+        }
+    }
+    if (clusterFile.empty() || self.empty()) {
+        std::cerr << "usage: rebalance.out --cluster file --self host:port [--layout flat|fanout] [-n] [root]" << std::endl;
+        return 1;
+    }
+    HashRing ring;
+    if (!loadClusterConfig(clusterFile, ring)) {
+        std::cerr << "rebalance: cannot load cluster file: " << clusterFile << std::endl;
+        return 1;
+    }
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    // Scan group: files whose owner in the new ring is someone else
+    std::vector<std::pair<std::string, std::string>> moves;    // (logical, local path)
+    size_t kept = 0;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file()) continue;
+        std::string rel = fs::relative(it->path(), root).generic_string();
+        if (rel.size() > 5 && rel.compare(rel.size() - 5, 5, ".part") == 0) continue;
+        std::string logical = rel;
+        if (layout == LAYOUT_FANOUT && (rel.size() < 7 || !unescapeFanoutName(rel.substr(6), logical))) continue;
+        if (ring.owner(logical) == self) {
+            kept++;
+            continue;
+        }
+        moves.emplace_back(logical, it->path().string());
+    }
+    if (ec) {
+        std::cerr << "rebalance: cannot scan " << root << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    // Move group: one connection per new owner
+    std::map<std::string, int> socks;
+    size_t moved = 0, failed = 0;
+    for (const auto &m : moves) {
+        const std::string &owner = ring.owner(m.first);
+        if (dryRun) {
+            std::cout << m.first << " -> " << owner << std::endl;
+            continue;
+        }
+        auto s = socks.find(owner);
+        if (s == socks.end()) s = socks.emplace(owner, connectTo(owner)).first;
+        if (s->second < 0 || !pushFile(s->second, m.first, m.second)) {
+            std::cerr << "rebalance: failed to move " << m.first << " to " << owner << std::endl;
+            failed++;
+            continue;
+        }
+        unlink(m.second.c_str());
+        moved++;
+    }
+    for (auto &s : socks) {
+        if (s.second >= 0) close(s.second);
+    }
+
+    std::cout << (dryRun ? "would move " : "moved ") << (dryRun ? moves.size() : moved)
+              << " file(s), " << kept << " stay on " << self
+              << (failed ? ", " + std::to_string(failed) + " failed" : "") << std::endl;
+    return failed ? 2 : 0;
+}
@@ -6,210 +6,1558 @@
 #include <fstream>
 #include <errno.h>
 #include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <random>
+
+Server::Server(int argc, char* argv[]) : contentIndex(metaCache, tiers) {
+    this->port = SERVER_PORT;
+    this->listenSocket = -1;
+    this->localPath = LOCAL_SOCKET_PATH;
+    this->localListenSocket = -1;
+    this->upgradePath = UPGRADE_SOCKET_PATH;
+    this->upgradeListenSocket = -1;
+    this->handoffSocket = -1;
+    this->takeover = false;
+    this->idleHandoff = true;
+    this->useInotify = false;
+    this->usePrefetch = true;
+    this->draining = false;
+    this->activeConnections = 0;
+    this->scheduler.setSlots(std::max<unsigned>(SRPT_MIN_SLOTS, std::thread::hardware_concurrency()));
+
+    // Option parsing group
+    static struct option longOpts[] = {
+        {"takeover", no_argument, nullptr, 'T'},
+        {"no-idle-handoff", no_argument, nullptr, 'I'},
+        {"layout", required_argument, nullptr, 'L'},
+        {"inotify", no_argument, nullptr, 'N'},
+        {"no-prefetch", no_argument, nullptr, 'P'},
+        {"cluster", required_argument, nullptr, 'C'},
+        {"self", required_argument, nullptr, 'S'},
+        {"next", required_argument, nullptr, 'X'},
+        {"hugepages", no_argument, nullptr, 'H'},
+        {"srpt-slots", required_argument, nullptr, 'R'},
+        {"hot-tier", required_argument, nullptr, 't'},
+        {"hot-tier-mb", required_argument, nullptr, 'm'},
+        {"affinity", no_argument, nullptr, 'A'},
+        {"trace", required_argument, nullptr, 'D'},
+        {"udp-impair", required_argument, nullptr, 'U'},
+        {nullptr, 0, nullptr, 0}
+    };
+    std::string clusterFile;
+    std::string hotTier;
+    size_t hotTierMb = TIER_DEFAULT_CAPACITY_MB;
+    int c;
+    while ((c = getopt_long(argc, argv, "p:l:u:", longOpts, nullptr)) != -1) {
+        switch (c) {
+            case 'p': this->port = atoi(optarg); break;
+            case 'l': this->localPath = optarg; break;
+            case 'u': this->upgradePath = optarg; break;
+            case 'T': this->takeover = true; break;
+            case 'I': this->idleHandoff = false; break;
+            case 'N': this->useInotify = true; break;
+            case 'P': this->usePrefetch = false; break;
+            case 'C': clusterFile = optarg; break;
+            case 'S': this->selfNode = optarg; break;
+            case 'X': this->nextNode = optarg; break;
+            case 'H': BufferPool::instance().useHugePages(true); break;
+            case 'R': this->scheduler.setSlots(static_cast<unsigned>(atoi(optarg))); break;
+            case 't': hotTier = optarg; break;
+            case 'm': hotTierMb = static_cast<size_t>(atol(optarg)); break;
+            case 'A':
+                if (!Affinity::instance().enable()) std::cerr << "affinity: no usable CPUs found, workers stay unpinned" << std::endl;
+                break;
+            case 'D':
+                if (!Trace::enable(optarg, "server")) std::cerr << "trace: cannot enable tracing" << std::endl;
+                break;
+            case 'U':
+                if (!UdpChannel::impair(optarg)) {
+                    std::cerr << "bad --udp-impair spec: " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'L':
+                if (strcmp(optarg, "fanout") == 0) setStorageLayout(LAYOUT_FANOUT);
+                else if (strcmp(optarg, "flat") == 0) setStorageLayout(LAYOUT_FLAT);
+                else {
+                    std::cerr << "unknown storage layout: " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+            default:
+                std::cerr << "usage: server [-p port] [-l local_socket] [-u upgrade_socket] [--takeover] [--no-idle-handoff] [--layout flat|fanout] [--next host:port] [--cluster file [--self host:port]] [--no-prefetch] [--inotify] [--hugepages] [--srpt-slots n] [--hot-tier dir [--hot-tier-mb n]] [--affinity] [--trace file] [--udp-impair spec]" << std::endl;
+                exit(1);
+        }
+    }
+
+    if (!hotTier.empty()) this->tiers.configure(hotTier, hotTierMb << 20);
+
+    std::string nextHost;
+    int nextPort;
+    if (!this->nextNode.empty() && !splitHostPort(this->nextNode, nextHost, nextPort)) {
+        std::cerr << "bad --next address: " << this->nextNode << std::endl;
+        exit(1);
+    }
+
+    // Cluster group: this node must be one of the ring members
+    if (!clusterFile.empty()) {
+        if (this->selfNode.empty()) this->selfNode = "localhost:" + std::to_string(this->port);
+        if (!loadClusterConfig(clusterFile, this->ring)) {
+            std::cerr << "cannot load cluster file: " << clusterFile << std::endl;
+            exit(1);
+        }
+        if (!this->ring.contains(this->selfNode)) {
+            std::cerr << "--self " << this->selfNode << " is not in " << clusterFile << std::endl;
+            exit(1);
+        }
+    }
 
-Server::Server() {
     bzero((char *)&this->sin, sizeof(this->sin));
     this->sin.sin_family = AF_INET;
     this->sin.sin_addr.s_addr = INADDR_ANY;
-    this->sin.sin_port = htons(SERVER_PORT);
-    this->addrLen = sizeof(this->sin);
-    this->listenSocket = -1;
-    this->clientSocket = -1;
-    this->bytesReceived = 0;
-
+    this->sin.sin_port = htons(this->port);
 }
 
 Server::~Server() {
-    if (this->clientSocket >= 0) {
-        close(this->clientSocket);
-    }
     if (this->listenSocket >= 0) {
         close(this->listenSocket);
     }
+    if (this->localListenSocket >= 0) {
+        close(this->localListenSocket);
+    }
+    if (this->upgradeListenSocket >= 0) {
+        close(this->upgradeListenSocket);
+    }
+    if (this->handoffSocket >= 0) {
+        close(this->handoffSocket);
+    }
 }
 
-// Command registration: binds protocol verbs to member implementations
-void Server::registerCommands() {
-    this->commandHandler.registerCommand("put", [this](int argc, char* argv[]) {
-        this->builtin_put(argc, argv);
+// Command registration: binds protocol verbs to member implementations for one connection
+void Server::registerCommands(CommandHandler &handler, Connection &conn) {
+    handler.registerCommand("put", [this, &conn](int argc, char* argv[]) {
+        this->builtin_put(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("get", [this, &conn](int argc, char* argv[]) {
+        this->builtin_get(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("get-if-changed", [this, &conn](int argc, char* argv[]) {
+        this->builtin_get_if_changed(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("getr", [this, &conn](int argc, char* argv[]) {
+        this->builtin_get_range(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("sput", [this, &conn](int argc, char* argv[]) {
+        this->builtin_sparse_put(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("sget", [this, &conn](int argc, char* argv[]) {
+        this->builtin_sparse_get(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("copy", [this, &conn](int argc, char* argv[]) {
+        this->builtin_copy(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("move", [this, &conn](int argc, char* argv[]) {
+        this->builtin_move(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("append", [this, &conn](int argc, char* argv[]) {
+        this->builtin_append(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("append-stream", [this, &conn](int argc, char* argv[]) {
+        this->builtin_append_stream(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("watch", [this, &conn](int argc, char* argv[]) {
+        this->builtin_watch(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("shm", [this, &conn](int argc, char* argv[]) {
+        this->builtin_shm(conn, argc, argv);
         return 0;
     });
-    this->commandHandler.registerCommand("get", [this](int argc, char* argv[]) {
-        this->builtin_get(argc, argv);
+    handler.registerCommand("mux", [this, &conn](int argc, char* argv[]) {
+        this->builtin_mux(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("hput", [this, &conn](int argc, char* argv[]) {
+        this->builtin_hash_put(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("uput", [this, &conn](int argc, char* argv[]) {
+        this->builtin_udp_put(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("uget", [this, &conn](int argc, char* argv[]) {
+        this->builtin_udp_get(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("bench-send", [this, &conn](int argc, char* argv[]) {
+        this->builtin_bench_send(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("bench-recv", [this, &conn](int argc, char* argv[]) {
+        this->builtin_bench_recv(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("stat", [this, &conn](int argc, char* argv[]) {
+        this->builtin_stat(conn, argc, argv);
+        return 0;
+    });
+    handler.registerCommand("stats", [this, &conn](int argc, char* argv[]) {
+        this->builtin_stats(conn, argc, argv);
         return 0;
     });
 }
 
-void Server::builtin_put(int argc, char* argv[]) {
+// reply for a path sanitizePath refused
+static std::string badPathReply(const std::string &requested) {
+    return pathTooLong(requested) ? "ERR 414 path_too_long\n" : "ERR 403 bad_path\n";
+}
+
+void Server::builtin_put(Connection &conn, int argc, char* argv[]) {
     std::cout << "builtin_put" << std::endl;
     // Header parsing group: extract pathLen and fileSize
-    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     char* end1 = nullptr; char* end2 = nullptr;
     unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
     unsigned long fileSizeUl = std::strtoul(argv[2], &end2, 10);
     if (!argv[1] || !argv[2] || *end1 != '\0' || *end2 != '\0' || pathLenUl == 0UL) {
-        std::string err = "ERR 400 bad_header\n"; sendAll(this->clientSocket, err.data(), err.size()); return;
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
     }
     size_t pathLen = static_cast<size_t>(pathLenUl);
     size_t fileSize = static_cast<size_t>(fileSizeUl);
 
     // Path group: read and sanitize the path bytes
     std::string path(pathLen, '\0');
-    if (!recvExact(this->clientSocket, path.data(), pathLen)) { std::string err = "ERR 400 bad_path\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!recvExact(conn.sock, path.data(), pathLen)) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     std::string safePath;
-    if (!sanitizePath(path, safePath)) { std::string err = "ERR 403 bad_path\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ring.empty() && this->ring.owner(path) != this->selfNode) {
+        if (this->discardBody(conn, fileSize)) this->ownsPath(conn, path);
+        return;
+    }
+    this->receivePut(conn, path, safePath, fileSize, "");
+}
+
+// Body and reply of a put whose header and path were accepted. With
+// expectSha the received bytes must hash to it (hput) and the checksum goes
+// straight into the content index; otherwise the file is queued for hashing.
+void Server::receivePut(Connection &conn, const std::string& path, const std::string& safePath, size_t fileSize,
+                        const std::string& expectSha) {
+    size_t pathLen = path.size();
+
+    // Replication group: start the same put on the next replica
+    int replica = -1;
+    if (!this->nextNode.empty()) {
+        std::string header = std::string("put ") + std::to_string(pathLen) + " " + std::to_string(fileSize) + "\n";
+        replica = this->replicaFor(conn);
+        if (replica < 0 || !sendAll(replica, header.data(), header.size()) || !sendAll(replica, path.data(), path.size())) {
+            this->dropReplica(conn);
+            if (this->discardBody(conn, fileSize)) { std::string err = "ERR 502 replica_failed\n"; sendAll(conn.sock, err.data(), err.size()); }
+            return;
+        }
+    }
 
-    // File transfer group: stream fileSize bytes to disk
-    if (!writeFileFromSocket(this->clientSocket, safePath, fileSize)) { std::string err = "ERR 500 write_failed\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    // File transfer group: stream fileSize bytes to the hot tier or disk (and down the chain)
+    bool mismatch = false;
+    if (!writeFileFromSocket(conn, this->tiers.placeForWrite(safePath, fileSize), fileSize, replica, expectSha, &mismatch)) {
+        std::string err = mismatch ? "ERR 422 hash_mismatch\n"
+                        : replica >= 0 && conn.replicaSock < 0 ? "ERR 502 replica_failed\n" : "ERR 500 write_failed\n";
+        sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    if (expectSha.empty()) this->contentIndex.note(safePath);
+    else this->contentIndex.add(expectSha, safePath);
+    this->notifyHub.publish(path, fileSize);
     std::string ok = "OK\n";
-    sendAll(this->clientSocket, ok.data(), ok.size());
+    sendAll(conn.sock, ok.data(), ok.size());
 }
 
-void Server::builtin_get(int argc, char* argv[]) {
+void Server::builtin_hash_put(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_hash_put" << std::endl;
+    // Header parsing group: extract pathLen, fileSize and the SHA-256 of the content
+    if (argc < 4) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long long fileSizeUll = std::strtoull(argv[2], &end2, 10);
+    std::string sha = argv[3];
+    if (*end1 != '\0' || *end2 != '\0' || pathLenUl == 0UL || sha.size() != 64 ||
+        sha.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    size_t fileSize = static_cast<size_t>(fileSizeUll);
+
+    // Path group: nothing but the header has been sent yet, so errors need no draining
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // Dedup group: known content is copied locally (a reflink where the
+    // filesystem can) and the client never sends the body. Replicas might
+    // not have the source, so a chain always takes the upload.
+    std::string srcPath;
+    if (this->nextNode.empty() && this->contentIndex.find(sha, fileSize, srcPath)) {
+        bool ok = srcPath == safePath;
+        if (!ok) {
+            TierWrite writing(this->tiers, safePath);
+            ok = writing.ok() && copyFileLocal(this->tiers.locate(srcPath), safePath);
+        }
+        if (ok) {
+            std::cout << "hash put: " << path << " deduplicated from " << srcPath << std::endl;
+            this->contentIndex.add(sha, safePath);
+            this->notifyHub.publish(path, fileSize);
+            std::string okLine = "OK\n";
+            sendAll(conn.sock, okLine.data(), okLine.size());
+            return;
+        }
+    }
+
+    // Upload group: ask for the body, then finish like a put
+    std::string send = "SEND\n";
+    if (!sendAll(conn.sock, send.data(), send.size())) return;
+    this->receivePut(conn, path, safePath, fileSize, this->nextNode.empty() ? sha : std::string());
+}
+
+void Server::builtin_get(Connection &conn, int argc, char* argv[]) {
     std::cout << "builtin_get" << std::endl;
     // Header parsing group: extract pathLen
-    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     char* end = nullptr;
     unsigned long pathLenUl = std::strtoul(argv[1], &end, 10);
-    if (!argv[1] || *end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!argv[1] || *end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     size_t pathLen = static_cast<size_t>(pathLenUl);
 
     // Path group: read and sanitize the path bytes
     std::string path(pathLen, '\0');
-    if (!recvExact(this->clientSocket, path.data(), pathLen)) { std::string err = "ERR 400 bad_path\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!recvExact(conn.sock, path.data(), pathLen)) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     std::string safePath;
-    if (!sanitizePath(path, safePath)) { std::string err = "ERR 403 bad_path\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
 
-    // File lookup and transfer group
+    // File lookup and transfer group: whichever tier holds the current copy
+    TierRead copy(this->tiers, safePath);
     size_t fileSize = 0;
-    if (!computeFileSize(safePath, fileSize)) { std::string err = "ERR 404 not_found\n"; sendAll(this->clientSocket, err.data(), err.size()); return; }
+    if (!computeFileSize(copy.path(), fileSize)) { std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return; }
     std::string ok = std::string("OK ") + std::to_string(fileSize) + "\n";
-    if (!sendAll(this->clientSocket, ok.data(), ok.size())) return;
-    if (!sendFileToSocket(this->clientSocket, safePath)) return;
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+    if (!sendFileToSocket(conn, copy.path(), fileSize)) return;
+}
+
+void Server::builtin_get_if_changed(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_get_if_changed" << std::endl;
+    // Header parsing group: extract pathLen and the client's ETag ("-" for none)
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end, 10);
+    if (*end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string etag = argv[2];
+
+    // Path group: read and sanitize the path bytes
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // Validation group: the current checksum is the ETag; a match sends no
+    // body. Without a cached copy (`-`) nothing is compared, so a checksum
+    // that is not known yet is not worth a full read before the first byte:
+    // the reply carries `-` and the background hasher catches up
+    TierRead copy(this->tiers, safePath);
+    FileMeta meta;
+    bool revalidate = etag != "-";
+    if (!this->metaCache.lookup(copy.path(), meta, revalidate)) { std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (meta.sha256.empty()) {
+        this->contentIndex.note(safePath);
+    } else {
+        this->contentIndex.add(meta.sha256, safePath);
+    }
+    if (revalidate && etag == meta.sha256) {
+        std::string notModified = "NOT_MODIFIED\n";
+        sendAll(conn.sock, notModified.data(), notModified.size());
+        return;
+    }
+    std::string ok = std::string("OK ") + std::to_string(meta.size) + " " + (meta.sha256.empty() ? "-" : meta.sha256) + "\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+    if (!sendFileToSocket(conn, copy.path(), meta.size)) return;
+}
+
+void Server::builtin_get_range(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_get_range" << std::endl;
+    // Header parsing group: extract pathLen, offset and length
+    if (argc < 4) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr; char* end3 = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long long offsetUll = std::strtoull(argv[2], &end2, 10);
+    unsigned long long lengthUll = std::strtoull(argv[3], &end3, 10);
+    if (*end1 != '\0' || *end2 != '\0' || *end3 != '\0' || pathLenUl == 0UL) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    size_t pathLen = static_cast<size_t>(pathLenUl);
+
+    // Path group: read and sanitize the path bytes
+    std::string path(pathLen, '\0');
+    if (!recvExact(conn.sock, path.data(), pathLen)) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // Range group: clip to the end of the file and send just those bytes
+    TierRead copy(this->tiers, safePath);
+    size_t fileSize = 0;
+    if (!computeFileSize(copy.path(), fileSize)) { std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (offsetUll > fileSize) { std::string err = "ERR 416 bad_range\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    size_t offset = static_cast<size_t>(offsetUll);
+    size_t length = std::min(static_cast<size_t>(lengthUll), fileSize - offset);
+    std::string ok = std::string("OK ") + std::to_string(length) + " " + std::to_string(fileSize) + "\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+    if (!sendFileRangeToSocket(conn, copy.path(), offset, length)) return;
+}
+
+void Server::builtin_sparse_put(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_sparse_put" << std::endl;
+    auto recvBody = [&conn](void *buf, size_t len) { return conn.recvBody(buf, len); };
+    // Header parsing group: extract pathLen and fileSize
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long long fileSizeUll = std::strtoull(argv[2], &end2, 10);
+    if (*end1 != '\0' || *end2 != '\0' || pathLenUl == 0UL) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    size_t fileSize = static_cast<size_t>(fileSizeUll);
+
+    // Path group: read and sanitize the path bytes; a rejected upload still
+    // has its extents drained so the connection stays usable
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    bool diskOk;
+    std::string reject;
+    if (!sanitizePath(path, safePath)) reject = badPathReply(path);
+    else if (!this->nextNode.empty()) reject = "ERR 501 not_replicated\n";
+    else if (!this->ring.empty() && this->ring.owner(path) != this->selfNode) reject = "ERR 421 misdirected " + this->ring.owner(path) + "\n";
+    if (!reject.empty()) {
+        if (recvSparseExtents(conn.sock, recvBody, -1, fileSize, diskOk)) sendAll(conn.sock, reject.data(), reject.size());
+        return;
+    }
+    Trace::stage("path_sanitized", path);
+
+    // File group: a fresh .part file of the full size is all hole until the
+    // data extents are written into it (always on disk, the hot tier does not keep holes)
+    TierWrite writing(this->tiers, safePath);
+    if (!writing.ok()) {
+        std::string err = "ERR 500 tier_busy\n";
+        if (recvSparseExtents(conn.sock, recvBody, -1, fileSize, diskOk)) sendAll(conn.sock, err.data(), err.size());
+        return;
+    }
+    std::string tmpPath = tempPathFor(safePath);
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && ensureParentDirs(tmpPath)) fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && ftruncate(fd, static_cast<off_t>(fileSize)) == 0;
+    size_t written = 0;
+    if (!recvSparseExtents(conn.sock, recvBody, ok ? fd : -1, fileSize, diskOk, &written)) {
+        if (fd >= 0) { close(fd); unlink(tmpPath.c_str()); }
+        return;
+    }
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (ok && diskOk && this->tiers.commit(tmpPath, safePath)) {
+        std::cout << "sparse put: " << written << " of " << fileSize << " bytes were data" << std::endl;
+        this->contentIndex.note(safePath);
+        this->notifyHub.publish(path, fileSize);
+        std::string okLine = "OK\n";
+        sendAll(conn.sock, okLine.data(), okLine.size());
+        return;
+    }
+    if (fd >= 0) unlink(tmpPath.c_str());
+    std::string err = "ERR 500 write_failed\n"; sendAll(conn.sock, err.data(), err.size());
+}
+
+void Server::builtin_sparse_get(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_sparse_get" << std::endl;
+    // Header parsing group: extract pathLen
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end, 10);
+    if (*end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Path group: read and sanitize the path bytes
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // Transfer group: OK <size>, then only the data extents
+    TierRead copy(this->tiers, safePath);
+    int fd = open(copy.path().c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    std::string ok = std::string("OK ") + std::to_string(st.st_size) + "\n";
+    size_t sent = 0;
+    if (sendAll(conn.sock, ok.data(), ok.size()) &&
+        sendSparseExtents(fd, static_cast<size_t>(st.st_size), conn.sock,
+                          [&conn](const void *buf, size_t len) { return conn.sendBody(buf, len); }, &sent)) {
+        std::cout << "sparse get: " << sent << " of " << st.st_size << " bytes were data" << std::endl;
+    }
+    close(fd);
+}
+
+void Server::builtin_udp_put(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_udp_put" << std::endl;
+    // Header parsing group: extract pathLen and fileSize
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long long fileSizeUll = std::strtoull(argv[2], &end2, 10);
+    if (*end1 != '\0' || *end2 != '\0' || pathLenUl == 0UL) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    size_t fileSize = static_cast<size_t>(fileSizeUll);
+
+    // Path group: the body is not on this connection, so errors need no draining
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    if (!this->nextNode.empty()) { std::string err = "ERR 501 not_replicated\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // File group: blocks arrive out of order, so they are pwritten into a
+    // .part file of the full size (always on disk, like sput)
+    TierWrite writing(this->tiers, safePath);
+    if (!writing.ok()) { std::string err = "ERR 500 tier_busy\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string tmpPath = tempPathFor(safePath);
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && ensureParentDirs(tmpPath)) fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(fileSize)) != 0) {
+        if (fd >= 0) { close(fd); unlink(tmpPath.c_str()); }
+        std::string err = "ERR 500 write_failed\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    Trace::stage("file_opened");
+
+    // Channel group: port and session to the client, then the datagrams
+    int udpPort = 0;
+    int udpSock = UdpChannel::bindAny(udpPort);
+    if (udpSock < 0) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        std::string err = "ERR 503 udp_unavailable\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    uint32_t session = static_cast<uint32_t>(std::random_device{}());
+    UdpChannel channel(udpSock, session, false);
+    std::string reply = "OK " + std::to_string(udpPort) + " " + std::to_string(session) + "\n";
+    if (!sendAll(conn.sock, reply.data(), reply.size())) { close(fd); unlink(tmpPath.c_str()); return; }
+    UdpTransferStats stats;
+    std::string error;
+    bool ok = udpReceiveFile(channel, fd, fileSize, conn.sock, stats, error);
+    Trace::stage("last_byte");
+    if (close(fd) != 0 && ok) { ok = false; error = "write_failed"; }
+    if (ok && this->tiers.commit(tmpPath, safePath)) {
+        std::cout << "udp put: " << path << " " << stats.describe() << std::endl;
+        this->contentIndex.note(safePath);
+        this->notifyHub.publish(path, fileSize);
+        std::string okLine = "OK\n";
+        sendAll(conn.sock, okLine.data(), okLine.size());
+        return;
+    }
+    unlink(tmpPath.c_str());
+    std::string err = "ERR " + std::string(error == "udp_timeout" ? "504 " : error == "aborted" ? "499 " : "500 ") +
+                      (error.empty() ? "write_failed" : error) + "\n";
+    sendAll(conn.sock, err.data(), err.size());
+}
+
+void Server::builtin_udp_get(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_udp_get" << std::endl;
+    // Header parsing group: extract pathLen
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end, 10);
+    if (*end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Path group: read and sanitize the path bytes
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+
+    // File group: whichever tier holds the current copy, read with pread
+    TierRead copy(this->tiers, safePath);
+    int fd = open(copy.path().c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    Trace::stage("file_opened");
+
+    // Channel group: size, port and session to the client, then send until its verdict
+    int udpPort = 0;
+    int udpSock = UdpChannel::bindAny(udpPort);
+    if (udpSock < 0) {
+        close(fd);
+        std::string err = "ERR 503 udp_unavailable\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    uint32_t session = static_cast<uint32_t>(std::random_device{}());
+    UdpChannel channel(udpSock, session, false);
+    std::string ok = "OK " + std::to_string(st.st_size) + " " + std::to_string(udpPort) + " " + std::to_string(session) + "\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) { close(fd); return; }
+    UdpTransferStats stats;
+    udpSendFile(channel, fd, static_cast<size_t>(st.st_size), conn.sock, stats);
+    close(fd);
+    Trace::stage("last_byte");
+    std::string verdict;
+    if (!recvLine(conn.sock, verdict)) return;
+    std::cout << "udp get: " << path << " " << verdict << ", " << stats.describe() << std::endl;
+}
+
+// Shared header handling of copy/move: "<verb> <srcLen> <dstLen>\n<src><dst>".
+// Sends the error reply itself and returns false if anything is wrong.
+bool Server::recvPathPair(Connection &conn, int argc, char* argv[], PathPair &out) {
+    // Header parsing group: extract srcLen and dstLen
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return false; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long srcLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long dstLenUl = std::strtoul(argv[2], &end2, 10);
+    if (*end1 != '\0' || *end2 != '\0' || srcLenUl == 0UL || dstLenUl == 0UL) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return false;
+    }
+
+    // Path group: read and sanitize both paths
+    out.src.assign(static_cast<size_t>(srcLenUl), '\0');
+    out.dst.assign(static_cast<size_t>(dstLenUl), '\0');
+    if (!recvExact(conn.sock, out.src.data(), out.src.size()) || !recvExact(conn.sock, out.dst.data(), out.dst.size())) {
+        std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return false;
+    }
+    if (!sanitizePath(out.src, out.srcLocal)) {
+        std::string err = badPathReply(out.src); sendAll(conn.sock, err.data(), err.size()); return false;
+    }
+    if (!sanitizePath(out.dst, out.dstLocal)) {
+        std::string err = badPathReply(out.dst); sendAll(conn.sock, err.data(), err.size()); return false;
+    }
+    if (!this->ownsPath(conn, out.src)) return false;
+    if (!this->ring.empty() && this->ring.owner(out.dst) != this->selfNode) {
+        std::string err = "ERR 409 cross_node\n"; sendAll(conn.sock, err.data(), err.size()); return false;
+    }
+    return true;
+}
+
+// Cluster mode: true if this node owns the path, otherwise redirect the
+// client to the owner with ERR 421. Always true outside cluster mode.
+bool Server::ownsPath(Connection &conn, const std::string& logicalPath) {
+    if (this->ring.empty()) return true;
+    const std::string &owner = this->ring.owner(logicalPath);
+    if (owner == this->selfNode) return true;
+    std::string err = "ERR 421 misdirected " + owner + "\n";
+    sendAll(conn.sock, err.data(), err.size());
+    return false;
+}
+
+// Tell watchers about a change that just completed
+void Server::publishChange(const std::string& logicalPath, const std::string& localPath) {
+    struct stat st;
+    if (stat(localPath.c_str(), &st) == 0) this->notifyHub.publish(logicalPath, static_cast<size_t>(st.st_size));
+}
+
+void Server::builtin_copy(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_copy" << std::endl;
+    PathPair paths;
+    if (!recvPathPair(conn, argc, argv, paths)) return;
+    const std::string &srcPath = paths.srcLocal, &destPath = paths.dstLocal;
+    TierWrite writingSrc(this->tiers, srcPath), writingDst(this->tiers, destPath);
+    if (!writingSrc.ok() || !writingDst.ok()) { std::string err = "ERR 500 tier_busy\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Copy group: the bytes never leave the server
+    struct stat st;
+    if (stat(srcPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) { std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (srcPath == destPath) { std::string ok = "OK\n"; sendAll(conn.sock, ok.data(), ok.size()); return; }
+    if (!this->nextNode.empty() && !this->forwardToReplica(conn, std::string(argv[0]) + " " + argv[1] + " " + argv[2] + "\n", paths.src + paths.dst)) {
+        std::string err = "ERR 502 replica_failed\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    if (!copyFileLocal(srcPath, destPath)) { std::string err = "ERR 500 copy_failed\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    this->contentIndex.note(destPath);
+    this->notifyHub.publish(paths.dst, static_cast<size_t>(st.st_size));
+    std::string ok = "OK\n";
+    sendAll(conn.sock, ok.data(), ok.size());
+}
+
+void Server::builtin_move(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_move" << std::endl;
+    PathPair paths;
+    if (!recvPathPair(conn, argc, argv, paths)) return;
+    const std::string &srcPath = paths.srcLocal, &destPath = paths.dstLocal;
+    TierWrite writingSrc(this->tiers, srcPath), writingDst(this->tiers, destPath);
+    if (!writingSrc.ok() || !writingDst.ok()) { std::string err = "ERR 500 tier_busy\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Rename group: a metadata-only operation inside server_storage/
+    struct stat st;
+    if (stat(srcPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) { std::string err = "ERR 404 not_found\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (!this->nextNode.empty() && !this->forwardToReplica(conn, std::string(argv[0]) + " " + argv[1] + " " + argv[2] + "\n", paths.src + paths.dst)) {
+        std::string err = "ERR 502 replica_failed\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    if (std::rename(srcPath.c_str(), destPath.c_str()) != 0) {
+        // destination directory (or fan-out bucket) may not exist yet
+        if (errno != ENOENT || !ensureParentDirs(destPath) || std::rename(srcPath.c_str(), destPath.c_str()) != 0) {
+            std::string err = "ERR 500 move_failed\n"; sendAll(conn.sock, err.data(), err.size()); return;
+        }
+    }
+    this->contentIndex.note(destPath);
+    this->notifyHub.publish(paths.dst, static_cast<size_t>(st.st_size));
+    std::string ok = "OK\n";
+    sendAll(conn.sock, ok.data(), ok.size());
+}
+
+void Server::builtin_append(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_append" << std::endl;
+    // Header parsing group: extract pathLen and len
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end1, 10);
+    unsigned long lenUl = std::strtoul(argv[2], &end2, 10);
+    if (*end1 != '\0' || *end2 != '\0' || pathLenUl == 0UL) {
+        std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    size_t len = static_cast<size_t>(lenUl);
+
+    // Path group: read and sanitize; on rejection skip the body to stay in sync
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) {
+        if (!this->discardBody(conn, len)) return;
+        std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    Trace::stage("path_sanitized", path);
+    if (!this->ring.empty() && this->ring.owner(path) != this->selfNode) {
+        if (this->discardBody(conn, len)) this->ownsPath(conn, path);
+        return;
+    }
+    TierWrite writing(this->tiers, safePath);
+    if (!writing.ok()) {
+        if (!this->discardBody(conn, len)) return;
+        std::string err = "ERR 500 tier_busy\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    int fd = open(safePath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        if (!this->discardBody(conn, len)) return;
+        std::string err = errno == ENOENT ? "ERR 404 not_found\n" : "ERR 500 write_failed\n";
+        sendAll(conn.sock, err.data(), err.size()); return;
+    }
+
+    // Replication group: the same append goes down the chain as it arrives
+    int replica = -1;
+    if (!this->nextNode.empty()) {
+        std::string header = std::string("append ") + std::to_string(path.size()) + " " + std::to_string(len) + "\n";
+        replica = this->replicaFor(conn);
+        if (replica >= 0 && (!sendAll(replica, header.data(), header.size()) || !sendAll(replica, path.data(), path.size()))) {
+            this->dropReplica(conn);
+            replica = -1;
+        }
+        if (replica < 0) {
+            close(fd);
+            if (this->discardBody(conn, len)) { std::string err = "ERR 502 replica_failed\n"; sendAll(conn.sock, err.data(), err.size()); }
+            return;
+        }
+    }
+
+    // Append group: only the new bytes touch the disk
+    PooledBuffer buffer;
+    size_t remaining = len;
+    bool ok = true, replicaOk = true;
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, buffer.size());
+        if (!conn.recvBody(buffer.data(), chunk)) { close(fd); return; }
+        if (ok && write(fd, buffer.data(), chunk) != static_cast<ssize_t>(chunk)) ok = false;
+        if (replica >= 0 && replicaOk) replicaOk = sendAll(replica, buffer.data(), chunk);
+        remaining -= chunk;
+    }
+    struct stat st;
+    if (ok && fstat(fd, &st) != 0) ok = false;
+    close(fd);
+    if (replica >= 0) {
+        std::string resp;
+        if (!replicaOk || !recvLine(replica, resp) || resp.rfind("OK", 0) != 0) {
+            this->dropReplica(conn);
+            std::string err = "ERR 502 replica_failed\n"; sendAll(conn.sock, err.data(), err.size()); return;
+        }
+    }
+    if (!ok) { std::string err = "ERR 500 write_failed\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (len > 0) this->notifyHub.publish(path, static_cast<size_t>(st.st_size));
+    std::string reply = std::string("OK ") + std::to_string(static_cast<long long>(st.st_size)) + "\n";
+    sendAll(conn.sock, reply.data(), reply.size());
+}
+
+void Server::builtin_append_stream(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_append_stream" << std::endl;
+    // Header parsing group: extract pathLen
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long pathLenUl = std::strtoul(argv[1], &end, 10);
+    if (*end != '\0' || pathLenUl == 0UL) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Path group: the stream is refused up front, before any frame is sent
+    std::string path(static_cast<size_t>(pathLenUl), '\0');
+    if (!recvExact(conn.sock, path.data(), path.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string safePath;
+    if (!sanitizePath(path, safePath)) { std::string err = badPathReply(path); sendAll(conn.sock, err.data(), err.size()); return; }
+    Trace::stage("path_sanitized", path);
+    if (!this->ownsPath(conn, path)) return;
+    if (!this->nextNode.empty()) { std::string err = "ERR 501 not_replicated\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    TierWrite writing(this->tiers, safePath);
+    if (!writing.ok()) { std::string err = "ERR 500 tier_busy\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    int fd = open(safePath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        std::string err = errno == ENOENT ? "ERR 404 not_found\n" : "ERR 500 write_failed\n";
+        sendAll(conn.sock, err.data(), err.size()); return;
+    }
+    std::string ready = "OK 0\n";
+    if (!sendAll(conn.sock, ready.data(), ready.size())) { close(fd); return; }
+
+    // Frame group: "<n>\n<n bytes>" until "0\n"
+    PooledBuffer buffer;
+    size_t streamBytes = 0, unacked = 0;
+    while (true) {
+        std::string line;
+        if (!recvLine(conn.sock, line)) break;
+        char* frameEnd = nullptr;
+        unsigned long frameUl = std::strtoul(line.c_str(), &frameEnd, 10);
+        // Errors end the connection too: the client may have more frames in
+        // flight, and none of them may be read as a command
+        if (line.empty() || *frameEnd != '\0' || frameUl > APPEND_MAX_FRAME) {
+            std::string err = "ERR 400 bad_frame\n"; sendAll(conn.sock, err.data(), err.size());
+            conn.ended = true;
+            break;
+        }
+        if (frameUl == 0) {
+            if (unacked > 0) this->publishChange(path, safePath);
+            std::string ok = std::string("OK ") + std::to_string(streamBytes) + "\n";
+            sendAll(conn.sock, ok.data(), ok.size());
+            break;
+        }
+        size_t remaining = static_cast<size_t>(frameUl);
+        bool ok = true;
+        while (remaining > 0) {
+            size_t chunk = std::min(remaining, buffer.size());
+            if (!conn.recvBody(buffer.data(), chunk)) { close(fd); return; }
+            if (ok) ok = write(fd, buffer.data(), chunk) == static_cast<ssize_t>(chunk);
+            remaining -= chunk;
+        }
+        if (!ok) {
+            std::string err = "ERR 500 write_failed\n"; sendAll(conn.sock, err.data(), err.size());
+            conn.ended = true;
+            break;
+        }
+        streamBytes += frameUl;
+        unacked += frameUl;
+
+        // Ack group: every APPEND_ACK_BYTES, or as soon as the client goes quiet
+        struct pollfd pfd;
+        pfd.fd = conn.sock;
+        pfd.events = POLLIN;
+        if (unacked >= APPEND_ACK_BYTES || poll(&pfd, 1, 0) == 0) {
+            this->publishChange(path, safePath);
+            std::string ack = std::string("ACK ") + std::to_string(streamBytes) + "\n";
+            if (!sendAll(conn.sock, ack.data(), ack.size())) break;
+            unacked = 0;
+        }
+    }
+    close(fd);
+}
+
+void Server::builtin_watch(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_watch" << std::endl;
+    // Header parsing group: prefixLen, optional sinceVersion and timeoutSecs
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long prefixLenUl = std::strtoul(argv[1], &end, 10);
+    if (*end != '\0' || prefixLenUl > 4096) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    uint64_t since = this->notifyHub.currentVersion();
+    long timeoutMs = -1;
+    if (argc >= 3) {
+        unsigned long long sinceUll = std::strtoull(argv[2], &end, 10);
+        if (*end != '\0') { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+        if (sinceUll > 0) since = sinceUll;
+    }
+    if (argc >= 4) {
+        long secs = std::strtol(argv[3], &end, 10);
+        if (*end != '\0' || secs < 0) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+        timeoutMs = secs * 1000;
+    }
+
+    // Prefix group: a logical path prefix, so no sanitizing beyond reading it
+    std::string prefix(static_cast<size_t>(prefixLenUl), '\0');
+    if (!recvExact(conn.sock, prefix.data(), prefix.size())) { std::string err = "ERR 400 bad_path\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Wait group: give up early if the client hangs up or we are being replaced
+    ChangeEvent ev;
+    bool got = this->notifyHub.waitFor(prefix, since, timeoutMs, [this, &conn]() {
+        struct pollfd pfd;
+        pfd.fd = conn.sock;
+        pfd.events = POLLRDHUP;
+        return this->draining || (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)));
+    }, ev);
+    std::string reply = got
+        ? std::string("EVENT ") + std::to_string(ev.version) + " " + std::to_string(ev.size) + " " + std::to_string(ev.path.size()) + "\n" + ev.path
+        : std::string("TIMEOUT ") + std::to_string(this->notifyHub.currentVersion()) + "\n";
+    sendAll(conn.sock, reply.data(), reply.size());
+}
+
+void Server::builtin_stat(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_stat" << std::endl;
+    // Header parsing group: extract count and the byte length of the path list
+    if (argc < 3) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end1 = nullptr; char* end2 = nullptr;
+    unsigned long count = std::strtoul(argv[1], &end1, 10);
+    unsigned long bytes = std::strtoul(argv[2], &end2, 10);
+    if (*end1 != '\0' || *end2 != '\0') { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (count > STAT_MAX_PATHS || bytes > STAT_MAX_BYTES) {
+        // drop the list so the connection stays in sync
+        char sink[4096];
+        for (unsigned long left = bytes; left > 0;) {
+            size_t chunk = std::min<unsigned long>(left, sizeof(sink));
+            if (!recvExact(conn.sock, sink, chunk)) return;
+            left -= chunk;
+        }
+        std::string err = "ERR 413 too_many_paths\n"; sendAll(conn.sock, err.data(), err.size()); return;
+    }
+
+    // Path list group: count paths separated by '\n'
+    std::string list(static_cast<size_t>(bytes), '\0');
+    if (!recvExact(conn.sock, list.data(), list.size())) return;
+    std::vector<std::string> paths;
+    if (count > 0) {
+        std::istringstream iss(list);
+        for (std::string path; std::getline(iss, path, '\n');) paths.push_back(path);
+    }
+    if (paths.size() != count) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Reply group: one line per path, all in a single response
+    std::string reply = "OK " + std::to_string(count) + "\n";
+    for (const std::string &path : paths) {
+        std::string safePath;
+        FileMeta meta;
+        if (path.empty() || !sanitizePath(path, safePath)) reply += badPathReply(path);
+        else if (!this->ring.empty() && this->ring.owner(path) != this->selfNode) reply += "ERR 421 misdirected " + this->ring.owner(path) + "\n";
+        else if (!this->metaCache.lookup(this->tiers.locate(safePath), meta)) reply += "ERR 404 not_found\n";
+        else {
+            this->contentIndex.add(meta.sha256, safePath);
+            reply += "OK " + std::to_string(meta.size) + " " + std::to_string(meta.mtime) + " " + meta.sha256 + "\n";
+        }
+    }
+    sendAll(conn.sock, reply.data(), reply.size());
+}
+
+void Server::builtin_stats(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_stats" << std::endl;
+    std::string body;
+    body += "server.active_connections " + std::to_string(this->activeConnections.load()) + "\n";
+    body += "prefetch.hinted " + std::to_string(this->prefetcher.hinted.load()) + "\n";
+    body += "prefetch.dropped " + std::to_string(this->prefetcher.dropped.load()) + "\n";
+    body += this->scheduler.statsText();
+    body += this->tiers.statsText();
+    body += this->metaCache.statsText();
+    body += this->contentIndex.statsText();
+    body += SocketTuner::statsText();
+    body += Affinity::instance().statsText();
+    body += udpStatsText();
+    body += BufferPool::allStatsText();
+    std::string ok = std::string("OK ") + std::to_string(body.size()) + "\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+    sendAll(conn.sock, body.data(), body.size());
+}
+
+// CPU time (user + system) of the calling thread, which serves the connection
+static uint64_t threadCpuUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+// `OK <us> <cpuUs>\n` closing a bench transfer that started at `started` / `cpuStart`
+static void sendBenchTrailer(int sock, std::chrono::steady_clock::time_point started, uint64_t cpuStart) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+    std::string done = "OK " + std::to_string(us) + " " + std::to_string(threadCpuUs() - cpuStart) + "\n";
+    sendAll(sock, done.data(), done.size());
+}
+
+void Server::builtin_bench_send(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_bench_send" << std::endl;
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long long bytesUll = std::strtoull(argv[1], &end, 10);
+    if (*end != '\0' || argv[1][0] == '-') { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    size_t remaining = static_cast<size_t>(bytesUll);
+    std::string ok = std::string("OK ") + std::to_string(remaining) + "\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+
+    // Generate group: every chunk comes from one pattern buffer, never from disk
+    static const std::vector<char> pattern = [] {
+        std::vector<char> bytes(TUNE_MAX_CHUNK);
+        for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<char>(i * 131 + 7);
+        return bytes;
+    }();
+    auto started = std::chrono::steady_clock::now();
+    uint64_t cpuStart = threadCpuUs();
+    conn.tuner.begin();
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, std::min(conn.tuner.chunkSize(), pattern.size()));
+        if (!conn.sendBody(pattern.data(), chunk)) return;
+        conn.tuner.progress(chunk, true);
+        remaining -= chunk;
+    }
+    sendBenchTrailer(conn.sock, started, cpuStart);
+}
+
+void Server::builtin_bench_recv(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_bench_recv" << std::endl;
+    if (argc < 2) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    char* end = nullptr;
+    unsigned long long bytesUll = std::strtoull(argv[1], &end, 10);
+    if (*end != '\0' || argv[1][0] == '-') { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    size_t remaining = static_cast<size_t>(bytesUll);
+
+    // Sink group: read into one buffer and drop it
+    ChunkBuffer buffer;
+    auto started = std::chrono::steady_clock::now();
+    uint64_t cpuStart = threadCpuUs();
+    conn.tuner.begin();
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, conn.tuner.chunkSize());
+        if (!conn.recvBody(buffer.get(chunk), chunk)) return;
+        conn.tuner.progress(chunk, false);
+        remaining -= chunk;
+    }
+    sendBenchTrailer(conn.sock, started, cpuStart);
+}
+
+void Server::builtin_mux(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_mux" << std::endl;
+    if (conn.shm || conn.muxStream) { std::string err = "ERR 400 mux_unavailable\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string ok = "OK\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+
+    // Session group: this thread pumps frames; every new stream is served
+    // like a freshly accepted connection
+    MuxSession session(conn.sock, false, [this](int streamFd) {
+        this->activeConnections++;
+        std::thread(&Server::serveConnection, this, streamFd, true).detach();
+    });
+    session.run();
+    conn.ended = true;
+    std::cout << "mux session closed" << std::endl;
+}
+
+void Server::builtin_shm(Connection &conn, int argc, char* argv[]) {
+    std::cout << "builtin_shm" << std::endl;
+    // Header parsing group: ring capacity in bytes (0 or missing: default)
+    size_t capacity = SHM_RING_CAPACITY;
+    if (argc >= 2) {
+        char* end = nullptr;
+        unsigned long capUl = std::strtoul(argv[1], &end, 10);
+        if (*end != '\0' || capUl > SHM_RING_MAX_CAPACITY) { std::string err = "ERR 400 bad_header\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+        if (capUl > 0) capacity = static_cast<size_t>(capUl);
+    }
+    // The descriptors travel over SCM_RIGHTS, so this only works for local clients
+    if (!conn.local) { std::string err = "ERR 403 not_local\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    if (conn.shm) { std::string err = "ERR 400 shm_active\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+
+    // Transport group: map the rings, then pass them to the client
+    std::unique_ptr<ShmTransport> shm(new ShmTransport());
+    if (!shm->create(capacity, conn.sock)) { std::string err = "ERR 500 shm_failed\n"; sendAll(conn.sock, err.data(), err.size()); return; }
+    std::string ok = "OK\n";
+    if (!sendAll(conn.sock, ok.data(), ok.size())) return;
+    if (!shm->sendFds(conn.sock)) return;
+    conn.shm = std::move(shm);
 }
 
+// A failed ring (peer gone, or counters that do not add up) is not
+// recoverable: the connection ends after the current request
+bool Connection::recvBody(void *buf, size_t len) {
+    if (this->shm) {
+        if (this->shm->toServer.read(buf, len)) return true;
+        this->ended = true;
+        return false;
+    }
+    return recvExact(this->sock, buf, len);
+}
 
-// Socket setup: create, configure, bind, and listen
+bool Connection::sendBody(const void *buf, size_t len) {
+    if (this->shm) {
+        if (this->shm->toClient.write(buf, len)) return true;
+        this->ended = true;
+        return false;
+    }
+    return sendAll(this->sock, buf, len);
+}
+
+
+// Socket setup: create, configure, bind, and listen (or inherit the socket on --takeover)
 void Server::setup() {
     int opt = 1;
-    if ((this->listenSocket = socket(PF_INET, SOCK_STREAM, 0)) < 0) 
-    {
-        perror("simplex-talk: socket");
-        exit(1);
+    if (this->takeover) {
+        if (!this->takeOver()) {
+            std::cerr << "takeover: no running server at " << this->upgradePath << std::endl;
+            exit(1);
+        }
+    } else {
+        if ((this->listenSocket = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+            perror("simplex-talk: socket");
+            exit(1);
+        }
+        if (setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            perror("setsockopt SO_REUSEADDR");
+        }
+        #ifdef SO_REUSEPORT
+        if (setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            perror("setsockopt SO_REUSEPORT");
+        }
+        #endif
+        if ((bind(this->listenSocket, (struct sockaddr *)&this->sin, sizeof(this->sin))) < 0) {
+            perror("simplex-talk: bind");
+            exit(1);
+        }
+        listen(this->listenSocket, MAX_PENDING);
     }
-    
-    if (setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt SO_REUSEADDR");
+    // The listening socket may be shared with the process we hand it to later,
+    // so never let accept() block once poll() said it was readable.
+    fcntl(this->listenSocket, F_SETFL, fcntl(this->listenSocket, F_GETFL) | O_NONBLOCK);
+
+    if (this->localListenSocket < 0 && (this->localListenSocket = listenUnix(this->localPath, MAX_PENDING)) < 0) {
+        perror("local socket");
     }
-    #ifdef SO_REUSEPORT
-    if (setsockopt(this->listenSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt SO_REUSEPORT");
+    if (this->localListenSocket >= 0) {
+        fcntl(this->localListenSocket, F_SETFL, fcntl(this->localListenSocket, F_GETFL) | O_NONBLOCK);
     }
-    #endif
-    if ((this->listenSocket = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("simplex-talk: socket");
-        exit(1);
+
+    if ((this->upgradeListenSocket = listenUnix(this->upgradePath, 1)) < 0) {
+        perror("upgrade socket");
     }
-    if ((bind(this->listenSocket, (struct sockaddr *)&this->sin, sizeof(this->sin))) < 0) {
-        perror("simplex-talk: bind");
-        exit(1);
+    if (this->useInotify && !this->notifyHub.startInotify(STORAGE_ROOT)) {
+        perror("inotify");
+    }
+    if (this->usePrefetch) {
+        this->prefetcher.start();
     }
-    listen(this->listenSocket, MAX_PENDING);
+    this->tiers.start();
+    this->contentIndex.start();
 }
 
-// Main loop: accept a client and process header lines via CommandHandler
+// Main loop: accept TCP and local clients and hand each one to its own
+// connection thread. Also watches the upgrade socket; a connection there
+// starts the handoff.
 void Server::run() {
-
-    this->registerCommands();
-
-    while (1) {
-        if ((this->clientSocket = accept(this->listenSocket, (struct sockaddr *)&this->sin, &this->addrLen)) < 0) {
-            perror("simplex-talk: accept");
+    while (!this->draining) {
+        // fds[0] TCP listener, fds[1] local listener, fds[2] upgrade socket
+        struct pollfd fds[3];
+        fds[0].fd = this->listenSocket;
+        fds[1].fd = this->localListenSocket;
+        fds[2].fd = this->upgradeListenSocket;
+        for (struct pollfd &p : fds) {
+            p.events = POLLIN;
+            p.revents = 0;
+        }
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
             exit(1);
         }
+        // a failed handoff leaves us serving as before
+        if (fds[2].revents & POLLIN) {
+            this->handOff();
+            if (this->draining) break;
+            continue;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            int clientSocket = accept(fds[i].fd, nullptr, nullptr);
+            if (clientSocket < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) continue;
+                perror("simplex-talk: accept");
+                exit(1);
+            }
+            this->startConnection(clientSocket);
+        }
+    }
 
-        while (true) {
-            std::string header;
-            if (!this->recvLine(this->clientSocket, header)) break;
+    // Drain group: wait for in-flight requests, then tell the new process we are done
+    {
+        std::unique_lock<std::mutex> lock(this->connMutex);
+        this->connCv.wait_for(lock, std::chrono::seconds(DRAIN_TIMEOUT_SECS),
+                              [this]() { return this->activeConnections == 0; });
+    }
+    std::cout << "upgrade: drained, " << this->activeConnections << " connection(s) left" << std::endl;
+    std::lock_guard<std::mutex> lock(this->handoffMutex);
+    sendFd(this->handoffSocket, 'E', -1);
+}
 
+void Server::startConnection(int sock) {
+    this->activeConnections++;
+    std::thread(&Server::serveConnection, this, sock, false).detach();
+}
 
-            std::cout << "header: " << header << std::endl;
-            std::istringstream iss(header);
-            std::string cmd;
-            iss >> cmd;
-            std::cout << "cmd: " << cmd << std::endl;
-            // copy cmd
-            char* header_copy = strdup(header.c_str());
-            std::cout << "header_copy: " << header_copy << std::endl;
-            this->commandHandler.executeCommand(header_copy);
-            free(header_copy);
+// Per-connection loop: process header lines via this connection's CommandHandler
+void Server::serveConnection(int sock, bool muxStream) {
+    // with --affinity: a core on the node the connection's packets arrive on
+    PinnedThread pin(Affinity::instance().placeConnection(sock));
+    Trace::instant(muxStream ? "stream_open" : "accept");
+    Connection conn(sock);
+    struct sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    // a mux stream is a socketpair, but its client is at the far end of the session
+    conn.muxStream = muxStream;
+    conn.local = !muxStream && getsockname(sock, (struct sockaddr *)&addr, &addrLen) == 0 && addr.ss_family == AF_UNIX;
+    CommandHandler handler;
+    this->registerCommands(handler, conn);
+    bool handedOff = false;
 
+    while (true) {
+        if (!this->waitForRequest(sock)) {
+            // the ring mapping (or the mux session) cannot follow the socket;
+            // keep serving until the client leaves
+            if (conn.shm || conn.muxStream) continue;
+            // idle while draining: the new process takes over this client
+            handedOff = this->idleHandoff && this->handOffConnection(sock);
+            break;
         }
+        // with --trace: one span per request, from its first byte to the reply
+        TraceRequest trace("request");
+        if (this->usePrefetch) this->prefetchQueued(conn);
+        std::string header;
+        if (!recvLine(sock, header)) break;
 
-        close(this->clientSocket);
-        this->clientSocket = -1;
+        std::cout << "header: " << header << std::endl;
+        std::istringstream iss(header);
+        std::string cmd;
+        iss >> cmd;
+        std::cout << "cmd: " << cmd << std::endl;
+        trace.setName(cmd);
+        Trace::stage("header_parsed");
+        // copy cmd
+        char* header_copy = strdup(header.c_str());
+        std::cout << "header_copy: " << header_copy << std::endl;
+        handler.executeCommand(header_copy);
+        free(header_copy);
+        if (conn.ended) break;
     }
+
+    if (conn.shm) conn.shm->toServer.close();
+    this->dropReplica(conn);
+    if (!handedOff) close(sock);
+    std::lock_guard<std::mutex> lock(this->connMutex);
+    this->activeConnections--;
+    this->connCv.notify_all();
 }
 
-bool Server::sendAll(int sock, const void* buf, size_t len) {
-    const char* p = static_cast<const char*>(buf);
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = send(sock, p + total, len - total, 0);
-        if (n <= 0) { if (n < 0 && errno == EINTR) continue; return false; }
-        total += static_cast<size_t>(n);
+// Hint the files of gets pipelined behind the request about to be read.
+// The first queued request is the one we serve next; it was hinted by an
+// earlier scan if it had been queued behind something.
+void Server::prefetchQueued(Connection &conn) {
+    std::vector<std::string> paths;
+    Prefetcher::scanQueued(conn.sock, !conn.shm, paths);
+    for (size_t i = 1; i < paths.size(); i++) {
+        std::string safePath;
+        if (!this->ring.empty() && this->ring.owner(paths[i]) != this->selfNode) continue;
+        if (sanitizePath(paths[i], safePath)) this->prefetcher.hint(this->tiers.locate(safePath));
     }
-    return true;
 }
 
-bool Server::recvExact(int sock, void* buf, size_t len) {
-    char* p = static_cast<char*>(buf);
-    size_t total = 0;
-    while (total < len) {
-        ssize_t n = recv(sock, p + total, len - total, 0);
-        if (n == 0) return false;
-        if (n < 0) { if (errno == EINTR) continue; return false; }
-        total += static_cast<size_t>(n);
+// Block until the next request arrives (true) or, while draining, until the
+// connection is found idle with nothing queued (false).
+bool Server::waitForRequest(int sock) {
+    while (true) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        int n = poll(&pfd, 1, IDLE_POLL_MS);
+        if (n > 0) return true;
+        if (n < 0 && errno != EINTR) return true;  // let recvLine report the error
+        if (this->draining) return false;
     }
+}
+
+// Pass an idle client socket to the new process ('C'); the local copy is closed.
+bool Server::handOffConnection(int sock) {
+    std::lock_guard<std::mutex> lock(this->handoffMutex);
+    if (this->handoffSocket < 0) return false;
+    if (!sendFd(this->handoffSocket, 'C', sock)) return false;
+    close(sock);
+    std::cout << "upgrade: handed off idle connection" << std::endl;
     return true;
 }
 
-bool Server::recvLine(int sock, std::string &out) {
-    out.clear();
-    char ch;
-    while (true) {
-        ssize_t n = recv(sock, &ch, 1, 0);
-        if (n == 0) return false;
-        if (n < 0) { if (errno == EINTR) continue; return false; }
-        if (ch == '\n') break;
-        out.push_back(ch);
-        if (out.size() > 4096) return false;
+// Old process side: a new binary connected to the upgrade socket
+void Server::handOff() {
+    int s = accept(this->upgradeListenSocket, nullptr, nullptr);
+    if (s < 0) {
+        perror("upgrade accept");
+        return;
     }
-    return true;
+    // If the new process is gone before it confirms it has the sockets, keep
+    // serving (and keep the upgrade socket for another attempt)
+    {
+        std::lock_guard<std::mutex> lock(this->handoffMutex);
+        if (!sendFd(s, 'L', this->listenSocket) || !sendFd(s, 'U', this->localListenSocket)) {
+            perror("upgrade: send listen socket");
+            close(s);
+            return;
+        }
+        struct pollfd pfd;
+        pfd.fd = s;
+        pfd.events = POLLIN;
+        char tag = 0;
+        int fd = -1;
+        if (poll(&pfd, 1, UPGRADE_ACK_SECS * 1000) <= 0 || !recvFd(s, tag, fd) || tag != 'A') {
+            if (fd >= 0) close(fd);
+            std::cerr << "upgrade: new process did not confirm the handoff, still serving" << std::endl;
+            close(s);
+            return;
+        }
+        this->handoffSocket = s;
+    }
+    // the new process re-creates the upgrade socket for the next upgrade
+    close(this->upgradeListenSocket);
+    this->upgradeListenSocket = -1;
+    close(this->listenSocket);
+    this->listenSocket = -1;
+    if (this->localListenSocket >= 0) {
+        close(this->localListenSocket);
+        this->localListenSocket = -1;
+    }
+    this->draining = true;
+    std::cout << "upgrade: listening socket handed off, draining "
+              << this->activeConnections << " connection(s)" << std::endl;
 }
 
-bool Server::sanitizePath(const std::string& requested, std::string& safeOut) {
-    if (!requested.empty() && requested[0] == '/') return false;
-    if (requested.find("..") != std::string::npos) return false;
-    safeOut = std::string("server_storage/") + requested;
+// New process side: receive the listening socket, then keep receiving idle
+// connections in the background until the old process says it is done.
+bool Server::takeOver() {
+    int s = connectUnix(this->upgradePath);
+    if (s < 0) return false;
+    char tag = 0;
+    int fd = -1;
+    if (!recvFd(s, tag, fd) || tag != 'L' || fd < 0) {
+        close(s);
+        return false;
+    }
+    this->listenSocket = fd;
+    // 'U' carries the local socket, or no descriptor if the old process had none
+    if (!recvFd(s, tag, fd) || tag != 'U') {
+        close(s);
+        return false;
+    }
+    this->localListenSocket = fd;
+    // until this arrives the old process keeps accepting
+    if (!sendFd(s, 'A', -1)) {
+        close(s);
+        return false;
+    }
+    std::cout << "takeover: inherited listening socket" << std::endl;
+    std::thread([this, s]() {
+        char tag = 0;
+        int fd = -1;
+        while (recvFd(s, tag, fd) && tag == 'C') {
+            if (fd >= 0) this->startConnection(fd);
+        }
+        close(s);
+        std::cout << "takeover: previous server exited" << std::endl;
+    }).detach();
     return true;
 }
 
-bool Server::writeFileFromSocket(int sock, const std::string& destPath, size_t size) {
-    std::string tmpPath = destPath + ".part";
+// With a replicaSock every chunk is also forwarded to the next replica, and
+// the .part file is only renamed into place after the replica answered OK.
+// A replica failure closes conn.replicaSock. With expectSha the file is only
+// committed if its SHA-256 matches (otherwise *hashMismatch is set).
+bool Server::writeFileFromSocket(Connection &conn, const std::string& destPath, size_t size, int replicaSock,
+                                 const std::string& expectSha, bool *hashMismatch) {
+    std::string tmpPath = tempPathFor(destPath);
     std::ofstream out(tmpPath, std::ios::binary);
-    if (!out) return false;
-    std::vector<char> buffer(64 * 1024);
+    if (!out) {
+        // first file in this directory (or fan-out bucket): create it and retry
+        if (!ensureParentDirs(tmpPath)) return false;
+        out.open(tmpPath, std::ios::binary);
+        if (!out) return false;
+    }
+    Trace::stage("file_opened");
+    ChunkBuffer buffer;
+    ScheduledTransfer transfer(this->scheduler, size, conn.shm ? -1 : conn.sock, POLLIN);
+    Sha256 sha;
     size_t remaining = size;
+    bool replicaOk = true;
+    conn.tuner.begin();
     while (remaining > 0) {
-        size_t chunk = std::min(remaining, buffer.size());
-        if (!this->recvExact(sock, buffer.data(), chunk)) return false;
-        out.write(buffer.data(), static_cast<std::streamsize>(chunk));
+        size_t chunk = std::min(remaining, conn.tuner.chunkSize());
+        char *buf = buffer.get(chunk);
+        transfer.beginChunk();
+        // a turn covers what has already arrived, not a wait for a slow sender
+        int avail = 0;
+        if (!conn.shm && ioctl(conn.sock, FIONREAD, &avail) == 0 && avail > 0) chunk = std::min(chunk, static_cast<size_t>(avail));
+        if (!conn.recvBody(buf, chunk)) return false;
+        if (remaining == size) Trace::stage("first_byte");
+        out.write(buf, static_cast<std::streamsize>(chunk));
         if (!out) return false;
+        if (!expectSha.empty()) sha.update(buf, chunk);
+        // keep reading the client's bytes even if the replica went away
+        if (replicaSock >= 0 && replicaOk) replicaOk = sendAll(replicaSock, buf, chunk);
+        transfer.endChunk(chunk);
+        conn.tuner.progress(chunk, false);
         remaining -= chunk;
     }
+    Trace::stage("last_byte");
     out.close();
-    if (std::rename(tmpPath.c_str(), destPath.c_str()) != 0) return false;
+    if (replicaSock >= 0) {
+        std::string resp;
+        if (!replicaOk || !recvLine(replicaSock, resp) || resp.rfind("OK", 0) != 0) {
+            this->dropReplica(conn);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+    }
+    if (!expectSha.empty() && sha.hexDigest() != expectSha) {
+        if (hashMismatch) *hashMismatch = true;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return this->tiers.commit(tmpPath, destPath);
+}
+
+// Connection to the next replica for this client connection (-1 if unreachable)
+int Server::replicaFor(Connection &conn) {
+    if (conn.replicaSock >= 0) return conn.replicaSock;
+    std::string host;
+    int port;
+    if (!splitHostPort(this->nextNode, host, port)) return -1;
+    struct hostent *hp = gethostbyname(host.c_str());
+    if (!hp) return -1;
+    struct sockaddr_in addr;
+    bzero((char *)&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    bcopy(hp->h_addr, (char *)&addr.sin_addr, hp->h_length);
+    addr.sin_port = htons(port);
+    int s = socket(PF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("replica connect");
+        close(s);
+        return -1;
+    }
+    conn.replicaSock = s;
+    return s;
+}
+
+// A failed replica connection is in an unknown protocol state: start over next time
+void Server::dropReplica(Connection &conn) {
+    if (conn.replicaSock >= 0) close(conn.replicaSock);
+    conn.replicaSock = -1;
+}
+
+// Send a complete request (header line plus raw bytes) down the chain and wait for OK
+bool Server::forwardToReplica(Connection &conn, const std::string& header, const std::string& payload) {
+    int replica = this->replicaFor(conn);
+    std::string resp;
+    if (replica < 0 || !sendAll(replica, header.data(), header.size()) ||
+        !sendAll(replica, payload.data(), payload.size()) || !recvLine(replica, resp)) {
+        this->dropReplica(conn);
+        return false;
+    }
+    return resp.rfind("OK", 0) == 0;
+}
+
+// Server-side copy: reflink, then in-kernel copy, then a user-space loop.
+// Like uploads, the data lands in a .part file that is renamed into place.
+bool Server::copyFileLocal(const std::string& srcPath, const std::string& destPath) {
+    int in = open(srcPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    std::string tmpPath = tempPathFor(destPath);
+    int out = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0 && errno == ENOENT && ensureParentDirs(tmpPath)) {
+        out = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    bool ok = false;
+    #ifdef FICLONE
+    // Reflink group: share the extents, no data is copied at all
+    ok = ioctl(out, FICLONE, in) == 0;
+    #endif
+    if (!ok) {
+        // copy_file_range group: the kernel moves the data (server-side copy on NFS/SMB)
+        ok = true;
+        bool fallback = false;
+        while (true) {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+            if (n > 0) continue;
+            if (n == 0) break;
+            if (errno == EINTR) continue;
+            // not supported for this pair of files: copy by hand from where we are
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) fallback = true;
+            else ok = false;
+            break;
+        }
+        if (fallback) {
+            PooledBuffer buffer;
+            while (true) {
+                ssize_t n = read(in, buffer.data(), buffer.size());
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    ok = n == 0;
+                    break;
+                }
+                if (write(out, buffer.data(), static_cast<size_t>(n)) != n) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+    close(in);
+    if (close(out) != 0) ok = false;
+    if (ok && std::rename(tmpPath.c_str(), destPath.c_str()) != 0) ok = false;
+    if (!ok) unlink(tmpPath.c_str());
+    return ok;
+}
+
+// Read and drop `size` body bytes after a rejected request
+bool Server::discardBody(Connection &conn, size_t size) {
+    PooledBuffer buffer;
+    while (size > 0) {
+        size_t chunk = std::min(size, buffer.size());
+        if (!conn.recvBody(buffer.data(), chunk)) return false;
+        size -= chunk;
+    }
     return true;
 }
 
@@ -223,21 +1571,67 @@ bool Server::computeFileSize(const std::string& path, size_t &outSize) {
     return true;
 }
 
-bool Server::sendFileToSocket(int sock, const std::string& path) {
+// Sends exactly the `size` already announced in the reply: an append that
+// grows the file meanwhile must not spill into the next reply. A file that
+// shrank meanwhile cannot make up the rest, so the connection is ended.
+bool Server::sendFileToSocket(Connection &conn, const std::string& path, size_t size) {
     std::ifstream in(path, std::ios::binary);
     if (!in) return false;
-    std::vector<char> buffer(64 * 1024);
-    while (true) {
-        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    Trace::stage("file_opened");
+    ChunkBuffer buffer;
+    ScheduledTransfer transfer(this->scheduler, size, conn.shm ? -1 : conn.sock, POLLOUT);
+    conn.tuner.begin();
+    size_t sent = 0;
+    while (sent < size) {
+        size_t chunk = std::min(conn.tuner.chunkSize(), size - sent);
+        char *buf = buffer.get(chunk);
+        transfer.beginChunk();
+        in.read(buf, static_cast<std::streamsize>(chunk));
         std::streamsize got = in.gcount();
-        if (got <= 0) break;
-        if (!this->sendAll(sock, buffer.data(), static_cast<size_t>(got))) return false;
+        if (got <= 0) {
+            conn.ended = true;
+            return false;
+        }
+        if (!conn.sendBody(buf, static_cast<size_t>(got))) return false;
+        if (sent == 0) Trace::stage("first_byte");
+        sent += static_cast<size_t>(got);
+        transfer.endChunk(static_cast<size_t>(got));
+        conn.tuner.progress(static_cast<size_t>(got), true);
+    }
+    Trace::stage("last_byte");
+    return true;
+}
+
+// pread keeps concurrent range requests for one file independent of each other
+bool Server::sendFileRangeToSocket(Connection &conn, const std::string& path, size_t offset, size_t length) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    Trace::stage("file_opened");
+    ChunkBuffer buffer;
+    ScheduledTransfer transfer(this->scheduler, length, conn.shm ? -1 : conn.sock, POLLOUT);
+    conn.tuner.begin();
+    size_t total = length;
+    while (length > 0) {
+        size_t chunk = std::min(length, conn.tuner.chunkSize());
+        char *buf = buffer.get(chunk);
+        transfer.beginChunk();
+        ssize_t got = pread(fd, buf, chunk, static_cast<off_t>(offset));
+        if (got <= 0 || !conn.sendBody(buf, static_cast<size_t>(got))) { close(fd); return false; }
+        if (length == total) Trace::stage("first_byte");
+        transfer.endChunk(static_cast<size_t>(got));
+        conn.tuner.progress(static_cast<size_t>(got), true);
+        offset += static_cast<size_t>(got);
+        length -= static_cast<size_t>(got);
     }
+    Trace::stage("last_byte");
+    close(fd);
     return true;
 }
 
-int main() {
-    Server server;
+int main(int argc, char* argv[]) {
+    // a client that disconnects mid-transfer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    Server server(argc, argv);
     server.setup();
     server.run();
     return 0;
@@ -10,13 +10,48 @@
 #include <string>
 #include <unistd.h>
 #include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include "../common/CommandHandler.h"
+#include "../common/NetIO.h"
+#include "../common/PathUtil.h"
+#include "../common/UnixSock.h"
+#include "../common/ShmRing.h"
+#include "../common/HashRing.h"
+#include "../common/BufferPool.h"
+#include "../common/SparseIO.h"
+#include "../common/Mux.h"
+#include "../common/Sha256.h"
+#include "../common/SocketTuner.h"
+#include "../common/Affinity.h"
+#include "../common/Trace.h"
+#include "../common/UdpTransfer.h"
+#include "NotifyHub.h"
+#include "Prefetcher.h"
+#include "TransferScheduler.h"
+#include "StorageTiers.h"
+#include "MetadataCache.h"
+#include "ContentIndex.h"
 
 #define SERVER_PORT 5432
 //added proxy port
 #define PROXY_PORT 5465
-#define MAX_PENDING 5
+#define MAX_PENDING 128
 #define MAX_LINE 256
+#define LOCAL_SOCKET_PATH "server.sock"
+#define UPGRADE_SOCKET_PATH "server.upgrade.sock"
+#define DRAIN_TIMEOUT_SECS 300
+// the new process must confirm it holds the listening sockets within this long
+#define UPGRADE_ACK_SECS 10
+#define IDLE_POLL_MS 250
+// append-stream: ack at least every APPEND_ACK_BYTES, frames are bounded
+#define APPEND_ACK_BYTES (1024 * 1024)
+#define APPEND_MAX_FRAME (16 * 1024 * 1024)
+// stat: paths per request and bytes of the path list
+#define STAT_MAX_PATHS 4096
+#define STAT_MAX_BYTES (1024 * 1024)
 
 /*
 Server
@@ -29,6 +64,9 @@ Commands:
           1) Parse header tokens: pathLen, fileSize.
           2) Read exactly `pathLen` bytes for the relative path.
           3) Sanitize the path (no absolute/.. traversal) and prefix `server_storage/`.
+             A refused path is `ERR 403 bad_path\n`, or `ERR 414 path_too_long\n`
+             when a name on disk would exceed STORAGE_NAME_MAX (every command
+             taking a path replies the same way).
           4) Stream exactly `fileSize` bytes from the socket to a temporary file,
              then atomically rename to the final path.
           5) Send `OK\n` on success.
@@ -42,34 +80,377 @@ Commands:
           4) Compute file size and send `OK <size>\n`.
           5) Stream file bytes to the client.
 
+    - getr <pathLen> <offset> <length>\n [<path bytes>]
+        Ranged get: sends at most `length` bytes starting at `offset`,
+        preceded by `OK <n> <fileSize>\n` (n is clipped at the end of the
+        file). An offset past the end is `ERR 416 bad_range\n`. The client
+        `swarm` command uses it to fetch disjoint blocks of one file from
+        several replicas in parallel; `getr <pathLen> 0 0` only asks for the
+        size.
+
+    - sput <pathLen> <fileSize>\n [<path bytes>][extents]
+    - sget <pathLen>\n [<path bytes>]
+        Sparse-aware put/get for files that are mostly holes (VM images,
+        database snapshots). The body is a list of data extents
+        `<offset> <len>\n<len bytes>` ending with `0 0\n` (see
+        common/SparseIO.h), so holes are never read or sent. sget replies
+        `OK <fileSize>\n` before the extents; sput replies `OK\n` once its
+        `.part` file (ftruncate'd to fileSize, so everything not written
+        stays a hole) has been renamed into place. sput is not replicated
+        (`ERR 501 not_replicated\n` with --next).
+
+    - copy <srcLen> <dstLen>\n [<src path bytes>][<dst path bytes>]
+        Duplicates a stored file without moving its bytes over the network.
+        Both paths go through `sanitizePath`. `copyFileLocal` tries a FICLONE
+        reflink first (a metadata-only copy on btrfs/xfs), then
+        copy_file_range (in-kernel copy), then a plain read/write loop; the
+        result is written to a `<dst>.<pid>.<n>.part` temp file
+        (`tempPathFor`, unique per writer) and renamed into place.
+        Replies `OK\n`, `ERR 404 not_found\n` or `ERR 500 copy_failed\n`.
+
+    - move <srcLen> <dstLen>\n [<src path bytes>][<dst path bytes>]
+        Renames a stored file (replacing any file at dst) with rename(), so
+        promoting an artifact is a metadata operation. Same replies as copy
+        with `ERR 500 move_failed\n`.
+
+    - append <pathLen> <len>\n [<path bytes>][<len bytes>]
+        Appends to the end of an existing file, opened with O_APPEND, so the
+        cost is proportional to the new data only. Replies `OK <fileSize>\n`;
+        a missing file is `ERR 404 not_found\n` (create it with put first).
+        On a path error the body is still consumed so the connection stays
+        usable.
+
+    - append-stream <pathLen>\n [<path bytes>]
+        Long-lived append for log shipping. The server checks the path and
+        replies `OK 0\n` (or an `ERR` line); the client then sends frames
+        `<n>\n<n bytes>` and ends the stream with `0\n`. The file
+        stays open for the whole stream. The server replies
+        `ACK <streamBytes>\n` after at least APPEND_ACK_BYTES, or whenever the
+        client pauses with nothing queued, and `OK <streamBytes>\n` at the
+        end. An error ends the stream with an `ERR` line and closes the
+        connection, since frames already in flight cannot be told apart
+        from commands.
+
+    - watch <prefixLen> [sinceVersion] [timeoutSecs]\n [<prefix bytes>]
+        Long-poll for changes instead of polling with get. Blocks until a
+        put / copy / move / append under the prefix completes (prefixLen 0
+        watches everything), then replies
+        `EVENT <version> <size> <pathLen>\n<path bytes>`. Passing the last
+        version seen as sinceVersion returns changes that happened between
+        two watches (see NotifyHub.h); without it only new changes count.
+        After timeoutSecs, or when the server starts draining for an
+        upgrade, the reply is `TIMEOUT <version>\n` and the client simply
+        watches again from that version.
+
+    - shm <capacity>\n
+        Same-host fast path, only accepted on the Unix-domain listener.
+        Replies `OK\n` plus the ring descriptors (see common/ShmRing.h); from
+        then on put/get/append bodies on this connection move through shared memory
+        while headers and status lines stay on the socket.
+
+    - mux\n
+        Replies `OK\n` and turns the connection into a multiplexed one (see
+        common/Mux.h): from then on it carries frames of many concurrent
+        streams, each of which behaves like a separate connection running
+        any of these commands, so a bulk get no longer delays the small
+        requests behind it. Not available on a shared-memory connection or
+        inside a stream. Streams are never handed to a new process during a
+        hot upgrade; the old process serves the session until it closes.
+
+    - stat <count> <listLen>\n [<path list bytes>]
+        Metadata of many files in one round trip (build systems probing
+        their artifacts). The list is `count` paths joined by '\n'. Replies
+        `OK <count>\n` followed by one line per path, in order:
+        `OK <size> <mtime> <sha256>` (mtime in seconds since the epoch,
+        SHA-256 in hex) or `ERR 404 not_found`, `ERR 403 bad_path`,
+        `ERR 414 path_too_long`, `ERR 421 misdirected <owner host:port>`. Checksums come from the
+        MetadataCache (see MetadataCache.h), so only files that changed
+        since the last stat are read. At most STAT_MAX_PATHS paths and
+        STAT_MAX_BYTES of list per request (`ERR 413 too_many_paths\n`).
+
+    - hput <pathLen> <fileSize> <sha256>\n<path bytes>
+        Hash-first put. If a stored file already has this size and SHA-256
+        (see ContentIndex.h) it is copied to <path> on the server and the
+        reply is `OK\n`: the body is never sent. Otherwise the reply is
+        `SEND\n`, the client sends exactly fileSize bytes and the rest
+        follows put; the received bytes must hash to <sha256> or the file
+        is dropped with `ERR 422 hash_mismatch\n`. With --next there is no
+        deduplication (the replicas may not hold the source) and the digest
+        is not checked.
+
+    - get-if-changed <pathLen> <etag>\n<path bytes>
+        Conditional get for clients that keep a download cache. The ETag of
+        a file is its SHA-256 from the MetadataCache (persisted in an xattr,
+        so it is not recomputed after a restart). If <etag> is still current
+        the reply is `NOT_MODIFIED\n` and no body; otherwise (or with `-`,
+        no cached copy) it is `OK <size> <etag>\n` followed by the file like
+        get. With `-` the file is never hashed first: if its checksum is not
+        known yet the reply's ETag is `-` (nothing to cache) and the
+        ContentIndex hashes it in the background for the next request.
+
+    - uput <pathLen> <fileSize>\n<path bytes>
+    - uget <pathLen>\n<path bytes>
+        Put/get with the body on a UDP data channel (see
+        common/UdpTransfer.h) for high-BDP, lossy links. The server opens a
+        UDP socket on an ephemeral port and replies `OK <port> <session>\n`
+        (uput) or `OK <size> <port> <session>\n` (uget); the client sends to
+        / receives from that port on the server's host. The receiver ends
+        the transfer with one line on this connection: the server answers a
+        uput with `OK\n` once the file is in place (or `ERR 504 udp_timeout\n`
+        etc.), the client a uget with `OK\n` or `ERR <reason>\n`. uput is
+        not replicated (`ERR 501 not_replicated\n` with --next). The SRPT
+        scheduler does not apply: the channel paces itself.
+
+    - bench-send <bytes>\n
+    - bench-recv <bytes>\n<bytes of anything>
+        Network throughput test with no disk I/O (the client's `bench`).
+        bench-send replies `OK <bytes>\n` and that many bytes generated in
+        memory; bench-recv reads and discards the body. Both then send
+        `OK <us> <cpuUs>\n`: how long the server took from first to last
+        byte and the CPU time its connection thread spent doing it. Bodies
+        use the same chunk sizing and transport (socket, shared memory, mux
+        stream) as get/put but bypass the SRPT scheduler.
+
+    - stats\n
+        Replies `OK <len>\n` and `len` bytes of `name value\n` lines:
+        connection, prefetch, scheduler, storage tier, metadata cache,
+        content index, socket tuning (see common/SocketTuner.h), worker
+        placement and UDP channel counters plus the I/O buffer pools'
+        allocation stats and high-water marks.
+
 I/O Helpers:
-    - `sendAll`, `recvExact`, `recvLine` enforce reliable framed I/O semantics.
-    - `sanitizePath` validates and builds a safe server-local destination path.
+    - `sendAll`, `recvExact`, `recvLine` (common/NetIO) enforce reliable framed I/O semantics.
+    - `sanitizePath` (common/PathUtil) validates and builds a safe server-local destination path.
     - `writeFileFromSocket`, `sendFileToSocket`, `computeFileSize` encapsulate
-      file system operations with robust, incremental I/O.
+      file system operations with robust, incremental I/O. Their transfer
+      buffers come from the shared BufferPool (common/BufferPool.h).
+
+Scheduling:
+    Bodies of put, get and getr move chunk by chunk through the
+    TransferScheduler (see TransferScheduler.h): when more transfers are
+    ready than there are slots (`--srpt-slots`, default one per CPU but at
+    least SRPT_MIN_SLOTS), the
+    one with the fewest bytes left goes next, with aging so a large
+    transfer is never starved. Small requests then finish ahead of bulk
+    ones instead of sharing the server evenly with them.
+
+Tiered storage:
+    With `--hot-tier <dir>` on a RAM-backed filesystem, new uploads land
+    in a hot tier of `--hot-tier-mb` MiB (see StorageTiers.h) and a
+    background mover demotes them to server_storage/ once they go cold
+    (or the tier is full); frequently read disk files are promoted. get,
+    getr and sget read whichever copy is current; append, copy, move and
+    sput first push a hot copy down and then work on disk as before
+    (`ERR 500 tier_busy\n` if that copy cannot be written to disk).
+    migrate.out and rebalance.out only see server_storage/: run them while
+    the server is stopped and the hot tier is empty.
+
+Concurrency:
+    Every accepted socket is served by its own thread running `serveConnection`
+    with a private CommandHandler whose builtins are bound to that connection.
+    After `mux` the connection's thread runs the MuxSession pump instead, and
+    every stream the client opens gets its own `serveConnection` thread on a
+    socketpair end, exactly like an accepted socket.
+
+Prefetch:
+    Before each request the connection peeks at the requests the client has
+    already pipelined behind it; the files of queued gets are handed to the
+    Prefetcher, whose workers issue posix_fadvise(WILLNEED) so the disk reads
+    the next files while the current one is being sent (see Prefetcher.h).
+
+Cluster mode:
+    Several servers can share the path space on a consistent-hash ring
+    (common/HashRing.h). Every node is started with the same cluster file
+    and its own `--self host:port`. A request for a path owned by another
+    node is refused with `ERR 421 misdirected <owner host:port>\n` (the body
+    of a put/append is consumed first), so clients that route with the same
+    ring never see it. copy/move between paths on different nodes is
+    `ERR 409 cross_node\n`. After changing the cluster file run rebalance.out
+    on every old node to move the files whose owner changed. For local
+    testing run each node from its own directory with its own -p, -l, -u.
+
+Replication:
+    `--next host:port` makes this server a link in a replica chain
+    (head -> ... -> tail; the tail has no --next). A put is forwarded to
+    the next replica chunk by chunk while it is being written locally, so a
+    replicated write costs about one transfer plus a round trip per hop.
+    Each replica writes a `.part` temp file and renames it into place only after
+    its successor answered OK, so the tail commits first and the client's
+    OK means every replica has the file. append bodies are streamed the
+    same way (applied on the way down); copy/move are forwarded before they
+    run locally. append-stream is refused with `ERR 501 not_replicated\n`.
+    A replica failure is `ERR 502 replica_failed\n`. Reads can go to any
+    replica; the tail only ever shows fully replicated files.
+
+Local transport:
+    Besides the TCP port the server listens on a Unix-domain socket
+    (`LOCAL_SOCKET_PATH`, or `-l <path>`). Clients on the same host connect
+    there directly, skipping the proxy and the loopback TCP stack, and may
+    upgrade the connection to the shared-memory rings with `shm`.
+
+Hot upgrade (zero-downtime restart):
+    The running server listens on a Unix socket (`UPGRADE_SOCKET_PATH`, or
+    `-u <path>`). Start the new binary with `--takeover`:
+      1) The new process connects to the upgrade socket.
+      2) The old process sends its listening sockets over SCM_RIGHTS (tag 'L'
+         for TCP, 'U' for the local socket); the new process confirms with
+         'A' and starts accepting immediately, so the port is never unbound.
+         Only then does the old process stop accepting: if the new process
+         dies first (no 'A' within UPGRADE_ACK_SECS) it keeps serving and
+         keeps the upgrade socket for another attempt.
+      3) The old process drains: requests already in flight finish normally.
+         Connections that become idle between requests are passed to the new
+         process as well (tag 'C') so keep-alive clients never see a reset.
+         `--no-idle-handoff` closes idle connections instead. Connections
+         using shared-memory rings stay with the old process until they close.
+      4) When no connections remain (or after `DRAIN_TIMEOUT_SECS`) the old
+         process sends 'E' and exits.
+
+Options:
+    -p <port>            TCP port (default SERVER_PORT)
+    -l <path>            local Unix-domain socket path (default LOCAL_SOCKET_PATH)
+    -u <path>            upgrade socket path (default UPGRADE_SOCKET_PATH)
+    --takeover           inherit the listening socket from a running server
+    --no-idle-handoff    do not pass idle connections during an upgrade
+    --layout flat|fanout on-disk layout of server_storage/ (see common/PathUtil.h);
+                         convert an existing tree with migrate.out first
+    --next <host:port>   forward writes to the next replica in a chain
+    --cluster <file>     serve only this node's share of a consistent-hash cluster
+    --self <host:port>   this node's entry in the cluster file (default localhost:<port>)
+    --no-prefetch        do not read ahead files of pipelined gets
+    --inotify            also report changes made to server_storage/ by other
+                         programs to `watch` clients
+    --hugepages          back the I/O buffer pool with hugetlbfs pages
+                         (see common/BufferPool.h)
+    --srpt-slots <n>     chunks moved at once before transfers queue by
+                         remaining size (default: CPU count, at least
+                         SRPT_MIN_SLOTS; 0 disables)
+    --hot-tier <dir>     keep new and frequently read files in a RAM tier
+                         under <dir> (tmpfs), demoted to disk when cold
+    --hot-tier-mb <n>    capacity of the hot tier (default TIER_DEFAULT_CAPACITY_MB)
+    --affinity           pin each connection's thread to a core on the NUMA node
+                         its packets arrive on, with node-local I/O buffers
+                         (see common/Affinity.h)
+    --trace <file>       record per-request spans (header parsed, path
+                         sanitized, file opened, first/last byte) in
+                         per-thread rings; `kill -USR1` writes them to
+                         <file> as Chrome trace JSON (see common/Trace.h)
+    --udp-impair <spec>  emulate a bad link on outgoing uput/uget datagrams,
+                         e.g. loss=0.01,delay=25,rate=100 (fraction, one-way
+                         ms, Mbit/s; see common/UdpTransfer.h)
+*/
+
+/*
+Connection
+----------
+    Per-connection state handed to the builtins. `sock` is the client socket
+    served by the owning thread; `local` is set for Unix-domain clients and
+    `shm` once they negotiated the shared-memory rings. Writes in a replica
+    chain go on through `replicaSock`. `muxStream` marks one stream of a
+    multiplexed connection; `ended` is set once a mux session on this socket
+    is over. File bodies go
+    through `recvBody` / `sendBody`, which pick the ring when there is one.
+*/
+struct Connection {
+    int sock;
+    bool local;
+    std::unique_ptr<ShmTransport> shm;
+    int replicaSock;    // connection to the next replica, opened on first write
+    bool muxStream;
+    bool ended;
+    SocketTuner tuner;  // chunk size and socket buffers for this peer's BDP
+    explicit Connection(int s) : sock(s), local(false), replicaSock(-1), muxStream(false), ended(false), tuner(s) {}
+    bool recvBody(void *buf, size_t len);
+    bool sendBody(const void *buf, size_t len);
+};
+
+/*
+PathPair
+--------
+    The two paths of a copy/move request: as sent by the client (logical)
+    and mapped into server_storage/ (local).
 */
+struct PathPair {
+    std::string src, dst;
+    std::string srcLocal, dstLocal;
+};
+
 class Server {
     private:
         struct sockaddr_in sin;
-        char buf[MAX_LINE];
-        socklen_t addrLen;
+        int port;
         int listenSocket;
-        int clientSocket;
-        int bytesReceived;
-        CommandHandler commandHandler;
-        bool sendAll(int sock, const void* buf, size_t len);
-        bool recvExact(int sock, void* buf, size_t len);
-        bool recvLine(int sock, std::string &out);
-        bool sanitizePath(const std::string& requested, std::string& safeOut);
-        bool writeFileFromSocket(int sock, const std::string& destPath, size_t size);
+        std::string localPath;
+        int localListenSocket;
+        std::string upgradePath;
+        int upgradeListenSocket;
+        int handoffSocket;
+        bool takeover;
+        bool idleHandoff;
+        std::atomic<bool> draining;
+        std::atomic<int> activeConnections;
+        std::mutex connMutex;
+        std::condition_variable connCv;
+        std::mutex handoffMutex;
+        NotifyHub notifyHub;
+        bool useInotify;
+        Prefetcher prefetcher;
+        bool usePrefetch;
+        TransferScheduler scheduler;
+        StorageTiers tiers;
+        MetadataCache metaCache;
+        ContentIndex contentIndex;      // after metaCache and tiers, which it uses
+        HashRing ring;
+        std::string selfNode;
+        std::string nextNode;
+        bool writeFileFromSocket(Connection &conn, const std::string& destPath, size_t size, int replicaSock = -1,
+                                 const std::string& expectSha = "", bool *hashMismatch = nullptr);
+        void receivePut(Connection &conn, const std::string& path, const std::string& safePath, size_t fileSize,
+                        const std::string& expectSha);
+        int replicaFor(Connection &conn);
+        void dropReplica(Connection &conn);
+        bool forwardToReplica(Connection &conn, const std::string& header, const std::string& payload);
         bool computeFileSize(const std::string& path, size_t &outSize);
-        bool sendFileToSocket(int sock, const std::string& path);
+        bool sendFileToSocket(Connection &conn, const std::string& path, size_t size);
+        bool sendFileRangeToSocket(Connection &conn, const std::string& path, size_t offset, size_t length);
+        bool copyFileLocal(const std::string& srcPath, const std::string& destPath);
+        bool discardBody(Connection &conn, size_t size);
+        bool recvPathPair(Connection &conn, int argc, char* argv[], PathPair &out);
+        bool ownsPath(Connection &conn, const std::string& logicalPath);
+        void publishChange(const std::string& logicalPath, const std::string& localPath);
+        void startConnection(int sock);
+        void serveConnection(int sock, bool muxStream);
+        bool waitForRequest(int sock);
+        void prefetchQueued(Connection &conn);
+        bool handOffConnection(int sock);
+        bool takeOver();
+        void handOff();
     public:
-        Server();
+        Server(int argc, char* argv[]);
         ~Server();
-        void registerCommands();
-        void builtin_put(int argc, char* argv[]);
-        void builtin_get(int argc, char* argv[]);
+        void registerCommands(CommandHandler &handler, Connection &conn);
+        void builtin_put(Connection &conn, int argc, char* argv[]);
+        void builtin_hash_put(Connection &conn, int argc, char* argv[]);
+        void builtin_get(Connection &conn, int argc, char* argv[]);
+        void builtin_get_if_changed(Connection &conn, int argc, char* argv[]);
+        // put/get with the body on a UDP data channel
+        void builtin_udp_put(Connection &conn, int argc, char* argv[]);
+        void builtin_udp_get(Connection &conn, int argc, char* argv[]);
+        // bytes from/to memory only, for telling network limits from disk ones
+        void builtin_bench_send(Connection &conn, int argc, char* argv[]);
+        void builtin_bench_recv(Connection &conn, int argc, char* argv[]);
+        void builtin_get_range(Connection &conn, int argc, char* argv[]);
+        void builtin_sparse_put(Connection &conn, int argc, char* argv[]);
+        void builtin_sparse_get(Connection &conn, int argc, char* argv[]);
+        void builtin_copy(Connection &conn, int argc, char* argv[]);
+        void builtin_move(Connection &conn, int argc, char* argv[]);
+        void builtin_append(Connection &conn, int argc, char* argv[]);
+        void builtin_append_stream(Connection &conn, int argc, char* argv[]);
+        void builtin_watch(Connection &conn, int argc, char* argv[]);
+        void builtin_shm(Connection &conn, int argc, char* argv[]);
+        void builtin_stat(Connection &conn, int argc, char* argv[]);
+        void builtin_stats(Connection &conn, int argc, char* argv[]);
+        void builtin_mux(Connection &conn, int argc, char* argv[]);
         void setup();
         void run();
 };
@@ -0,0 +1,100 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+BenchHarness
+------------
+
+    Tiny header-only microbenchmark harness shared by the bench programs.
+
+    - runBench(name, fn, bytesPerOp) calls fn() in batches, doubling the batch
+      until it has run for at least BENCH_MIN_SECONDS, and records ns/op,
+      allocations/op and (when bytesPerOp > 0) MB/s.
+    - Allocations are counted by interposing malloc/calloc/realloc, so both
+      C++ allocations (operator new) and C ones (strdup in CommandHandler)
+      made inside fn() are attributed to the benchmark. Include this header
+      from exactly one translation unit (the bench's main file).
+    - printResults() prints a table, or one JSON object per line with -j.
+*/
+
+#define BENCH_MIN_SECONDS 0.25
+
+static std::atomic<unsigned long> g_benchAllocs(0);
+
+// glibc supports interposing malloc; its own internal callers (strdup,
+// operator new in libstdc++, iostreams) go through this definition too.
+extern "C" void* __libc_malloc(size_t n);
+extern "C" void* __libc_calloc(size_t n, size_t sz);
+extern "C" void* __libc_realloc(void* p, size_t n);
+
+extern "C" void* malloc(size_t n) {
+    g_benchAllocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(n);
+}
+extern "C" void* calloc(size_t n, size_t sz) {
+    g_benchAllocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, sz);
+}
+extern "C" void* realloc(void* p, size_t n) {
+    g_benchAllocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, n);
+}
+
+struct BenchResult {
+    std::string name;
+    unsigned long iters;
+    double nsPerOp;
+    double allocsPerOp;
+    double mbPerSec;
+};
+
+static std::vector<BenchResult> g_benchResults;
+
+template <typename Fn>
+void runBench(const std::string &name, Fn fn, size_t bytesPerOp = 0) {
+    using Clock = std::chrono::steady_clock;
+    // warm-up: touch caches and let lazily-built state settle
+    for (int i = 0; i < 16; i++) fn();
+
+    unsigned long batch = 1;
+    while (true) {
+        unsigned long allocs0 = g_benchAllocs.load(std::memory_order_relaxed);
+        auto t0 = Clock::now();
+        for (unsigned long i = 0; i < batch; i++) fn();
+        double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+        unsigned long allocs = g_benchAllocs.load(std::memory_order_relaxed) - allocs0;
+        if (secs >= BENCH_MIN_SECONDS || batch >= (1UL << 30)) {
+            BenchResult r;
+            r.name = name;
+            r.iters = batch;
+            r.nsPerOp = secs * 1e9 / batch;
+            r.allocsPerOp = static_cast<double>(allocs) / batch;
+            r.mbPerSec = bytesPerOp ? (static_cast<double>(bytesPerOp) * batch) / secs / (1024.0 * 1024.0) : 0.0;
+            g_benchResults.push_back(r);
+            return;
+        }
+        batch *= 2;
+    }
+}
+
+static void printResults(bool json) {
+    for (const auto &r : g_benchResults) {
+        if (json) {
+            printf("{\"name\":\"%s\",\"iters\":%lu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+                   r.name.c_str(), r.iters, r.nsPerOp, r.allocsPerOp, r.mbPerSec);
+        } else if (r.mbPerSec > 0) {
+            printf("%-44s %12.1f ns/op %8.2f allocs/op %10.1f MB/s\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp, r.mbPerSec);
+        } else {
+            printf("%-44s %12.1f ns/op %8.2f allocs/op\n", r.name.c_str(), r.nsPerOp, r.allocsPerOp);
+        }
+    }
+}
+
+#endif // BENCH_HARNESS_H
@@ -0,0 +1,101 @@
+/*
+   microbench: per-request parsing helpers of proxy_http (proxy/http_parse.cpp)
+
+     - determineHostPortAndPath on absolute-form and origin-form requests
+     - parseHeadersToMap on a small and a browser-sized header block
+     - containsForbidden over a page-sized lowercase body with the rules
+       from proxy/forbidden.txt (clean body = full scan, dirty = early hit)
+
+   Usage: ./microbench.out [-j] [filter]
+*/
+
+#include "BenchHarness.h"
+#include "../proxy/http_parse.h"
+
+#include <string.h>
+
+static std::string g_filter;
+
+static bool wanted(const std::string &name)
+{
+	return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+static const char *kSmallHeaders =
+	"Host: httpbin.org\r\n"
+	"User-Agent: curl/8.4.0\r\n"
+	"Accept: */*\r\n"
+	"\r\n";
+
+static const char *kBrowserHeaders =
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Connection: keep-alive\r\n"
+	"Proxy-Connection: keep-alive\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Cookie: session=4f1d2c3b5a6e7f8091a2b3c4d5e6f708; theme=dark; tz=America%2FNew_York\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"Priority: u=0, i\r\n"
+	"\r\n";
+
+static void benchDetermine(const char *label, const std::string &reqLine, const std::string &headers)
+{
+	std::string name = std::string("determineHostPortAndPath/") + label;
+	if (!wanted(name)) return;
+	std::string host, port, path;
+	runBench(name, [&]() { determineHostPortAndPath(reqLine, headers, host, port, path); });
+}
+
+static void benchParseHeaders(const char *label, const std::string &headers)
+{
+	std::string name = std::string("parseHeadersToMap/") + label;
+	if (!wanted(name)) return;
+	runBench(name, [&]() { auto m = parseHeadersToMap(headers); (void)m; }, headers.size());
+}
+
+static void benchForbidden(const char *label, const std::string &bodyLower, const std::vector<std::string> &words)
+{
+	std::string name = std::string("containsForbidden/") + label;
+	if (!wanted(name)) return;
+	volatile bool hit = false;
+	runBench(name, [&]() { hit = containsForbidden(bodyLower, words); }, bodyLower.size());
+}
+
+int main(int argc, char *argv[])
+{
+	bool json = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0) json = true;
+		else g_filter = argv[i];
+	}
+
+	benchDetermine("absolute", "GET http://httpbin.org/anything?x=1 HTTP/1.1", kSmallHeaders);
+	benchDetermine("origin-small", "GET /anything?x=1 HTTP/1.1", kSmallHeaders);
+	benchDetermine("origin-browser", "GET /index.html HTTP/1.1", kBrowserHeaders);
+
+	benchParseHeaders("small", kSmallHeaders);
+	benchParseHeaders("browser", kBrowserHeaders);
+
+	// same keyword list as proxy/forbidden.txt
+	std::vector<std::string> words = { "hello", "boom", "secret", "leak" };
+	std::string filler = "<p>lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor.</p>\n";
+	for (size_t size : { 4096UL, 65536UL, 1048576UL }) {
+		std::string body;
+		while (body.size() < size) body += filler;
+		body.resize(size);
+		std::string clean = "clean-" + std::to_string(size);
+		benchForbidden(clean.c_str(), body, words);
+	}
+	{
+		std::string body;
+		while (body.size() < 65536) body += filler;
+		body.replace(1024, 6, "secret");
+		benchForbidden("dirty-65536", body, words);
+	}
+
+	printResults(json);
+	return 0;
+}
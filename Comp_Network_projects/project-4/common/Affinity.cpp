@@ -0,0 +1,195 @@
+#include "Affinity.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+static std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> out;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        std::string part = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t dash = part.find('-');
+        int first = std::atoi(part.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(part.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last && !part.empty(); cpu++) out.push_back(cpu);
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    return out;
+}
+
+static bool sameAddress(const struct sockaddr *a, const struct sockaddr *b) {
+    if (!a || !b || a->sa_family != b->sa_family) return false;
+    if (a->sa_family == AF_INET) {
+        return reinterpret_cast<const sockaddr_in *>(a)->sin_addr.s_addr == reinterpret_cast<const sockaddr_in *>(b)->sin_addr.s_addr;
+    }
+    if (a->sa_family == AF_INET6) {
+        return memcmp(&reinterpret_cast<const sockaddr_in6 *>(a)->sin6_addr, &reinterpret_cast<const sockaddr_in6 *>(b)->sin6_addr,
+                      sizeof(struct in6_addr)) == 0;
+    }
+    return false;
+}
+
+Affinity::Affinity() : on(false), steeredRxCpu(0), steeredNic(0), balanced(0) {}
+
+Affinity &Affinity::instance() {
+    static Affinity affinity;
+    return affinity;
+}
+
+bool Affinity::enable() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+
+    // Topology group: node<N>/cpulist for every node, limited to allowed CPUs
+    this->cpus.clear();
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir) {
+        while (struct dirent *entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit(static_cast<unsigned char>(entry->d_name[4]))) continue;
+            int node = std::atoi(entry->d_name + 4);
+            std::ifstream in(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            std::string list;
+            if (!std::getline(in, list)) continue;
+            for (int cpu : parseCpuList(list)) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) this->cpus.push_back(Cpu{cpu, node, 0});
+            }
+        }
+        closedir(dir);
+    }
+    if (this->cpus.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) this->cpus.push_back(Cpu{cpu, 0, 0});
+        }
+    }
+    std::sort(this->cpus.begin(), this->cpus.end(), [](const Cpu &a, const Cpu &b) { return a.id < b.id; });
+    this->nodeIds.clear();
+    for (const Cpu &cpu : this->cpus) {
+        if (std::find(this->nodeIds.begin(), this->nodeIds.end(), cpu.node) == this->nodeIds.end()) this->nodeIds.push_back(cpu.node);
+    }
+    this->on = !this->cpus.empty();
+    return this->on;
+}
+
+// Node of the interface that owns the socket's local address (-1 if unknown or virtual)
+int Affinity::nicNode(int sock) {
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    if (getsockname(sock, reinterpret_cast<struct sockaddr *>(&local), &len) != 0) return -1;
+    struct ifaddrs *addrs = nullptr;
+    if (getifaddrs(&addrs) != 0) return -1;
+    std::string ifname;
+    for (struct ifaddrs *ifa = addrs; ifa; ifa = ifa->ifa_next) {
+        if (sameAddress(ifa->ifa_addr, reinterpret_cast<struct sockaddr *>(&local))) {
+            ifname = ifa->ifa_name;
+            break;
+        }
+    }
+    freeifaddrs(addrs);
+    if (ifname.empty()) return -1;
+
+    auto it = this->nicNodes.find(ifname);
+    if (it != this->nicNodes.end()) return it->second;
+    int node = -1;
+    std::ifstream in("/sys/class/net/" + ifname + "/device/numa_node");
+    if (!(in >> node) || std::find(this->nodeIds.begin(), this->nodeIds.end(), node) == this->nodeIds.end()) node = -1;
+    this->nicNodes[ifname] = node;
+    return node;
+}
+
+int Affinity::nodeOfCpuLocked(int cpu) const {
+    for (const Cpu &c : this->cpus) {
+        if (c.id == cpu) return c.node;
+    }
+    return -1;
+}
+
+int Affinity::nodeOfCpu(int cpu) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->nodeOfCpuLocked(cpu);
+}
+
+int Affinity::placeConnection(int sock) {
+    if (!this->on) return -1;
+    std::lock_guard<std::mutex> lock(this->mtx);
+
+    // Node group: where the packets arrive, else where the NIC is, else the emptiest node
+    int node = -1;
+    int rxCpu = -1;
+    socklen_t len = sizeof(rxCpu);
+    if (getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &rxCpu, &len) == 0 && rxCpu >= 0) node = this->nodeOfCpuLocked(rxCpu);
+    if (node >= 0) {
+        this->steeredRxCpu++;
+    } else if ((node = this->nicNode(sock)) >= 0) {
+        this->steeredNic++;
+    } else {
+        std::map<int, int> load;
+        for (int id : this->nodeIds) load[id] = 0;
+        for (const Cpu &c : this->cpus) load[c.node] += c.workers;
+        node = std::min_element(load.begin(), load.end(),
+                                [](const std::pair<const int, int> &a, const std::pair<const int, int> &b) { return a.second < b.second; })->first;
+        this->balanced++;
+    }
+
+    // Core group: the node's core with the fewest workers
+    Cpu *best = nullptr;
+    for (Cpu &c : this->cpus) {
+        if (c.node == node && (!best || c.workers < best->workers)) best = &c;
+    }
+    best->workers++;
+    return best->id;
+}
+
+void Affinity::releaseCpu(int cpu) {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    for (Cpu &c : this->cpus) {
+        if (c.id == cpu && c.workers > 0) c.workers--;
+    }
+}
+
+std::string Affinity::statsText() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    std::string out;
+    out += "affinity.enabled " + std::to_string(this->on ? 1 : 0) + "\n";
+    out += "affinity.nodes " + std::to_string(this->nodeIds.size()) + "\n";
+    out += "affinity.cpus " + std::to_string(this->cpus.size()) + "\n";
+    out += "affinity.steered_rx_cpu " + std::to_string(this->steeredRxCpu.load()) + "\n";
+    out += "affinity.steered_nic " + std::to_string(this->steeredNic.load()) + "\n";
+    out += "affinity.balanced " + std::to_string(this->balanced.load()) + "\n";
+    for (int node : this->nodeIds) {
+        int workers = 0;
+        for (const Cpu &c : this->cpus) {
+            if (c.node == node) workers += c.workers;
+        }
+        out += "affinity.node" + std::to_string(node) + ".workers " + std::to_string(workers) + "\n";
+    }
+    return out;
+}
+
+PinnedThread::PinnedThread(int cpu) : cpu(cpu) {
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    BufferPool::setThreadNode(Affinity::instance().nodeOfCpu(cpu));
+}
+
+PinnedThread::~PinnedThread() {
+    if (this->cpu < 0) return;
+    BufferPool::setThreadNode(-1);
+    Affinity::instance().releaseCpu(this->cpu);
+}
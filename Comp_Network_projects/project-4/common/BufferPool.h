@@ -0,0 +1,119 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+BufferPool
+----------
+
+    Process-wide pool of fixed-size I/O buffers (BUFFER_POOL_BUF_SIZE), so
+    transfer loops reuse warm, already-faulted memory instead of allocating
+    and zeroing a fresh 64 KiB vector per request.
+
+    Buffers are carved out of 2 MiB slabs (one huge page). A slab is mapped
+    2 MiB aligned and advised MADV_HUGEPAGE; after `useHugePages(true)` it is
+    mapped from the hugetlbfs pool (MAP_HUGETLB) instead, falling back to
+    normal pages when none are reserved. Slabs are never returned to the OS.
+
+    Free buffers sit on a lock-free stack (a Treiber stack of buffer
+    indices; the head carries a tag against ABA). In front of it every thread
+    keeps a small cache of BUFFER_POOL_THREAD_CACHE buffers, so the common
+    acquire/release pair on one connection thread touches no shared cache
+    line at all. A thread's cache goes back to the shared stack when the
+    thread exits.
+
+    Use it through PooledBuffer (RAII):
+
+        PooledBuffer buffer;
+        recv(sock, buffer.data(), buffer.size(), 0);
+
+    `stats()` reports buffers in use, the high-water mark, slabs mapped and
+    how acquires were served; the server exposes it via the `stats` command.
+
+    NUMA: there is one pool per node. `instance()` is the pool of the
+    calling thread's node, set with `setThreadNode` when a worker is pinned
+    (see Affinity.h); unpinned threads share the default pool. A node's
+    slabs are mbind()-preferred to that node, so a pinned worker's buffers
+    stay in node-local memory even when they travel through the shared
+    stack. A buffer always goes back to the pool it came from.
+*/
+
+#define BUFFER_POOL_BUF_SIZE (64 * 1024)
+#define BUFFER_POOL_SLAB_SIZE (2 * 1024 * 1024)
+#define BUFFER_POOL_MAX_SLABS 2048
+#define BUFFER_POOL_THREAD_CACHE 4
+#define BUFFER_POOL_MAX_NODES 8
+
+struct BufferPoolStats {
+    uint64_t acquires;          // total acquire() calls
+    uint64_t threadCacheHits;   // served from the calling thread's cache
+    uint64_t sharedHits;        // served from the shared free stack
+    uint64_t slabs;             // slabs mapped so far
+    uint64_t hugeSlabs;         // of those, backed by MAP_HUGETLB
+    uint64_t inUse;             // buffers currently handed out
+    uint64_t highWater;         // most buffers ever in use at once
+    uint64_t failures;          // acquires that had to fall back to the heap
+};
+
+class BufferPool {
+    private:
+        static const uint32_t NONE = 0xffffffffu;
+        static const uint32_t PER_SLAB = BUFFER_POOL_SLAB_SIZE / BUFFER_POOL_BUF_SIZE;
+
+        std::atomic<char *> slabs[BUFFER_POOL_MAX_SLABS];
+        std::atomic<uint32_t> next[BUFFER_POOL_MAX_SLABS * PER_SLAB];   // free-stack links
+        std::atomic<uint64_t> freeHead;     // (tag << 32) | index
+        std::atomic<uint32_t> slabCount;
+        int node;                           // -1: the default pool, not bound to a node
+
+        std::atomic<uint64_t> acquires, threadCacheHits, sharedHits, hugeSlabs, inUse, highWater, failures;
+
+        explicit BufferPool(int node);
+        uint32_t popShared();
+        void pushShared(uint32_t index);
+        bool growSlab();
+        void noteAcquire();
+
+    public:
+        // pool of the calling thread's node
+        static BufferPool &instance();
+        static BufferPool &forNode(int node);
+        // node whose pool this thread uses from now on (-1: the default pool)
+        static void setThreadNode(int node);
+
+        // Index of a free buffer (NONE if the pool is exhausted)
+        uint32_t acquire();
+        void release(uint32_t index);
+        char *data(uint32_t index);
+        // For every pool; must be called before the first acquire to have any effect
+        static void useHugePages(bool enable);
+        BufferPoolStats stats();
+        std::string statsText();
+        // statsText of the default pool plus a bufpool.node<N>.* block per node pool in use
+        static std::string allStatsText();
+
+        friend struct BufferPoolThreadCache;
+        friend class PooledBuffer;
+};
+
+// One pooled buffer for the lifetime of the object (heap fallback if the pool is full)
+class PooledBuffer {
+    private:
+        BufferPool *pool;
+        uint32_t index;
+        char *ptr;
+
+    public:
+        PooledBuffer();
+        ~PooledBuffer();
+        PooledBuffer(const PooledBuffer &) = delete;
+        PooledBuffer &operator=(const PooledBuffer &) = delete;
+        char *data() { return this->ptr; }
+        size_t size() const { return BUFFER_POOL_BUF_SIZE; }
+};
+
+#endif // BUFFER_POOL_H
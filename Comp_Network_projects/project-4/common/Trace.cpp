@@ -0,0 +1,236 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct TraceEvent {
+    std::atomic<uint64_t> seq;      // odd while the slot is being written
+    uint64_t startUs;
+    uint64_t durUs;
+    uint64_t request;
+    uint32_t tid;
+    char phase;                     // 'X' span, 'i' instant
+    char name[TRACE_NAME_LEN];
+    char detail[TRACE_DETAIL_LEN];
+};
+
+struct TraceRing {
+    std::atomic<uint64_t> head;
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static std::atomic<bool> traceOn(false);
+static std::string tracePath;
+static const char *traceCategory = "";
+static std::atomic<uint64_t> nextRequest(1);
+// never destroyed: threads may hand their rings back during exit
+static std::mutex &ringsMtx = *new std::mutex();
+static std::vector<TraceRing *> &rings = *new std::vector<TraceRing *>();       // every ring ever made, for the dump
+static std::vector<TraceRing *> &freeRings = *new std::vector<TraceRing *>();   // rings whose thread has exited
+static int wakePipe[2] = {-1, -1};
+
+// The calling thread's ring (taken on first use) and current request
+struct TraceThread {
+    TraceRing *ring = nullptr;
+    uint32_t tid = 0;
+    TraceRequest *request = nullptr;
+
+    ~TraceThread() {
+        if (!this->ring) return;
+        std::lock_guard<std::mutex> lock(ringsMtx);
+        freeRings.push_back(this->ring);
+    }
+};
+
+static thread_local TraceThread traceThread;
+
+static uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void copyText(char *dst, size_t cap, const char *src) {
+    size_t n = strnlen(src, cap - 1);
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+static void record(char phase, const char *name, const char *detail, uint64_t request, uint64_t startUs, uint64_t durUs) {
+    TraceThread &t = traceThread;
+    if (!t.ring) {
+        std::lock_guard<std::mutex> lock(ringsMtx);
+        if (!freeRings.empty()) {
+            t.ring = freeRings.back();
+            freeRings.pop_back();
+        } else {
+            t.ring = new TraceRing();
+            t.ring->head.store(0);
+            for (TraceEvent &ev : t.ring->events) ev.seq.store(0);
+            rings.push_back(t.ring);
+        }
+        t.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    }
+    uint64_t index = t.ring->head.load(std::memory_order_relaxed);
+    TraceEvent &ev = t.ring->events[index % TRACE_RING_EVENTS];
+    ev.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ev.startUs = startUs;
+    ev.durUs = durUs;
+    ev.request = request;
+    ev.tid = t.tid;
+    ev.phase = phase;
+    copyText(ev.name, sizeof(ev.name), name);
+    copyText(ev.detail, sizeof(ev.detail), detail);
+    ev.seq.store(2 * index + 2, std::memory_order_release);
+    t.ring->head.store(index + 1, std::memory_order_release);
+}
+
+static void onDumpSignal(int) {
+    char c = 'D';
+    ssize_t ignored = write(wakePipe[1], &c, 1);
+    (void)ignored;
+}
+
+bool Trace::enable(const std::string &path, const char *category) {
+    if (traceOn) return true;
+    if (pipe(wakePipe) != 0) return false;
+    tracePath = path;
+    traceCategory = category;
+    // dumps run on their own thread: the signal handler only wakes it
+    std::thread([]() {
+        char c;
+        while (read(wakePipe[0], &c, 1) > 0) {
+            if (Trace::dump(tracePath)) fprintf(stderr, "trace: wrote %s\n", tracePath.c_str());
+            else fprintf(stderr, "trace: cannot write %s\n", tracePath.c_str());
+        }
+    }).detach();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onDumpSignal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, nullptr);
+    traceOn = true;
+    return true;
+}
+
+bool Trace::enabled() {
+    return traceOn.load(std::memory_order_relaxed);
+}
+
+void Trace::instant(const char *name, const std::string &detail) {
+    if (!Trace::enabled()) return;
+    TraceRequest *req = traceThread.request;
+    record('i', name, detail.c_str(), req ? req->id : 0, nowUs(), 0);
+}
+
+void Trace::stage(const char *name, const std::string &detail) {
+    TraceRequest *req = traceThread.request;
+    if (!req) return;
+    uint64_t now = nowUs();
+    if (!detail.empty() && req->detail[0] == '\0') copyText(req->detail, sizeof(req->detail), detail.c_str());
+    record('X', name, detail.c_str(), req->id, req->lastUs, now - req->lastUs);
+    req->lastUs = now;
+}
+
+static void appendJsonString(std::string &out, const char *s) {
+    out += '"';
+    for (; *s; s++) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+bool Trace::dump(const std::string &path) {
+    std::vector<TraceRing *> all;
+    {
+        std::lock_guard<std::mutex> lock(ringsMtx);
+        all = rings;
+    }
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    std::string pid = std::to_string(getpid());
+    for (TraceRing *ring : all) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for (uint64_t i = begin; i < head; i++) {
+            // Copy group: take the slot only if no writer touched it meanwhile
+            TraceEvent &slot = ring->events[i % TRACE_RING_EVENTS];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq != 2 * i + 2) continue;
+            uint64_t startUs = slot.startUs, durUs = slot.durUs, request = slot.request;
+            uint32_t tid = slot.tid;
+            char phase = slot.phase;
+            char name[TRACE_NAME_LEN], detail[TRACE_DETAIL_LEN];
+            memcpy(name, slot.name, sizeof(name));
+            memcpy(detail, slot.detail, sizeof(detail));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+            name[sizeof(name) - 1] = '\0';
+            detail[sizeof(detail) - 1] = '\0';
+
+            if (!first) out += ",\n";
+            first = false;
+            out += "{\"name\":";
+            appendJsonString(out, name);
+            out += ",\"cat\":";
+            appendJsonString(out, traceCategory);
+            out += ",\"ph\":\"";
+            out += phase;
+            out += "\",\"ts\":" + std::to_string(startUs);
+            if (phase == 'X') out += ",\"dur\":" + std::to_string(durUs);
+            else out += ",\"s\":\"t\"";
+            out += ",\"pid\":" + pid + ",\"tid\":" + std::to_string(tid);
+            out += ",\"args\":{\"request\":" + std::to_string(request) + ",\"detail\":";
+            appendJsonString(out, detail);
+            out += "}}";
+        }
+    }
+    out += "\n]}\n";
+
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) return false;
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp.c_str(), path.c_str()) != 0) ok = false;
+    if (!ok) unlink(tmp.c_str());
+    return ok;
+}
+
+TraceRequest::TraceRequest(const char *name, const std::string &detail)
+    : active(false), id(0), startUs(0), lastUs(0) {
+    if (!Trace::enabled() || traceThread.request) return;
+    this->active = true;
+    this->id = nextRequest++;
+    this->startUs = this->lastUs = nowUs();
+    copyText(this->name, sizeof(this->name), name);
+    copyText(this->detail, sizeof(this->detail), detail.c_str());
+    traceThread.request = this;
+}
+
+TraceRequest::~TraceRequest() {
+    if (!this->active) return;
+    traceThread.request = nullptr;
+    record('X', this->name, this->detail, this->id, this->startUs, nowUs() - this->startUs);
+}
+
+void TraceRequest::setName(const std::string &name) {
+    if (this->active) copyText(this->name, sizeof(this->name), name.c_str());
+}
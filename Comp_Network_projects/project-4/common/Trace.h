@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// events kept per thread; older ones are overwritten
+#define TRACE_RING_EVENTS 4096
+#define TRACE_NAME_LEN 24
+#define TRACE_DETAIL_LEN 64
+
+/*
+Trace
+-----
+
+    Lightweight per-request tracing (`--trace <file>`), dumped in the Chrome
+    trace event format that chrome://tracing and ui.perfetto.dev load.
+
+    A request is a TraceRequest on the thread serving it. Code on that
+    thread marks the points the request passes with `Trace::stage(name)`;
+    each stage becomes a span from the previous mark (or the start of the
+    request) up to the named point, so in the viewer a request is one bar
+    with its phases laid out beneath it:
+
+        get [request]
+          header_parsed  path_sanitized  file_opened  first_byte  last_byte
+
+    `Trace::instant` records a single point (e.g. accept). Stages and
+    instants outside a request, or while tracing is off, cost a
+    thread-local check and nothing else.
+
+    Storage: every thread writes into its own ring of TRACE_RING_EVENTS
+    slots (no locks or shared cache lines on the hot path). A ring is
+    registered once and reused by a later thread after its owner exits, so
+    memory stays bounded by the peak thread count. Slots carry a sequence
+    number and the dump skips any slot being rewritten while it is copied.
+
+    SIGUSR1 writes the current contents of all rings to the trace file
+    (overwriting it); `kill -USR1 <pid>` whenever a slow transfer needs a
+    look.
+*/
+
+class Trace {
+    public:
+        // turn tracing on; `category` tags every event (e.g. "server")
+        static bool enable(const std::string &path, const char *category);
+        static bool enabled();
+        static void instant(const char *name, const std::string &detail = "");
+        // close the current stage of this thread's request at `name`; the
+        // first non-empty `detail` also becomes the request's detail
+        static void stage(const char *name, const std::string &detail = "");
+        // write every ring as Chrome trace JSON
+        static bool dump(const std::string &path);
+};
+
+/*
+TraceRequest
+------------
+    One request on the calling thread, from construction to destruction.
+    `setName` renames it once the request type is known (the server only
+    learns the command after parsing the header line).
+*/
+class TraceRequest {
+    private:
+        bool active;
+        uint64_t id;
+        uint64_t startUs;
+        uint64_t lastUs;
+        char name[TRACE_NAME_LEN];
+        char detail[TRACE_DETAIL_LEN];
+
+        friend class Trace;
+
+    public:
+        explicit TraceRequest(const char *name, const std::string &detail = "");
+        ~TraceRequest();
+        TraceRequest(const TraceRequest &) = delete;
+        TraceRequest &operator=(const TraceRequest &) = delete;
+        void setName(const std::string &name);
+};
+
+#endif // TRACE_H
@@ -0,0 +1,28 @@
+#ifndef UNIX_SOCK_H
+#define UNIX_SOCK_H
+
+#include <string>
+
+/*
+UnixSock
+--------
+
+    AF_UNIX stream helpers used for same-host control channels.
+
+    - listenUnix  : unlink any stale socket file, bind and listen on `path`
+    - connectUnix : connect to the socket at `path`
+    - sendFd      : send one tag byte, optionally carrying a file descriptor
+                    as SCM_RIGHTS ancillary data (fd < 0 sends the tag only)
+    - recvFd      : receive one tag byte and the descriptor that came with
+                    it (or -1). Returns false on EOF/error.
+
+    The hot-upgrade handoff uses these to pass the listening socket and idle
+    client connections from the old process to the new one.
+*/
+
+int listenUnix(const std::string &path, int backlog);
+int connectUnix(const std::string &path);
+bool sendFd(int unixSock, char tag, int fd);
+bool recvFd(int unixSock, char &tag, int &fdOut);
+
+#endif // UNIX_SOCK_H
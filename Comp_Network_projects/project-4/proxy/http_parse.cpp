@@ -0,0 +1,123 @@
+#include "http_parse.h"
+
+#include <sstream>
+#include <ctype.h>
+
+std::string toLowerCopy(const std::string &s) {
+	std::string r = s;
+	for (char &c : r) c = (char)tolower((unsigned char)c);
+	return r;
+}
+
+// check substring match case-insensitive between haystackLower and any forbidden word
+bool containsForbidden(const std::string &haystackLower, const std::vector<std::string> &forbidden)
+{
+	for (const auto &w : forbidden) {
+		if (w.empty()) continue;
+		if (haystackLower.find(w) != std::string::npos) return true;
+	}
+	return false;
+}
+
+// parse host:port from an URL (absolute URI) or Host header fallback
+// Outputs host (string), port (string), and pathToSend (string) which is the origin-form path to send to server.
+bool determineHostPortAndPath(const std::string &requestLine, const std::string &headers, std::string &hostOut, std::string &portOut, std::string &pathOut) 
+{
+	std::istringstream iss(requestLine);
+	std::string method, uri, version;
+	if (!(iss >> method >> uri >> version)) return false;
+	// If uri begins with "http://" or "https://", parse out host and path
+	if (uri.rfind("http://", 0) == 0 || uri.rfind("https://", 0) == 0) {
+		// strip scheme
+		size_t pos = uri.find("://");
+		size_t start = (pos==std::string::npos)?0:pos+3;
+		size_t slash = uri.find('/', start);
+		std::string authority = (slash == std::string::npos) ? uri.substr(start) : uri.substr(start, slash - start);
+		pathOut = (slash == std::string::npos) ? "/" : uri.substr(slash);
+		// authority may contain port
+		size_t col = authority.find(':');
+		if (col != std::string::npos) {
+			hostOut = authority.substr(0, col);
+			portOut = authority.substr(col + 1);
+		} 
+        else {
+			hostOut = authority;
+			// default port
+			if (uri.rfind("https://", 0) == 0) portOut = "443";
+			else portOut = "80";
+		}
+		return true;
+	} 
+    else {
+		// origin-form: use Host header
+		// extract Host header from headers string
+		std::istringstream hs(headers);
+		std::string line;
+		std::string hostHeader;
+		while (std::getline(hs, line)) {
+			if (line.size() > 5 && (line[0]=='H' || line[0]=='h')) {
+				// transform to lower for safe compare
+				std::string lower=line;
+				for(char &c: lower) c=tolower((unsigned char)c);
+				if (lower.rfind("host:", 0) == 0) {
+					hostHeader = line.substr(5);
+					break;
+				}
+			}
+		}
+		// trim whitespace
+		auto trim = [](std::string &s) {
+			size_t a = s.find_first_not_of(" \t");
+			size_t b = s.find_last_not_of(" \t\r\n");
+			if (a==std::string::npos || b==std::string::npos) {
+				s.clear();
+				return;
+			}
+			s = s.substr(a, b-a+1);
+		};
+		trim(hostHeader);
+		if (hostHeader.empty()) return false;
+		size_t colon = hostHeader.find(':');
+		if (colon != std::string::npos) {
+			hostOut = hostHeader.substr(0, colon);
+			portOut = hostHeader.substr(colon + 1);
+		} 
+        else {
+			hostOut = hostHeader;
+			portOut = "80";
+		}
+		// path is the uri itself (origin-form)
+		pathOut = uri;
+		return true;
+	}
+}
+
+// Helper: parse headers into map<string,string> (lowercased keys)
+std::map<std::string,std::string> parseHeadersToMap(const std::string &headers)
+{
+	std::map<std::string,std::string> m;
+	std::istringstream hs(headers);
+	std::string line;
+	while (std::getline(hs, line)) {
+		if (!line.empty() && line.back()=='\r') line.pop_back();
+		if (line.empty()) continue;
+		size_t pos = line.find(':');
+		if (pos==std::string::npos) continue;
+		std::string k = line.substr(0,pos);
+		std::string v = line.substr(pos+1);
+		// trim
+		auto trim = [](std::string &s) {
+			size_t a = s.find_first_not_of(" \t");
+			size_t b = s.find_last_not_of(" \t\r\n");
+			if (a==std::string::npos || b==std::string::npos) {
+				s.clear();
+				return;
+			}
+			s = s.substr(a, b-a+1);
+		};
+		trim(k); trim(v);
+		for (char &c : k) c = (char)tolower((unsigned char)c);
+		m[k] = v;
+	}
+	return m;
+}
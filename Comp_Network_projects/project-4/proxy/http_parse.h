@@ -0,0 +1,26 @@
+#ifndef HTTP_PARSE_H
+#define HTTP_PARSE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+   Request/response parsing helpers used by client_thread in proxy_http.cpp.
+   They are kept in their own translation unit so bench/microbench.cpp can
+   link exactly the code the proxy runs on every request.
+*/
+
+// lowercase copy of s (ASCII)
+std::string toLowerCopy(const std::string &s);
+
+// check substring match case-insensitive between haystackLower and any forbidden word
+bool containsForbidden(const std::string &haystackLower, const std::vector<std::string> &forbidden);
+
+// parse host:port from an URL (absolute URI) or Host header fallback
+bool determineHostPortAndPath(const std::string &requestLine, const std::string &headers, std::string &hostOut, std::string &portOut, std::string &pathOut);
+
+// parse headers into map<string,string> (lowercased keys)
+std::map<std::string,std::string> parseHeadersToMap(const std::string &headers);
+
+#endif // HTTP_PARSE_H
@@ -5,6 +5,7 @@
 */
 
 #include "proxy_http.h"
+#include "http_parse.h"
 
 // Forward declarations
 void *client_thread(void *arg);
@@ -13,6 +14,11 @@ void *client_thread(void *arg);
 static std::vector<std::string> forbiddenWords;
 static std::vector<std::string> forbiddenSites;
 
+// Number of running client threads, so a hot upgrade can drain before exiting
+static int activeClients = 0;
+static pthread_mutex_t activeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t activeCond = PTHREAD_COND_INITIALIZER;
+
 // Utility: print timestamped log
 void logf(const char *fmt, ...) 
 {
@@ -200,22 +206,6 @@ static void loadForbiddenSingleFile(const char *filename)
 	     forbiddenWords.size(), forbiddenSites.size(), filename);
 }
 
-static std::string toLowerCopy(const std::string &s) {
-	std::string r = s;
-	for (char &c : r) c = (char)tolower((unsigned char)c);
-	return r;
-}
-
-// check substring match case-insensitive between haystackLower and any forbidden word
-static bool containsForbidden(const std::string &haystackLower, const std::vector<std::string> &forbidden)
-{
-	for (const auto &w : forbidden) {
-		if (w.empty()) continue;
-		if (haystackLower.find(w) != std::string::npos) return true;
-	}
-	return false;
-}
-
 // send a simple HTML error response (code like "403", reason like "Forbidden")
 static void sendErrorHtml(int clientSock, const char *code, const char *reason, const char *bodytext)
 {
@@ -232,79 +222,6 @@ static void sendErrorHtml(int clientSock, const char *code, const char *reason,
 	sendAll(clientSock, s.c_str(), s.size());
 }
 
-// parse host:port from an URL (absolute URI) or Host header fallback
-// Outputs host (string), port (string), and pathToSend (string) which is the origin-form path to send to server.
-bool determineHostPortAndPath(const std::string &requestLine, const std::string &headers, std::string &hostOut, std::string &portOut, std::string &pathOut) 
-{
-	std::istringstream iss(requestLine);
-	std::string method, uri, version;
-	if (!(iss >> method >> uri >> version)) return false;
-	// If uri begins with "http://" or "https://", parse out host and path
-	if (uri.rfind("http://", 0) == 0 || uri.rfind("https://", 0) == 0) {
-		// strip scheme
-		size_t pos = uri.find("://");
-		size_t start = (pos==std::string::npos)?0:pos+3;
-		size_t slash = uri.find('/', start);
-		std::string authority = (slash == std::string::npos) ? uri.substr(start) : uri.substr(start, slash - start);
-		pathOut = (slash == std::string::npos) ? "/" : uri.substr(slash);
-		// authority may contain port
-		size_t col = authority.find(':');
-		if (col != std::string::npos) {
-			hostOut = authority.substr(0, col);
-			portOut = authority.substr(col + 1);
-		} 
-        else {
-			hostOut = authority;
-			// default port
-			if (uri.rfind("https://", 0) == 0) portOut = "443";
-			else portOut = "80";
-		}
-		return true;
-	} 
-    else {
-		// origin-form: use Host header
-		// extract Host header from headers string
-		std::istringstream hs(headers);
-		std::string line;
-		std::string hostHeader;
-		while (std::getline(hs, line)) {
-			if (line.size() > 5 && (line[0]=='H' || line[0]=='h')) {
-				// transform to lower for safe compare
-				std::string lower=line;
-				for(char &c: lower) c=tolower((unsigned char)c);
-				if (lower.rfind("host:", 0) == 0) {
-					hostHeader = line.substr(5);
-					break;
-				}
-			}
-		}
-		// trim whitespace
-		auto trim = [](std::string &s) {
-			size_t a = s.find_first_not_of(" \t");
-			size_t b = s.find_last_not_of(" \t\r\n");
-			if (a==std::string::npos || b==std::string::npos) {
-				s.clear();
-				return;
-			}
-			s = s.substr(a, b-a+1);
-		};
-		trim(hostHeader);
-		if (hostHeader.empty()) return false;
-		size_t colon = hostHeader.find(':');
-		if (colon != std::string::npos) {
-			hostOut = hostHeader.substr(0, colon);
-			portOut = hostHeader.substr(colon + 1);
-		} 
-        else {
-			hostOut = hostHeader;
-			portOut = "80";
-		}
-		// path is the uri itself (origin-form)
-		pathOut = uri;
-		return true;
-	}
-}
-
 // connect to server by host:port; returns socket fd or -1
 int connectToHostPort(const std::string &host, const std::string &port, std::string *resolvedIP = nullptr) 
 {
@@ -314,6 +231,7 @@ int connectToHostPort(const std::string &host, const std::string &port, std::str
 	hints.ai_socktype = SOCK_STREAM;
 
 	int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	Trace::stage("dns", host);
 	if (rv != 0) {
 		logf("getaddrinfo(%s:%s) failed: %s", host.c_str(), port.c_str(), gai_strerror(rv));
 		return -1;
@@ -338,6 +256,7 @@ int connectToHostPort(const std::string &host, const std::string &port, std::str
 		break;
 	}
 	freeaddrinfo(res);
+	Trace::stage("connect");
 	return s;
 }
 
@@ -347,7 +266,7 @@ void tunnelRelay(int clientSock, int serverSock)
 {
 	// Use two threads or simple loop with select; simple loop with splice-like behavior:
 	fd_set readfds;
-	char buf[BUF_SIZE];
+	PooledBuffer buf;
 	int maxfd = std::max(clientSock, serverSock) + 1;
 	bool clientOpen = true, serverOpen = true;
 	while (clientOpen && serverOpen) {
@@ -357,26 +276,26 @@ void tunnelRelay(int clientSock, int serverSock)
 		int rv = select(maxfd, &readfds, nullptr, nullptr, nullptr);
 		if (rv <= 0) break;
 		if (FD_ISSET(clientSock, &readfds)) {
-			ssize_t n = recv(clientSock, buf, sizeof(buf), 0);
+			ssize_t n = recv(clientSock, buf.data(), buf.size(), 0);
 			if (n <= 0) {
 				clientOpen = false;
 				shutdown(serverSock, SHUT_WR);
 			}
 			else {
-				if (sendAll(serverSock, buf, (size_t)n) <= 0) {
+				if (sendAll(serverSock, buf.data(), (size_t)n) <= 0) {
 					serverOpen = false;
 					shutdown(clientSock, SHUT_RD);
 				}
 			}
 		}
 		if (FD_ISSET(serverSock, &readfds)) {
-			ssize_t n = recv(serverSock, buf, sizeof(buf), 0);
+			ssize_t n = recv(serverSock, buf.data(), buf.size(), 0);
 			if (n <= 0) {
 				serverOpen = false;
 				shutdown(clientSock, SHUT_WR);
 			}
 			else {
-				if (sendAll(clientSock, buf, (size_t)n) <= 0) {
+				if (sendAll(clientSock, buf.data(), (size_t)n) <= 0) {
 					clientOpen = false;
 					shutdown(serverSock, SHUT_RD);
 				}
@@ -385,36 +304,6 @@ void tunnelRelay(int clientSock, int serverSock)
 	}
 }
 
-// Helper: parse headers into map<string,string> (lowercased keys)
-static std::map<std::string,std::string> parseHeadersToMap(const std::string &headers)
-{
-	std::map<std::string,std::string> m;
-	std::istringstream hs(headers);
-	std::string line;
-	while (std::getline(hs, line)) {
-		if (!line.empty() && line.back()=='\r') line.pop_back();
-		if (line.empty()) continue;
-		size_t pos = line.find(':');
-		if (pos==std::string::npos) continue;
-		std::string k = line.substr(0,pos);
-		std::string v = line.substr(pos+1);
-		// trim
-		auto trim = [](std::string &s) {
-			size_t a = s.find_first_not_of(" \t");
-			size_t b = s.find_last_not_of(" \t\r\n");
-			if (a==std::string::npos || b==std::string::npos) {
-				s.clear();
-				return;
-			}
-			s = s.substr(a, b-a+1);
-		};
-		trim(k); trim(v);
-		for (char &c : k) c = (char)tolower((unsigned char)c);
-		m[k] = v;
-	}
-	return m;
-}
-
 // Read chunked response from serverSock. We will collect both raw bytes (including chunk headers and CRLFs)
 // into rawOut (so we can forward the response unchanged) and collect decoded data bytes into decodedOut (for searching).
 // Returns true on success, false on error or if forbidden content detected (503 already sent).
@@ -487,7 +376,7 @@ static bool readChunkedResponse(int serverSock, int clientSock, std::string &raw
 static bool readContentLengthResponse(int serverSock, int clientSock, size_t contentLength, std::string &rawOut, std::string &decodedOut)
 {
 	size_t remaining = contentLength;
-	std::vector<char> buffer(BUF_SIZE);
+	PooledBuffer buffer;
 	std::string decodedLower;
 	while (remaining > 0) {
 		size_t toRead = (remaining < buffer.size())?remaining:buffer.size();
@@ -512,7 +401,7 @@ static bool readContentLengthResponse(int serverSock, int clientSock, size_t con
 // This scans incrementally and will send 503 immediately if forbidden content is found.
 static bool readUntilCloseResponse(int serverSock, int clientSock, std::string &rawOut, std::string &decodedOut)
 {
-	std::vector<char> buffer(BUF_SIZE);
+	PooledBuffer buffer;
 	ssize_t n;
 	std::string decodedLower;
 	while ((n = recv(serverSock, buffer.data(), buffer.size(), 0)) > 0) {
@@ -535,6 +424,8 @@ void *client_thread(void *arg)
 {
 	int clientSock = *((int*)arg);
 	free(arg);
+	// with --trace: one span per client, its stages beneath it
+	TraceRequest trace("request");
 
 	// Set a generous recv timeout to avoid hanging forever (optional)
 	struct timeval tv;
@@ -556,6 +447,7 @@ void *client_thread(void *arg)
 	}
 
 	logf("Received request-line: %s", reqLine.c_str());
+	Trace::stage("headers", reqLine);
 
 	// read possible request body (Content-Length) into local buffer BEFORE connecting so we can inspect it
 	size_t reqContentLength = 0;
@@ -592,7 +484,7 @@ void *client_thread(void *arg)
 	if (reqContentLength > 0) {
 		reqBody.reserve(reqContentLength);
 		size_t remaining = reqContentLength;
-		std::vector<char> buf(BUF_SIZE);
+		PooledBuffer buf;
 		while (remaining > 0) {
 			size_t chunk = (remaining < buf.size()) ? remaining : buf.size();
 			ssize_t n = recv(clientSock, buf.data(), chunk, 0);
@@ -600,6 +492,7 @@ void *client_thread(void *arg)
 			reqBody.append(buf.data(), (size_t)n);
 			remaining -= (size_t)n;
 		}
+		Trace::stage("request_body");
 	}
 
 	// Quick check: if request-line (without query) or headers or body contain forbidden words -> 403
@@ -611,6 +504,7 @@ void *client_thread(void *arg)
 		close(clientSock);
 		return nullptr;
 	}
+	trace.setName(method);
 	// remove query string from uri for request filtering
 	std::string uriNoQuery = uri;
 	size_t qpos = uriNoQuery.find('?');
@@ -620,7 +514,9 @@ void *client_thread(void *arg)
 	std::string combinedReq = method + " " + uriNoQuery + " " + version + "\r\n" + headers + reqBody;
 	std::string combinedReqLower = toLowerCopy(combinedReq);
 
-	if (containsForbidden(combinedReqLower, forbiddenWords)) {
+	bool forbiddenInRequest = containsForbidden(combinedReqLower, forbiddenWords);
+	Trace::stage("filter");
+	if (forbiddenInRequest) {
 		logf("Blocking request from client: forbidden word in request (headers/path/body)");
 		sendErrorHtml(clientSock, "403", "Forbidden", "Your request contains forbidden words and was blocked by the proxy.");
 		close(clientSock);
@@ -661,6 +557,7 @@ void *client_thread(void *arg)
 		logf("Tunnel established to %s (%s:%s)", host.c_str(), resolved.c_str(), port.c_str());
 		// now relay data both ways until closed
 		tunnelRelay(clientSock, serverSock);
+		Trace::stage("tunnel");
 		close(serverSock);
 		close(clientSock);
 		logf("Tunnel closed for %s:%s", host.c_str(), port.c_str());
@@ -747,6 +644,7 @@ void *client_thread(void *arg)
 			return nullptr;
 		}
 	}
+	Trace::stage("send_request");
 
 	
 	// If any forbidden word is found in the response body -> return 503 to client instead of forwarding original.
@@ -766,6 +664,8 @@ void *client_thread(void *arg)
 		return nullptr;
 	}
 
+	Trace::stage("response_headers", statusLine);
+
 	// Build full headers block to send later
 	std::string responseHeaderBlock = statusLine + "\r\n" + serverHeaders;
 
@@ -809,6 +709,7 @@ void *client_thread(void *arg)
 		readOk = readUntilCloseResponse(serverSock, clientSock, rawBody, decodedBody);
 	}
 
+	Trace::stage("response_body");
 	if (!readOk) {
 		// If read failed due to forbidden content, the function already sent 503.
 		// Either way, we should close sockets and stop.
@@ -820,6 +721,7 @@ void *client_thread(void *arg)
 	std::string decodedLower = toLowerCopy(decodedBody);
 
 	bool forbiddenInResponse = containsForbidden(decodedLower, forbiddenWords);
+	Trace::stage("filter");
 	if (forbiddenInResponse) {
 		logf("Blocking response from server: forbidden content detected");
 		sendErrorHtml(clientSock, "503", "Service Unavailable", "The server response contains forbidden content and was blocked by the proxy.");
@@ -841,6 +743,7 @@ void *client_thread(void *arg)
 			logf("Failed sending response body to client");
 		}
 	}
+	Trace::stage("reply");
 
 	// close connections
 	close(serverSock);
@@ -849,6 +752,118 @@ void *client_thread(void *arg)
 	return nullptr;
 }
 
+// Thread entry: run client_thread and account for it in activeClients.
+// arg is {clientSock, cpu}; with --affinity the thread stays on that core.
+static void *client_thread_counted(void *arg)
+{
+	int cpu = ((int*)arg)[1];
+	{
+		PinnedThread pin(cpu);
+		client_thread(arg);
+	}
+	pthread_mutex_lock(&activeMutex);
+	activeClients--;
+	pthread_cond_broadcast(&activeCond);
+	pthread_mutex_unlock(&activeMutex);
+	return nullptr;
+}
+
+// Waits for the previous proxy's end-of-drain message on the upgrade channel
+static void *upgrade_watch_thread(void *arg)
+{
+	int u = *((int*)arg);
+	free(arg);
+	char tag = 0;
+	int ignored = -1;
+	while (recvFd(u, tag, ignored) && tag != 'E') {}
+	close(u);
+	logf("Previous proxy drained and exited");
+	return nullptr;
+}
+
+// New process side of a hot upgrade: receive the listening socket from the
+// running proxy over the upgrade socket and confirm it with 'A'. Returns the
+// socket or -1.
+static int takeOverListenSocket(const std::string &upgradePath)
+{
+	int u = connectUnix(upgradePath);
+	if (u < 0) return -1;
+	char tag = 0;
+	int fd = -1;
+	if (!recvFd(u, tag, fd) || tag != 'L' || fd < 0) {
+		close(u);
+		return -1;
+	}
+	// until this arrives the old proxy keeps accepting
+	if (!sendFd(u, 'A', -1)) {
+		close(fd);
+		close(u);
+		return -1;
+	}
+	// the old proxy keeps the channel open until it has drained; log when it goes away
+	int *pu = (int*)malloc(sizeof(int));
+	*pu = u;
+	pthread_t tid;
+	if (pthread_create(&tid, NULL, upgrade_watch_thread, pu) == 0) pthread_detach(tid);
+	else { close(u); free(pu); }
+	return fd;
+}
+
+// Old process side of a hot upgrade: pass the listening socket, and once
+// the new process confirms it, stop accepting, wait for in-flight requests
+// and tunnels, then tell the new process we are done. Returns false (with
+// both sockets still open) if the handoff did not happen.
+static bool handOffAndDrain(int upgradeListenSock, int listenSock)
+{
+	int s = accept(upgradeListenSock, NULL, NULL);
+	if (s < 0) {
+		perror("upgrade accept");
+		return false;
+	}
+	if (!sendFd(s, 'L', listenSock)) {
+		perror("upgrade: send listen socket");
+		close(s);
+		return false;
+	}
+	struct pollfd pfd;
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	char tag = 0;
+	int fd = -1;
+	if (poll(&pfd, 1, UPGRADE_ACK_SECS * 1000) <= 0 || !recvFd(s, tag, fd) || tag != 'A') {
+		if (fd >= 0) close(fd);
+		logf("Upgrade: new proxy did not confirm the handoff, still serving");
+		close(s);
+		return false;
+	}
+	// the new process re-creates the upgrade socket for the next upgrade
+	close(upgradeListenSock);
+	close(listenSock);
+
+	pthread_mutex_lock(&activeMutex);
+	logf("Upgrade: listening socket handed off, draining %d client(s)", activeClients);
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += DRAIN_TIMEOUT_SECS;
+	while (activeClients > 0) {
+		if (pthread_cond_timedwait(&activeCond, &activeMutex, &deadline) == ETIMEDOUT) break;
+	}
+	logf("Upgrade: drained, %d client(s) left", activeClients);
+	pthread_mutex_unlock(&activeMutex);
+	BufferPoolStats pool = BufferPool::instance().stats();
+	logf("Buffer pool: %llu acquires (%llu from thread caches), high water %llu buffers, %llu slab(s)",
+	     (unsigned long long)pool.acquires, (unsigned long long)pool.threadCacheHits,
+	     (unsigned long long)pool.highWater, (unsigned long long)pool.slabs);
+	Affinity &affinity = Affinity::instance();
+	if (affinity.enabled()) {
+		logf("Affinity: %lu connection(s) steered by receive CPU, %lu by NIC node, %lu balanced",
+		     affinity.steeredRxCpu.load(), affinity.steeredNic.load(), affinity.balanced.load());
+	}
+	sendFd(s, 'E', -1);
+	close(s);
+	return true;
+}
+
 int main(int argc, char *argv[]) 
 {
 	// ignore SIGPIPE to avoid dying if writing to closed sockets
@@ -857,7 +872,51 @@ int main(int argc, char *argv[])
 	// load single forbidden list file
 	loadForbiddenSingleFile("forbidden.txt");
 
-	const char *port = (argc >= 2) ? argv[1] : DEFAULT_PORT;
+	// options: [-u upgrade_socket] [--takeover] [--affinity] [--trace file] [port]
+	std::string upgradePath = UPGRADE_SOCKET_PATH;
+	bool takeover = false;
+	bool affinity = false;
+	std::string tracePath;
+	static struct option longOpts[] = {
+		{"takeover", no_argument, nullptr, 'T'},
+		{"affinity", no_argument, nullptr, 'A'},
+		{"trace", required_argument, nullptr, 'D'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "u:", longOpts, nullptr)) != -1) {
+		switch (opt) {
+		case 'u': upgradePath = optarg; break;
+		case 'T': takeover = true; break;
+		case 'A': affinity = true; break;
+		case 'D': tracePath = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-u upgrade_socket] [--takeover] [--affinity] [--trace file] [port]\n", argv[0]);
+			return 1;
+		}
+	}
+	const char *port = (optind < argc) ? argv[optind] : DEFAULT_PORT;
+	if (!tracePath.empty()) {
+		if (Trace::enable(tracePath, "proxy_http")) logf("Tracing requests; kill -USR1 %d writes %s", (int)getpid(), tracePath.c_str());
+		else logf("Tracing could not be enabled");
+	}
+	if (affinity) {
+		if (Affinity::instance().enable()) {
+			logf("Affinity: client threads pinned across %zu NUMA node(s)", Affinity::instance().nodeCount());
+		} else {
+			logf("Affinity: no usable CPUs found, client threads stay unpinned");
+		}
+	}
+
+	int listenSock = -1;
+	if (takeover) {
+		listenSock = takeOverListenSocket(upgradePath);
+		if (listenSock < 0) {
+			fprintf(stderr, "takeover: no running proxy at %s\n", upgradePath.c_str());
+			return 1;
+		}
+		logf("Took over listening socket from previous proxy");
+	}
 
 	// set up listening socket
 	struct addrinfo hints {
@@ -865,14 +924,13 @@ int main(int argc, char *argv[])
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
-	int rv = getaddrinfo(NULL, port, &hints, &res);
+	int rv = takeover ? 0 : getaddrinfo(NULL, port, &hints, &res);
 	if (rv != 0) {
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
 		return 1;
 	}
-	int listenSock = -1;
 	struct addrinfo *p;
-	for (p = res; p != NULL; p = p->ai_next) {
+	for (p = takeover ? NULL : res; p != NULL; p = p->ai_next) {
 		listenSock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
 		if (listenSock < 0) continue;
 		int yes = 1;
@@ -884,35 +942,78 @@ int main(int argc, char *argv[])
 		}
 		break;
 	}
-	freeaddrinfo(res);
+	if (!takeover) freeaddrinfo(res);
 	if (listenSock < 0) {
 		fprintf(stderr, "Failed to bind to port %s\n", port);
 		return 1;
 	}
-	if (listen(listenSock, BACKLOG) < 0) {
+	if (!takeover && listen(listenSock, BACKLOG) < 0) {
 		perror("listen");
 		return 1;
 	}
+	// the listening socket may later be shared with a new process; never block in accept
+	fcntl(listenSock, F_SETFL, fcntl(listenSock, F_GETFL) | O_NONBLOCK);
+	int upgradeListenSock = listenUnix(upgradePath, 1);
+	if (upgradeListenSock < 0) perror("upgrade socket");
 	logf("Proxy listening on port %s", port);
 
 	while (true) {
+		struct pollfd fds[2];
+		nfds_t nfds = 1;
+		fds[0].fd = listenSock;
+		fds[0].events = POLLIN;
+		if (upgradeListenSock >= 0) {
+			fds[1].fd = upgradeListenSock;
+			fds[1].events = POLLIN;
+			nfds = 2;
+		}
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		if (nfds == 2 && (fds[1].revents & POLLIN)) {
+			// a new binary started with --takeover: hand off and exit once
+			// drained; if it never confirms, keep serving
+			if (handOffAndDrain(upgradeListenSock, listenSock)) return 0;
+			continue;
+		}
+		if (!(fds[0].revents & POLLIN)) continue;
 		struct sockaddr_storage clientAddr;
 		socklen_t addrlen = sizeof(clientAddr);
 		int clientSock = accept(listenSock, (struct sockaddr*)&clientAddr, &addrlen);
 		if (clientSock < 0) {
-			if (errno == EINTR) continue;
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) continue;
 			perror("accept");
 			break;
 		}
 		// optionally set socket options (timeouts) here
-		// spawn thread
+		// spawn thread, created straight on its core when --affinity placed it
 		pthread_t tid;
-		int *pclient = (int*)malloc(sizeof(int));
-		*pclient = clientSock;
-		if (pthread_create(&tid, NULL, client_thread, pclient) != 0) {
+		int *pclient = (int*)malloc(2 * sizeof(int));
+		pclient[0] = clientSock;
+		pclient[1] = Affinity::instance().placeConnection(clientSock);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (pclient[1] >= 0) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(pclient[1], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		pthread_mutex_lock(&activeMutex);
+		activeClients++;
+		pthread_mutex_unlock(&activeMutex);
+		int created = pthread_create(&tid, &attr, client_thread_counted, pclient);
+		pthread_attr_destroy(&attr);
+		if (created != 0) {
 			logf("pthread_create failed");
+			if (pclient[1] >= 0) Affinity::instance().releaseCpu(pclient[1]);
 			close(clientSock);
 			free(pclient);
+			pthread_mutex_lock(&activeMutex);
+			activeClients--;
+			pthread_mutex_unlock(&activeMutex);
 		} else {
 			pthread_detach(tid);
 		}
@@ -3,7 +3,9 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -22,9 +24,17 @@
 #include <sstream>
 #include <string>
 
+#include "../common/UnixSock.h"
+#include "../common/BufferPool.h"
+#include "../common/Affinity.h"
+#include "../common/Trace.h"
+
 #define DEFAULT_PORT "5465"
 #define BACKLOG 128
-#define BUF_SIZE 65536
 #define LOGFILE "proxy_http.log"
+#define UPGRADE_SOCKET_PATH "proxy_http.upgrade.sock"
+#define DRAIN_TIMEOUT_SECS 300
+// the new process must confirm it holds the listening socket within this long
+#define UPGRADE_ACK_SECS 10
 
 #endif // PROXY_HTTP_H
\ No newline at end of file